@@ -0,0 +1,105 @@
+#include "align.h"
+using namespace std;
+
+// A part of both sequences that's still to be aligned
+struct Part
+{
+	size_t a0, a1;
+	size_t b0, b1;
+};
+
+// Finds the longest run of anchors with increasing b-indices (patience
+// sorting). The anchors are in order of their a-index.
+static void Increasing(const vector<pair<size_t, size_t> >& anchors, vector<size_t>& result)
+{
+	vector<size_t> tails;		// Per length, the anchor that ends the best run of it
+	vector<size_t> prev(anchors.size());
+	for (size_t i = 0; i < anchors.size(); i++)
+	{
+		size_t low = 0, high = tails.size();
+		while (low < high)
+		{
+			size_t mid = (low + high) / 2;
+			if (anchors[tails[mid]].second < anchors[i].second) low  = mid + 1;
+			else                                                high = mid;
+		}
+		prev[i] = (low > 0) ? tails[low - 1] : (size_t)-1;
+		if (low == tails.size()) tails.push_back(i);
+		else                     tails[low] = i;
+	}
+
+	result.resize(tails.size());
+	size_t i = tails.empty() ? (size_t)-1 : tails.back();
+	for (size_t n = tails.size(); n > 0; n--, i = prev[i])
+	{
+		result[n - 1] = i;
+	}
+}
+
+void align(const vector<uint32_t>& a, const vector<uint32_t>& b, size_t nSymbols, vector<uint32_t>& match)
+{
+	match.assign(a.size(), NO_MATCH);
+
+	vector<uint32_t> countA(nSymbols), countB(nSymbols);
+	vector<size_t>   posB(nSymbols);
+	vector<pair<size_t, size_t> > anchors;
+	vector<size_t>   chosen;
+
+	vector<Part> parts;
+	Part all = {0, a.size(), 0, b.size()};
+	parts.push_back(all);
+	while (!parts.empty())
+	{
+		Part part = parts.back();
+		parts.pop_back();
+
+		// Match the equal start and end
+		while (part.a0 < part.a1 && part.b0 < part.b1 && a[part.a0] == b[part.b0])
+		{
+			match[part.a0++] = (uint32_t)part.b0++;
+		}
+		while (part.a0 < part.a1 && part.b0 < part.b1 && a[part.a1 - 1] == b[part.b1 - 1])
+		{
+			match[--part.a1] = (uint32_t)--part.b1;
+		}
+		if (part.a0 == part.a1 || part.b0 == part.b1)
+		{
+			continue;
+		}
+
+		// Find the symbols that occur once on both sides
+		for (size_t i = part.a0; i < part.a1; i++) countA[a[i]]++;
+		for (size_t j = part.b0; j < part.b1; j++) { countB[b[j]]++; posB[b[j]] = j; }
+
+		anchors.clear();
+		for (size_t i = part.a0; i < part.a1; i++)
+		{
+			if (countA[a[i]] == 1 && countB[a[i]] == 1)
+			{
+				anchors.push_back(make_pair(i, posB[a[i]]));
+			}
+		}
+
+		for (size_t i = part.a0; i < part.a1; i++) countA[a[i]] = 0;
+		for (size_t j = part.b0; j < part.b1; j++) countB[b[j]] = 0;
+
+		// Without anchors, the rest of the part stays unmatched
+		Increasing(anchors, chosen);
+		size_t a0 = part.a0, b0 = part.b0;
+		for (vector<size_t>::const_iterator c = chosen.begin(); c != chosen.end(); c++)
+		{
+			const pair<size_t, size_t>& anchor = anchors[*c];
+			match[anchor.first] = (uint32_t)anchor.second;
+
+			Part between = {a0, anchor.first, b0, anchor.second};
+			parts.push_back(between);
+			a0 = anchor.first  + 1;
+			b0 = anchor.second + 1;
+		}
+		if (!chosen.empty())
+		{
+			Part last = {a0, part.a1, b0, part.b1};
+			parts.push_back(last);
+		}
+	}
+}
\ No newline at end of file
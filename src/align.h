@@ -0,0 +1,20 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <vector>
+#include "types.h"
+
+static const uint32_t NO_MATCH = 0xFFFFFFFF;
+
+// Aligns two sequences of symbols (e.g., names that were numbered) with a
+// patience diff: symbols that occur once in both sequences are anchors, the
+// longest run of anchors that's in the same order in both is matched, and
+// the parts between them are aligned the same way. Equal symbols at the
+// start and end of a part are matched directly.
+//
+// Fills match with, for every element of a, the index of the element of b
+// it matches, or NO_MATCH. Matches are in increasing order of b. Symbols
+// must be smaller than nSymbols.
+void align(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, size_t nSymbols, std::vector<uint32_t>& match);
+
+#endif
\ No newline at end of file
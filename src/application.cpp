@@ -26,6 +26,10 @@ static const int MIN_WINDOW_HEIGHT = 400;
 static const int INITIAL_WINDOW_WIDTH  = 860;
 static const int INITIAL_WINDOW_HEIGHT = 600;
 
+// The journal is written every this many milliseconds, if it changed
+static const UINT JOURNAL_TIMER          = 1;
+static const UINT JOURNAL_FLUSH_INTERVAL = 1000;
+
 enum
 {
 	COLUMN_NAME = 1,
@@ -314,43 +318,30 @@ void Application::OnStringFocused()
 			item.iSubItem = 0;
 			
 			int version = document->getActiveVersion();
-			for (int v = version; v >= 0; v--)
+			vector<int> versions;
+			document->getHistory(id, versions);
+			for (vector<int>::const_iterator v = versions.begin(); v != versions.end(); v++)
 			{
-				const Document::StringInfo& str = document->getString(id, v);
-				const wchar_t*              val = document->getValue(id, v);
+				const Document::StringInfo& str = document->getString(id, *v);
+				const wchar_t*              val = document->getValue(id, *v);
 
-				set<LANGID> languages;
-				document->getLanguages(languages, v);
-				if (languages.find(document->getActiveLanguage()) == languages.end())
+				item.pszText = L"";
+				item.lParam  = (LPARAM)*v;
+				if (*v < version)
 				{
-					break;
+					wchar_t tmp[16];
+					wsprintf(tmp, L"%d", *v + 1);
+					item.pszText = tmp;
 				}
 
-				if (v == version || document->hasStringChanged(id, v) || document->hasValueChanged(id, v))
-				{
-					item.pszText = L"";
-					item.lParam  = (LPARAM)v;
-					if (v < version)
-					{
-						wchar_t tmp[16];
-						wsprintf(tmp, L"%d", v + 1);
-						item.pszText = tmp;
-					}
-
-					wstring modified = DateTime(str.m_modified).formatDateShort();
-
-					ListView_InsertItem(hHistory, &item);
-					ListView_SetItemText(hHistory, item.iItem, 1, (LPTSTR)str.m_name);
-					ListView_SetItemText(hHistory, item.iItem, 2, (LPTSTR)val);
-					ListView_SetItemText(hHistory, item.iItem, 3, (LPTSTR)str.m_comment);
-					ListView_SetItemText(hHistory, item.iItem, 4, (LPTSTR)modified.c_str());
-					item.iItem++;
-				}
+				wstring modified = DateTime(str.m_modified).formatDateShort();
 
-				if (str.m_flags & SF_NEW)
-				{
-					break;
-				}			
+				ListView_InsertItem(hHistory, &item);
+				ListView_SetItemText(hHistory, item.iItem, 1, (LPTSTR)str.m_name);
+				ListView_SetItemText(hHistory, item.iItem, 2, (LPTSTR)val);
+				ListView_SetItemText(hHistory, item.iItem, 3, (LPTSTR)str.m_comment);
+				ListView_SetItemText(hHistory, item.iItem, 4, (LPTSTR)modified.c_str());
+				item.iItem++;
 			}
 
 			// Select top entry (current version)
@@ -501,8 +492,8 @@ void Application::FillLanguageList()
 // Compares two entries in the list view
 int Application::StringCompareFunc(LPARAM lParam1, LPARAM lParam2) const
 {
-	const vector<Document::StringInfo>& strings = document->getStrings();
-	const vector<const wchar_t*>&       values  = document->getValues();
+	const Document::StringArray&      strings = document->getStrings();
+	const Document::ValueArray&       values  = document->getValues();
 
 	// Make sure the negative items (i.e, the <new string here>) always end up at the end
 	if (lParam1 < 0 && lParam2 < 0) return 0;
@@ -537,8 +528,8 @@ void Application::FillListView()
 	if (document != NULL)
 	{
 
-		const vector<Document::StringInfo>& strings = document->getStrings();
-		const vector<const wchar_t*>&       values  = document->getValues();
+		const Document::StringArray&      strings = document->getStrings();
+		const Document::ValueArray&       values  = document->getValues();
 
 		vector<Document::VersionInfo> versions;
 		document->getVersions(versions);
@@ -618,7 +609,7 @@ void Application::FillListViewValues()
 {
 	if (document != NULL)
 	{
-		const vector<const wchar_t*>& values  = document->getValues();
+		const Document::ValueArray& values = document->getValues();
 
 		LVITEM item;
 		item.mask     = LVIF_PARAM;
@@ -682,8 +673,10 @@ void Application::DoOpenFile()
 		try
 		{
 			PhysicalFile file(filename);
-			document = new Document(file);
+			MappedFile   mapped(file);
+			document = new Document(mapped);
 			this->filename = filename;
+			OpenJournal(true);
 			
 			if (document->getType() == Document::DT_NAME)
 			{
@@ -756,8 +749,22 @@ bool Application::DoSave(bool saveas)
 			try
 			{
 				document->saveVersion(versioninfo.author, versioninfo.notes);
-				PhysicalFile file(filename, PhysicalFile::WRITE);
-				document->write(file);
+				document->detach();
+				if (!saveas && document->canAppend())
+				{
+					// Only write what changed to the file it came from
+					PhysicalFile file(filename, PhysicalFile::UPDATE);
+					BufferedFile buffered(file);
+					document->append(buffered);
+					buffered.flush();
+				}
+				else
+				{
+					PhysicalFile file(filename, PhysicalFile::WRITE);
+					BufferedFile buffered(file);
+					document->write(buffered);
+					buffered.flush();
+				}
 				document->increaseVersion();
 				document->setActiveVersion();
 				FillVersionList();
@@ -765,7 +772,11 @@ bool Application::DoSave(bool saveas)
 			catch (wexception&)
 			{
 				MessageBox(hMainWnd, LoadString(IDS_ERROR_FILE_SAVE).c_str(), NULL, MB_OK | MB_ICONERROR);
+				return false;
 			}
+
+			// The changes are saved, so the journal starts over
+			OpenJournal(false);
 		}
 	}
 	else if (!changed)
@@ -837,7 +848,8 @@ void Application::DoImportFile()
 					BusyCursor(IDC_WAIT);
 
 					PhysicalFile file(filename);
-					StringList strings(file);
+					MappedFile   mapped(file);
+					StringList strings(mapped);
 					document->addStrings(strings, method);
 
 					FillListView();
@@ -857,17 +869,10 @@ void Application::DoExportFile()
 	if (document != NULL)
 	{
 		// First, check if all names are valid
-		const vector<Document::StringInfo>& strings = document->getStrings();
-		for (size_t i = 0; i < strings.size(); i++)
+		if (document->hasInvalidNames())
 		{
-			if (strings[i].m_name != NULL)
-			{
-				if (!document->isValidName((unsigned int)i))
-				{
-					MessageBox(hMainWnd, LoadString(IDS_ERROR_INVALID_NAMES).c_str(), NULL, MB_OK | MB_ICONERROR);
-					return;
-				}
-			}
+			MessageBox(hMainWnd, LoadString(IDS_ERROR_INVALID_NAMES).c_str(), NULL, MB_OK | MB_ICONERROR);
+			return;
 		}
 
 		// Create the postfixes
@@ -877,9 +882,7 @@ void Application::DoExportFile()
 		{
 			if (p->second.empty())
 			{
-				// Uppercased english language name
-				p->second = L"_" + GetEnglishLanguageName(p->first);
-				transform(p->second.begin(), p->second.end(), p->second.begin(), toupper);
+				p->second = GetDefaultPostfix(p->first);
 			}
 		}
 
@@ -901,31 +904,48 @@ void Application::DoExportFile()
 			map<LANGID, wstring>::const_iterator p = postfixes.begin();
 			map<LANGID, bool>   ::const_iterator e = enabled.begin();
 
-			bool showmsg = false;
+			// Open the files, up to the first one that can't be created
+			vector<PhysicalFile*>       files;
+			vector<wstring>             filenames;
+			vector<Document::ExportJob> jobs;
+			wstring                     failed;
 			for (;p != postfixes.end(); p++, e++)
 			{
 				if (e->second)
 				{
-					// Export this file
-					showmsg = true;
 					document->setPostfix(p->first, p->second);
 					wstring filename = basename + p->second + ext;
-					
+
 					try
 					{
-						PhysicalFile file(filename, PhysicalFile::WRITE);
-						document->exportFile(p->first, file);
+						files.push_back(new PhysicalFile(filename, PhysicalFile::WRITE));
 					}
 					catch (wexception&)
 					{
-						MessageBox(hMainWnd, LoadString(IDS_ERROR_FILE_EXPORT, filename.c_str()).c_str(), NULL, MB_OK | MB_ICONERROR);
-						showmsg = false;
+						failed = filename;
 						break;
 					}
+					filenames.push_back(filename);
+					jobs.push_back(Document::ExportJob(p->first, files.back()));
 				}
 			}
 
-			if (showmsg)
+			// Export all languages at once
+			document->exportFiles(jobs);
+			for (size_t i = 0; i < jobs.size(); i++)
+			{
+				delete files[i];
+				if (jobs[i].m_failed && failed.empty())
+				{
+					failed = filenames[i];
+				}
+			}
+
+			if (!failed.empty())
+			{
+				MessageBox(hMainWnd, LoadString(IDS_ERROR_FILE_EXPORT, failed.c_str()).c_str(), NULL, MB_OK | MB_ICONERROR);
+			}
+			else if (!jobs.empty())
 			{
                 MessageBox(hMainWnd, LoadString(IDS_INFO_EXPORT_COMPLETE).c_str(), LoadString(IDS_INFORMATION).c_str(), MB_OK | MB_ICONINFORMATION);
 			}
@@ -945,6 +965,7 @@ bool Application::DoClose()
 				case IDCANCEL:	return false;
 			}
 		}
+		CloseJournal(true);
 		delete document;
 		document = NULL;
 	}
@@ -1200,8 +1221,8 @@ void Application::DoFind(bool showDialog)
 
 	if (!showDialog || Dialogs::Find(hMainWnd, findinfo))
 	{
-		const vector<Document::StringInfo>& strings = document->getStrings();
-		const vector<const wchar_t*>&       values  = document->getValues();
+		const Document::StringArray&      strings = document->getStrings();
+		const Document::ValueArray&       values  = document->getValues();
 
 		const wchar_t* term = findinfo.term.c_str();
 
@@ -1413,8 +1434,8 @@ bool Application::DoCopy()
 		item.mask     = LVIF_PARAM;
 		item.iItem    = -1;
 
-		const vector<Document::StringInfo>& strings = document->getStrings();
-		const vector<const wchar_t*>&       values  = document->getValues();
+		const Document::StringArray&      strings = document->getStrings();
+		const Document::ValueArray&       values  = document->getValues();
 
 		size_t   size   = 1024;
 		size_t   length = 0;
@@ -1494,7 +1515,12 @@ bool Application::DoPaste()
 			item.iItem = ListView_GetItemCount(hActiveListView) - 1;
 		}
 
+		// The strings in a batch all get the same time, so it's formatted once
+		uint64_t time = 0;
+		wstring  modified;
+
 		BusyCursor(IDC_WAIT);
+		document->beginBatch();
 		while (str != NULL && *str != L'\0')
 		{
 			// Get the line
@@ -1525,7 +1551,11 @@ bool Application::DoPaste()
 			unsigned int id = document->addString();
 			document->setString(id, newstr);
 			const Document::StringInfo& info = document->getString(id);
-			wstring modified = DateTime(info.m_modified).formatShort();
+			if (modified.empty() || info.m_modified != time)
+			{
+				time     = info.m_modified;
+				modified = DateTime(time).formatShort();
+			}
 
 			// Insert the item
 			item.lParam = id;
@@ -1554,6 +1584,7 @@ bool Application::DoPaste()
 				item.iItem++;
 			}
 		}
+		document->commitBatch();
 		return true;
 	}
 	return false;
@@ -1611,7 +1642,6 @@ bool Application::DoPasteSpecial(Document::Method method)
 		str = nl;
 	}
 
-	strings.sort();
 	document->addStrings(strings, method);
 	FillListView();
 	SetFocus(hActiveListView);
@@ -1664,7 +1694,7 @@ void Application::DoFindNextInvalid()
 {
 	if (document != NULL)
 	{
-		const vector<Document::StringInfo>& strings = document->getStrings();
+		const Document::StringArray& strings = document->getStrings();
 		
 		LVITEM item;
 		item.mask     = LVIF_PARAM;
@@ -1672,6 +1702,12 @@ void Application::DoFindNextInvalid()
 		item.iItem    = ListView_GetNextItem(hActiveListView, -1, LVNI_FOCUSED) + 1;
 		item.iSubItem = 0;
 
+		if (!document->hasInvalidNames())
+		{
+			// Nothing to look for
+			item.iItem = count;
+		}
+
 		BusyCursor(IDC_WAIT);
 		while (item.iItem < count)
 		{
@@ -1711,8 +1747,8 @@ void Application::SwapStrings(int id1, int pos1, int id2, int pos2)
 		document->setPosition(id2, pos1);
 
 		// Update listview
-		const vector<Document::StringInfo>& strings = document->getStrings();
-		const vector<const wchar_t*>&       values  = document->getValues();
+		const Document::StringArray&      strings = document->getStrings();
+		const Document::ValueArray&       values  = document->getValues();
 
 		LVITEM item;
 		item.iSubItem = 0;
@@ -1742,7 +1778,7 @@ void Application::SwapValues(int id1, int pos1, int id2, int pos2)
 {
 	if (id1 >= 0 && id2 >= 0)
 	{
-		const vector<const wchar_t*>& values = document->getValues();
+		const Document::ValueArray& values = document->getValues();
 
 		Document::String str1;
 		str1.m_flags = Document::String::SF_VALUE;
@@ -1756,7 +1792,7 @@ void Application::SwapValues(int id1, int pos1, int id2, int pos2)
 		document->setString(id2, str2);
 
 		// Update listview
-		const vector<Document::StringInfo>& strings = document->getStrings();
+		const Document::StringArray& strings = document->getStrings();
 
 		wstring modified = DateTime(strings[id1].m_modified).formatShort();
 		ListView_SetItemText(hActiveListView, pos1, 1, (LPWSTR)str1.m_value.c_str());
@@ -1786,6 +1822,9 @@ void Application::DoMoveStrings(bool up, void (Application::*callback)(int, int,
 			selection.insert(item1.iItem);
 		}
 
+		set<int> moved;
+		document->beginBatch();
+
 		if (up)
 		{
 			// When moving up we need to start swapping at the top and move down
@@ -1797,6 +1836,8 @@ void Application::DoMoveStrings(bool up, void (Application::*callback)(int, int,
 				ListView_GetItem(hActiveListView, &item2);
 
 				(this->*callback)((int)item2.lParam, item2.iItem, (int)item1.lParam, item1.iItem);
+				moved.insert(item1.iItem);
+				moved.insert(item2.iItem);
 
 				ListView_SetItemState(hActiveListView, item1.iItem, 0, LVIS_SELECTED);
 				ListView_SetItemState(hActiveListView, item2.iItem, LVIS_SELECTED, LVIS_SELECTED);
@@ -1817,6 +1858,8 @@ void Application::DoMoveStrings(bool up, void (Application::*callback)(int, int,
 				ListView_GetItem(hActiveListView, &item2);
 
 				(this->*callback)((int)item1.lParam, item1.iItem, (int)item2.lParam, item2.iItem);
+				moved.insert(item1.iItem);
+				moved.insert(item2.iItem);
 
 				ListView_SetItemState(hActiveListView, item1.iItem, 0, LVIS_SELECTED);
 				ListView_SetItemState(hActiveListView, item2.iItem, LVIS_SELECTED, LVIS_SELECTED);
@@ -1827,6 +1870,20 @@ void Application::DoMoveStrings(bool up, void (Application::*callback)(int, int,
 			}
 		}
 
+		document->commitBatch();
+
+		// The modification times are known after the batch
+		const Document::StringArray& strings = document->getStrings();
+		for (set<int>::const_iterator p = moved.begin(); p != moved.end(); p++)
+		{
+			int id = (int)ListView_GetItemParam(hActiveListView, *p);
+			if (id >= 0)
+			{
+				wstring modified = DateTime(strings[id].m_modified).formatShort();
+				ListView_SetItemText(hActiveListView, *p, 3, (LPWSTR)modified.c_str());
+			}
+		}
+
 		// Focus could have changed, update
 		OnStringFocused();
 	}
@@ -2220,9 +2277,17 @@ LRESULT Application::WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
 				DestroyWindow(hToolbar);
 				return -1;
 			}
+			SetTimer(hWnd, JOURNAL_TIMER, JOURNAL_FLUSH_INTERVAL, NULL);
 			break;
 		}
 
+		case WM_TIMER:
+			if (wParam == JOURNAL_TIMER && journal != NULL)
+			{
+				FlushJournal();
+			}
+			break;
+
 		case WM_CLOSE:
 			if (DoMenuItem(ID_FILE_EXIT))
 			{
@@ -2231,6 +2296,7 @@ LRESULT Application::WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
 			return 0;
 
 		case WM_DESTROY:
+			KillTimer(hWnd, JOURNAL_TIMER);
 			DestroyWindow(hLanguageSelect);
 			DestroyWindow(hVersionSelect);
 			DestroyWindow(hToolbar);
@@ -2402,6 +2468,124 @@ int Application::run()
 	return (int)msg.wParam;
 }
 
+// Starts recording the changes to the document in a journal next to its file.
+// The changes in the journal that were never saved can be recovered.
+void Application::OpenJournal(bool recover)
+{
+	wstring name = filename + L".journal";
+	if (journal != NULL && journalName == name)
+	{
+		// The document was saved, so there's nothing to recover
+		try
+		{
+			journal->reset(*document);
+			return;
+		}
+		catch (wexception&)
+		{
+		}
+	}
+	CloseJournal(true);
+
+	try
+	{
+		try
+		{
+			journalFile = new PhysicalFile(name, PhysicalFile::UPDATE);
+		}
+		catch (FileNotFoundException&)
+		{
+			journalFile = new PhysicalFile(name, PhysicalFile::WRITE);
+		}
+		journalName = name;
+		journal     = new Journal(*journalFile, *document);
+
+		if (journal->hasRecords())
+		{
+			if (recover && MessageBox(hMainWnd, LoadString(IDS_QUERY_RECOVER_CHANGES).c_str(), LoadString(IDS_TITLE_RECOVER_CHANGES).c_str(), MB_YESNO | MB_ICONQUESTION) == IDYES)
+			{
+				try
+				{
+					document->replay(*journal);
+				}
+				catch (wexception&)
+				{
+					// Some changes were made, but not all; start over from the
+					// file. The journal is kept under another name for the user.
+					CloseJournal(false);
+					wstring kept = name + L".failed";
+					if (!MoveFileEx(name.c_str(), kept.c_str(), MOVEFILE_REPLACE_EXISTING))
+					{
+						kept = name;
+					}
+
+					delete document;
+					document = NULL;
+					PhysicalFile file(filename);
+					MappedFile   mapped(file);
+					document = new Document(mapped);
+					MessageBox(hMainWnd, LoadString(IDS_ERROR_RECOVER_CHANGES, kept.c_str()).c_str(), NULL, MB_OK | MB_ICONERROR);
+					if (kept == name)
+					{
+						// Continue without a journal rather than overwrite it
+						return;
+					}
+
+					journalFile = new PhysicalFile(name, PhysicalFile::WRITE);
+					journalName = name;
+					journal     = new Journal(*journalFile, *document);
+				}
+			}
+			else
+			{
+				journal->reset(*document);
+			}
+		}
+		document->setJournal(journal);
+	}
+	catch (wexception&)
+	{
+		// Continue without a journal, but leave the file alone
+		CloseJournal(false);
+		if (document == NULL)
+		{
+			throw;
+		}
+	}
+}
+
+// Stops recording changes. The journal is removed when its changes were
+// saved or thrown away.
+void Application::CloseJournal(bool remove)
+{
+	if (document != NULL)
+	{
+		document->setJournal(NULL);
+	}
+	delete journal;
+	delete journalFile;
+	journal     = NULL;
+	journalFile = NULL;
+
+	if (remove && !journalName.empty())
+	{
+		DeleteFile(journalName.c_str());
+	}
+	journalName.clear();
+}
+
+void Application::FlushJournal()
+{
+	try
+	{
+		journal->flush();
+	}
+	catch (wexception&)
+	{
+		CloseJournal(false);
+	}
+}
+
 bool Application::initialize()
 {
 	INITCOMMONCONTROLSEX icce = {
@@ -2454,6 +2638,8 @@ Application::Application(HINSTANCE _hInstance)
 	hActiveListView = NULL;
 	sorting         = 0;			// Not sorted
 	locked          = false;
+	journalFile     = NULL;
+	journal         = NULL;
 
 	if (!initialize())
 	{
@@ -2463,6 +2649,7 @@ Application::Application(HINSTANCE _hInstance)
 
 Application::~Application()
 {
+	CloseJournal(false);
 	delete document;
 	DestroyWindow(hMainWnd);
 	UnregisterClass(L"VDFEditor", hInstance);
@@ -3,6 +3,7 @@
 
 #include <string>
 #include "dialogs.h"
+#include "journal.h"
 
 class IWindow
 {
@@ -90,6 +91,11 @@ private:
 	void SwapValues(int id1, int pos1, int id2, int pos2);
 	bool initialize();
 
+	// Journal functions
+	void OpenJournal(bool recover);
+	void CloseJournal(bool remove);
+	void FlushJournal();
+
 	//
 	// Members
 	//
@@ -109,6 +115,10 @@ private:
 	bool		 locked;		// When true, don't act upon notifications
 	HWND		 hwndFocus;		// Last window to have focus
 	FIND_INFO    findinfo;		// Latest find options
+
+	std::wstring  journalName;	// The journal of the document's file, if any
+	PhysicalFile* journalFile;
+	Journal*      journal;
 };
 
 #endif
\ No newline at end of file
@@ -3,6 +3,25 @@
 #include "utils.h"
 using namespace std;
 
+// Files named "mem:<name>" are kept in memory for the commands that follow,
+// so a file that's only used by a later command never goes to disk
+static map<wstring, vector<char> > MemoryFiles;
+
+static bool IsMemoryFile(const wstring& filename)
+{
+	return filename.compare(0, 4, L"mem:") == 0;
+}
+
+static const vector<char>& GetMemoryFile(const wstring& filename)
+{
+	map<wstring, vector<char> >::const_iterator p = MemoryFiles.find(filename);
+	if (p == MemoryFiles.end())
+	{
+		throw runtime_error("unable to open " + WideToAnsi(filename) + "; it hasn't been written yet");
+	}
+	return p->second;
+}
+
 static LANGID ParseLanguage(const string& str)
 {
 	char* endptr;
@@ -80,7 +99,15 @@ public:
 			delete document;
 			document = NULL;
 		}
-		PhysicalFile input(filename);
+		if (IsMemoryFile(filename))
+		{
+			const vector<char>& data = GetMemoryFile(filename);
+			ConstMemoryFile input(data.empty() ? NULL : &data[0], (unsigned long)data.size());
+			document = new Document(input);
+			return;
+		}
+		PhysicalFile file(filename);
+		MappedFile   input(file);
 		document = new Document(input);
 	}
 
@@ -125,9 +152,31 @@ public:
 			throw runtime_error("unable to import; specified method cannot be used with document type");
 		}
 
-		PhysicalFile input(filename);
-		StringList strings(input);
-		document->addStrings(strings, method);
+		Document::ImportReport report;
+		if (IsMemoryFile(filename))
+		{
+			const vector<char>& data = GetMemoryFile(filename);
+			ConstMemoryFile input(data.empty() ? NULL : &data[0], (unsigned long)data.size());
+			StringList strings(input);
+			document->addStrings(strings, method, &report);
+		}
+		else
+		{
+			PhysicalFile file(filename);
+			MappedFile   input(file);
+			StringList strings(input);
+			document->addStrings(strings, method, &report);
+		}
+		if (method == Document::AM_OVERWRITE)
+		{
+			printf("Overwrote %lu strings; moved %lu in %lu blocks; inserted %lu in %lu blocks; %lu in %lu blocks not in file\n",
+				report.m_overwritten, report.m_moved, report.m_movedBlocks, report.m_inserted, report.m_insertedBlocks,
+				report.m_missing, report.m_missingBlocks);
+		}
+		else
+		{
+			printf("Added %lu strings; overwrote %lu; removed %lu\n", report.m_inserted, report.m_overwritten, report.m_removed);
+		}
 	}
 
 	static ICommand* parse(vector<string>::const_iterator& arg, const vector<string>::const_iterator& end)
@@ -176,15 +225,18 @@ public:
 		}
 
 		// Check if all names are valid
-		const vector<Document::StringInfo>& strings = document->getStrings();
-		for (size_t i = 0; i < strings.size(); i++)
+		if (document->hasInvalidNames())
 		{
-			if (strings[i].m_name != NULL && !document->isValidName((unsigned int)i))
-			{
-				throw runtime_error("unable to export; this file contains invalid names");
-			}
+			throw runtime_error("unable to export; this file contains invalid names");
 		}
 
+		if (IsMemoryFile(filename))
+		{
+			MemoryFile output;
+			document->exportFile(language, output);
+			output.swap(MemoryFiles[filename]);
+			return;
+		}
 		PhysicalFile output(filename, PhysicalFile::WRITE);
 		document->exportFile(language, output);
 	}
@@ -205,6 +257,97 @@ public:
 	}
 };
 
+//
+// Command: export-all
+//
+class CommandExportAll : public ICommand
+{
+	wstring basename;
+
+public:
+	void execute(Document* &document)
+	{
+		if (document == NULL)
+		{
+			throw runtime_error("unable to export; please create or open a document first");
+		}
+
+		// Check if all names are valid
+		if (document->hasInvalidNames())
+		{
+			throw runtime_error("unable to export; this file contains invalid names");
+		}
+
+		// The postfix of each language goes before the extension
+		wstring base = basename;
+		wstring ext  = L".DAT";
+		size_t slash  = base.find_last_of(L"\\/");
+		size_t period = base.find_last_of(L".");
+		if (period != wstring::npos && (slash == wstring::npos || period > slash))
+		{
+			ext  = base.substr(period);
+			base = base.substr(0, period);
+		}
+
+		set<LANGID> languages;
+		document->getLanguages(languages);
+		const map<LANGID, wstring>& postfixes = document->getPostfixes();
+
+		vector<IFile*>              files;
+		vector<wstring>             filenames;
+		vector<Document::ExportJob> jobs;
+		try
+		{
+			for (set<LANGID>::const_iterator l = languages.begin(); l != languages.end(); l++)
+			{
+				map<LANGID, wstring>::const_iterator p = postfixes.find(*l);
+				wstring postfix = (p != postfixes.end() && !p->second.empty()) ? p->second : GetDefaultPostfix(*l);
+				filenames.push_back(base + postfix + ext);
+				if (IsMemoryFile(filenames.back()))
+					files.push_back(new MemoryFile());
+				else
+					files.push_back(new PhysicalFile(filenames.back(), PhysicalFile::WRITE));
+				jobs.push_back(Document::ExportJob(*l, files.back()));
+			}
+
+			// Export all languages at once
+			document->exportFiles(jobs);
+		}
+		catch (...)
+		{
+			for (size_t i = 0; i < files.size(); i++) delete files[i];
+			throw;
+		}
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			if (IsMemoryFile(filenames[i]))
+			{
+				((MemoryFile*)files[i])->swap(MemoryFiles[filenames[i]]);
+			}
+			delete files[i];
+		}
+
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			if (jobs[i].m_failed)
+			{
+				throw runtime_error("unable to export; could not write " + WideToAnsi(filenames[i]));
+			}
+		}
+	}
+
+	static ICommand* parse(vector<string>::const_iterator& arg, const vector<string>::const_iterator& end)
+	{
+		if (arg == end) throw ParseException("expected base filename");
+		return new CommandExportAll(*arg++);
+	}
+
+	CommandExportAll(const string& basename)
+	{
+		this->basename = AnsiToWide(basename);
+	}
+};
+
 //
 // Command: languages
 //
@@ -239,6 +382,136 @@ public:
 	}
 };
 
+//
+// Command: history
+//
+class CommandHistory : public ICommand
+{
+	wstring name;
+
+public:
+	void execute(Document* &document)
+	{
+		if (document == NULL)
+		{
+			throw runtime_error("unable to show history; please create or open a document first");
+		}
+
+		int id = document->findString(name.c_str());
+		if (id == -1)
+		{
+			throw runtime_error("unable to show history; specified string does not exist");
+		}
+
+		// Print the versions that changed the string, newest first
+		int         current = document->getActiveVersion();
+		vector<int> versions;
+		document->getHistory(id, versions);
+		for (vector<int>::const_iterator v = versions.begin(); v != versions.end(); v++)
+		{
+			const Document::StringInfo& str = document->getString(id, *v);
+			wstring modified = DateTime(str.m_modified).formatShort();
+			if (*v == current)
+				printf("current ");
+			else
+				printf("%7d ", *v + 1);
+			printf("%ls %ls: %ls\n", modified.c_str(), str.m_name, document->getValue(id, *v));
+		}
+	}
+
+	static ICommand* parse(vector<string>::const_iterator& arg, const vector<string>::const_iterator& end)
+	{
+		if (arg == end) throw ParseException("expected string name");
+		return new CommandHistory(*arg++);
+	}
+
+	CommandHistory(const string& name)
+	{
+		this->name = AnsiToWide(name);
+	}
+};
+
+//
+// Command: save
+//
+class CommandSave : public ICommand
+{
+	wstring author;
+	wstring filename;
+
+public:
+	void execute(Document* &document)
+	{
+		if (document == NULL)
+		{
+			throw runtime_error("unable to save; please create or open a document first");
+		}
+
+		if (!document->isModified())
+		{
+			printf("There are no changes since the last version; file not saved\n");
+			return;
+		}
+
+		document->saveVersion(author, L"");
+		if (IsMemoryFile(filename))
+		{
+			MemoryFile output;
+			document->write(output);
+			output.swap(MemoryFiles[filename]);
+		}
+		else
+		{
+			// The file may be the one the document was opened from
+			document->detach();
+			PhysicalFile file(filename, PhysicalFile::WRITE);
+			BufferedFile output(file);
+			document->write(output);
+			output.flush();
+		}
+		document->increaseVersion();
+		document->setActiveVersion();
+	}
+
+	static ICommand* parse(vector<string>::const_iterator& arg, const vector<string>::const_iterator& end)
+	{
+		if (arg == end) throw ParseException("expected author");
+		const string& author = *arg++;
+
+		if (arg == end) throw ParseException("expected filename");
+		return new CommandSave(author, *arg++);
+	}
+
+	CommandSave(const string& author, const string& filename)
+	{
+		this->author   = AnsiToWide(author);
+		this->filename = AnsiToWide(filename);
+	}
+};
+
+//
+// Command: vacuum
+//
+class CommandVacuum : public ICommand
+{
+public:
+	void execute(Document* &document)
+	{
+		if (document == NULL)
+		{
+			throw runtime_error("unable to vacuum; please create or open a document first");
+		}
+
+		size_t reclaimed = document->vacuum();
+		printf("Reclaimed %lu bytes\n", (unsigned long)reclaimed);
+	}
+
+	static ICommand* parse(vector<string>::const_iterator& arg, const vector<string>::const_iterator& end)
+	{
+		return new CommandVacuum();
+	}
+};
+
 //
 // Commands list
 //
@@ -252,13 +525,17 @@ struct COMMAND
 //
 // IMPORTANT: ALWAYS make sure this array is sorted on the command name (for the binary search)
 //
-static const int N_COMMANDS = 5;
+static const int N_COMMANDS = 9;
 COMMAND Commands[N_COMMANDS] = {
 	{"export",		CommandExport::parse},
+	{"export-all",	CommandExportAll::parse},
+	{"history",		CommandHistory::parse},
 	{"import",		CommandImport::parse},
 	{"languages",	CommandLanguages::parse},
 	{"new",			CommandNew::parse},
 	{"open",		CommandOpen::parse},
+	{"save",		CommandSave::parse},
+	{"vacuum",		CommandVacuum::parse},
 };
 
 ICommand* ParseCommand(vector<string>::const_iterator& arg, const vector<string>::const_iterator& end)
@@ -1,6 +1,8 @@
 #ifndef CRC32_H
 #define CRC32_H
 
+#include <cstddef>
+
 unsigned long crc32(const void *data, size_t size);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,12 @@
 #include "datetime.h"
+#ifndef _WIN32
+#include <ctime>
+#include <cwchar>
+#endif
 using namespace std;
 
+#ifdef _WIN32
+
 bool DateTime::operator < (const DateTime& dt) const
 {
 	return (CompareFileTime(&filetime, &dt.filetime) < 0);
@@ -115,3 +121,75 @@ DateTime::DateTime()
 	GetSystemTime(&systemtime);
 	SystemTimeToFileTime(&systemtime, &filetime);
 }
+
+
+#else
+
+// FILETIME counts 100-nanosecond ticks since 1601, time_t seconds since 1970
+static const uint64_t TICKS_PER_SECOND = 10000000;
+static const uint64_t EPOCH_DIFFERENCE = 11644473600ULL;
+
+static uint64_t GetTicks(const FILETIME& filetime)
+{
+	return ((uint64_t)filetime.dwHighDateTime << 32) | filetime.dwLowDateTime;
+}
+
+static wstring Format(const FILETIME& filetime, bool localTime, const wchar_t* format)
+{
+	time_t    seconds = (time_t)(GetTicks(filetime) / TICKS_PER_SECOND - EPOCH_DIFFERENCE);
+	struct tm time;
+	if (localTime)
+	{
+		localtime_r(&seconds, &time);
+	}
+	else
+	{
+		gmtime_r(&seconds, &time);
+	}
+
+	wchar_t buf[128];
+	size_t  len = wcsftime(buf, sizeof buf / sizeof *buf, format, &time);
+	return wstring(buf, len);
+}
+
+bool DateTime::operator < (const DateTime& dt) const
+{
+	return GetTicks(filetime) < GetTicks(dt.filetime);
+}
+
+wstring DateTime::formatDateShort(bool localTime)
+{
+	return Format(filetime, localTime, L"%x");
+}
+
+wstring DateTime::formatShort(bool localTime)
+{
+	return Format(filetime, localTime, L"%x, %H:%M");
+}
+
+wstring DateTime::format(bool localTime)
+{
+	return Format(filetime, localTime, L"%A, %B %d, %Y, %H:%M");
+}
+
+uint64_t DateTime::getEpochSeconds() const
+{
+	return GetTicks(filetime);
+}
+
+DateTime::DateTime(uint64_t epochSeconds)
+{
+	filetime.dwLowDateTime  = (DWORD)epochSeconds;
+	filetime.dwHighDateTime = (DWORD)(epochSeconds >> 32);
+}
+
+DateTime::DateTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t ticks = ((uint64_t)now.tv_sec + EPOCH_DIFFERENCE) * TICKS_PER_SECOND + now.tv_nsec / 100;
+	filetime.dwLowDateTime  = (DWORD)ticks;
+	filetime.dwHighDateTime = (DWORD)(ticks >> 32);
+}
+
+#endif
\ No newline at end of file
@@ -1,14 +1,30 @@
 #include <algorithm>
 #include "document.h"
+#include "journal.h"
+#include "align.h"
+#include "parallel.h"
 #include "exceptions.h"
 using namespace std;
 
+// Rows per journal record when an import is recorded
+static const size_t JOURNAL_ROWS = 256;
+
+const uint32_t Document::NO_CHANGE;
+
 void Document::setPostfix(LANGID language, const wstring& postfix )
 {
 	m_newPostfixes[language] = postfix;
+
+	if (m_journal != NULL)
+	{
+		m_journal->begin(Journal::JR_SET_POSTFIX);
+		m_journal->put(language);
+		m_journal->put(postfix);
+		m_journal->end();
+	}
 }
 
-const vector<const wchar_t*>& Document::getValues(LANGID language) const
+const Document::ValueArray& Document::getValues(LANGID language) const
 {
 	return m_curVersion->m_values.find(language)->second.m_virt;
 }
@@ -29,51 +45,81 @@ void Document::addLanguage(LANGID language)
 	Version&      version = m_versions.back();
 	StringValues& values  = version.m_values[language];
 	
-	values.m_virt.resize( version.m_strings.size() );
 	values.m_phys.resize( version.m_strings.size() );
+	values.m_virt.clear();
 
 	for (size_t i = 0; i < version.m_strings.size(); i++)
 	{
-		values.m_virt[i] = values.m_phys[i].c_str();
-		checkChangedAll((unsigned int)i);
+		if (version.m_strings[i].m_name != NULL)
+		{
+			values.m_virt.push_back(values.m_phys[i].c_str());
+			markChanged((unsigned int)i, true);
+		}
+		else
+		{
+			values.m_virt.push_back(NULL);
+		}
 	}
 
 	m_newPostfixes[language];
+
+	if (m_journal != NULL)
+	{
+		m_journal->begin(Journal::JR_ADD_LANGUAGE);
+		m_journal->put(language);
+		m_journal->end();
+	}
 }
 
 void Document::changeLanguage(LANGID from, LANGID to)
 {
 	Version& version = m_versions.back();
-	map<LANGID, StringValues>::const_iterator p = version.m_values.find(from);
+	map<LANGID, StringValues>::iterator p = version.m_values.find(from);
 	if (p != version.m_values.end() && version.m_values.find(to) == version.m_values.end())
 	{
+		// Swapping keeps the physical strings where they are, so the values
+		// that point to them stay valid
 		StringValues& values = version.m_values[to];
-		values.m_phys = p->second.m_phys;
-		version.m_values.erase(from);
+		values.m_phys.swap(p->second.m_phys);
+		values.m_virt.swap(p->second.m_virt);
+		version.m_values.erase(p);
 
 		if (m_curLanguage == from)
 		{
 			setActiveLanguage(to);
 		}
 
-		values.m_virt.resize( version.m_strings.size() );
 		for (size_t i = 0; i < version.m_strings.size(); i++)
 		{
 			if (version.m_strings[i].m_name != NULL)
 			{
-				values.m_virt[i] = values.m_phys[i].c_str();
+				markChanged((unsigned int)i, true);
 			}
-			checkChanged((unsigned int)i);
 		}
 
 		m_newPostfixes[to] = m_newPostfixes[from];
 		m_newPostfixes.erase(from);
+
+		if (m_journal != NULL)
+		{
+			m_journal->begin(Journal::JR_CHANGE_LANGUAGE);
+			m_journal->put(from);
+			m_journal->put(to);
+			m_journal->end();
+		}
 	}
 }
 
 void Document::deleteLanguage(LANGID language)
 {
 	m_versions.back().m_values.erase(language);
+
+	if (m_journal != NULL)
+	{
+		m_journal->begin(Journal::JR_DELETE_LANGUAGE);
+		m_journal->put(language);
+		m_journal->end();
+	}
 }
 
 bool Document::setActiveLanguage(LANGID language)
@@ -99,6 +145,10 @@ void Document::getVersions( std::vector<VersionInfo>& versions ) const
 
 const Document::StringInfo& Document::getString(unsigned int id, int version) const
 {
+	if (version >= 0)
+	{
+		load(version);
+	}
 	const Version* pVersion = (version < 0) ? m_curVersion : &m_versions[version];
 	return pVersion->m_strings[id];
 }
@@ -110,20 +160,148 @@ const wchar_t* Document::getValue(unsigned int id, int version) const
 		return m_curValues->m_virt[id];
 	}
 	
+	load(version);
 	map<LANGID, StringValues>::const_iterator p = m_versions[version].m_values.find(m_curLanguage);
 	return (p == m_versions[version].m_values.end()) ? NULL : p->second.m_virt[id];
 }
 
 bool Document::hasStringChanged(unsigned int id, int version) const
 {
+	if (version >= 0)
+	{
+		load(version);
+	}
 	const Version* pVersion = (version < 0) ? m_curVersion : &m_versions[version];
-	return pVersion->diff_strings.find(id) != pVersion->diff_strings.end();
+	return pVersion->diff_strings.contains(id);
 }
 
 bool Document::hasValueChanged(unsigned int id, int version) const
 {
+	if (version >= 0)
+	{
+		load(version);
+	}
 	const StringValues* values = (version < 0) ? m_curValues : &m_versions[version].m_values.find(m_curLanguage)->second;
-	return values->m_changed.find(id) != values->m_changed.end();
+	return values->m_changed.contains(id);
+}
+
+void Document::getHistory(unsigned int id, vector<int>& versions) const
+{
+	int version = getActiveVersion();
+	versions.push_back(version);
+
+	// Strings and languages that were added in the current version have no
+	// saved changes yet
+	bool added = (version == (int)m_versions.size() - 1 && (m_curVersion->m_strings[id].m_flags & SF_NEW));
+	if (version > 0 && m_versions[version - 1].m_values.find(m_curLanguage) == m_versions[version - 1].m_values.end())
+	{
+		added = true;
+	}
+
+	uint32_t c = (id < m_latestChange.size()) ? m_latestChange[id] : NO_CHANGE;
+	for (; c != NO_CHANGE && !added; c = m_changes[c].prev)
+	{
+		const Change& change = m_changes[c];
+		if (change.version <= (uint32_t)version && ((change.flags & Change::CF_INFO) || change.language == m_curLanguage))
+		{
+			if (change.version < (uint32_t)versions.back())
+			{
+				versions.push_back(change.version);
+			}
+			added = (change.flags & Change::CF_FIRST) != 0;
+		}
+	}
+}
+
+int Document::findString(const wchar_t* name) const
+{
+	unsigned int id = m_names.find(name, m_versions.back().m_strings);
+	return (id != Names::NO_ID) ? (int)id : -1;
+}
+
+void Document::addChange(unsigned int id, size_t version, LANGID language, uint8_t flags)
+{
+	if (id >= m_latestChange.size())
+	{
+		m_latestChange.resize(id + 1, NO_CHANGE);
+	}
+
+	Change change;
+	change.version  = (uint32_t)version;
+	change.prev     = m_latestChange[id];
+	change.language = language;
+	change.flags    = flags;
+	m_latestChange[id] = (uint32_t)m_changes.size();
+	m_changes.push_back(change);
+}
+
+uint64_t Document::now() const
+{
+	return (m_batch > 0) ? m_batchTime : DateTime().getEpochSeconds();
+}
+
+void Document::markChanged(unsigned int id, bool all)
+{
+	if (m_batch == 0)
+	{
+		if (all) checkChangedAll(id);
+		else     checkChanged(id);
+	}
+	else if (all)
+	{
+		m_batchAll.insert(id);
+	}
+	else
+	{
+		m_batchValues[m_curLanguage].insert(id);
+	}
+}
+
+void Document::beginBatch()
+{
+	if (m_batch++ == 0)
+	{
+		m_batchTime = DateTime().getEpochSeconds();
+	}
+}
+
+void Document::commitBatch()
+{
+	if (m_batch == 1)
+	{
+		// The checks only look at the final state, so every string is
+		// checked once, per language it was changed in
+		LANGID        language = m_curLanguage;
+		StringValues* values   = m_curValues;
+		for (map<LANGID, IdSet>::const_iterator p = m_batchValues.begin(); p != m_batchValues.end(); p++)
+		{
+			map<LANGID, StringValues>::iterator q = m_curVersion->m_values.find(p->first);
+			for (IdSet::const_iterator i = p->second.begin(); i != p->second.end(); i++)
+			{
+				if (q == m_curVersion->m_values.end())
+				{
+					// The language was deleted, but the rest of the string can have changed
+					m_batchAll.insert(*i);
+				}
+				else if (!m_batchAll.contains(*i))
+				{
+					m_curLanguage = q->first;
+					m_curValues   = &q->second;
+					checkChanged((unsigned int)*i);
+				}
+			}
+		}
+		m_curLanguage = language;
+		m_curValues   = values;
+
+		for (IdSet::const_iterator i = m_batchAll.begin(); i != m_batchAll.end(); i++)
+		{
+			checkChangedAll((unsigned int)*i);
+		}
+		m_batchValues.clear();
+		m_batchAll.clear();
+	}
+	m_batch--;
 }
 
 // Check if this string has changed with respect to the previous version and
@@ -132,12 +310,14 @@ void Document::checkChanged(unsigned int id)
 {
 	// Note: m_curVersion and m_curLanguage point to the latest version and language
 	// in which the changed string is.
-	Version&    newver = *m_curVersion;
-	StringInfo& newstr = newver.m_strings[id];
+	Version&          newver   = *m_curVersion;
+	const StringInfo& newstr   = newver.m_strings[id];
+	const StringInfo* oldstr   = NULL;
+	const wchar_t*    oldvalue = NULL;
 
-	bool infoChanged  = true;
-	bool valueChanged = true;
-	newstr.m_modified = DateTime().getEpochSeconds();
+	bool     infoChanged  = true;
+	bool     valueChanged = true;
+	uint64_t modified     = now();
 
 	if (m_versions.size() > 1)
 	{
@@ -145,11 +325,11 @@ void Document::checkChanged(unsigned int id)
 		if (~newstr.m_flags & SF_NEW && id < oldver.m_strings.size())
 		{
 			// The same string existed in the previous version as well, compare it
-			const StringInfo& oldstr = oldver.m_strings[id];
+			oldstr = &oldver.m_strings[id];
 
-			if (newstr.m_position == oldstr.m_position     &&
-				wcscmp(newstr.m_name, oldstr.m_name) == 0  &&
-				wcscmp(newstr.m_comment, oldstr.m_comment) == 0)
+			if (newstr.m_position == oldstr->m_position     &&
+				wcscmp(newstr.m_name, oldstr->m_name) == 0  &&
+				wcscmp(newstr.m_comment, oldstr->m_comment) == 0)
 			{
 				// The info hasn't changed
 				infoChanged = false;
@@ -160,16 +340,33 @@ void Document::checkChanged(unsigned int id)
 			{
 				// The value hasn't changed
 				valueChanged = false;
+				oldvalue     = p->second.m_virt[id];
 			}
 
 			if (!infoChanged && !valueChanged)
 			{
 				// It hasn't been changed, so copy the modified date from the previous version
-				newstr.m_modified = oldstr.m_modified;
+				modified = oldstr->m_modified;
 			}
 		}
 	}
 
+	// Unchanged strings point to the previous version's strings again
+	if (!infoChanged && (newstr.m_name != oldstr->m_name || newstr.m_comment != oldstr->m_comment))
+	{
+		StringInfo& str = newver.m_strings.edit(id);
+		str.m_name    = oldstr->m_name;
+		str.m_comment = oldstr->m_comment;
+	}
+	if (!valueChanged && m_curValues->m_virt[id] != oldvalue)
+	{
+		m_curValues->m_virt.edit(id) = oldvalue;
+	}
+	if (newver.m_strings[id].m_modified != modified)
+	{
+		newver.m_strings.edit(id).m_modified = modified;
+	}
+
 	// Add it to the appropriate lists
 	if (infoChanged)  newver.diff_strings.insert(id);
 	else              newver.diff_strings.erase(id);
@@ -182,11 +379,10 @@ void Document::checkChanged(unsigned int id)
 void Document::checkChangedAll(unsigned int id)
 {
 	// Note: m_curVersion points to the latest version
-	size_t      version = m_versions.size() - 1;
-	Version&    newver  = *m_curVersion;
-	StringInfo& newstr  = newver.m_strings[id];
-
-	newstr.m_modified = DateTime().getEpochSeconds();
+	size_t            version  = m_versions.size() - 1;
+	Version&          newver   = *m_curVersion;
+	const StringInfo& newstr   = newver.m_strings[id];
+	uint64_t          modified = now();
 
 	if (m_versions.size() > 1 && ~newstr.m_flags & SF_NEW && id < m_versions[version-1].m_strings.size())
 	{
@@ -200,7 +396,17 @@ void Document::checkChangedAll(unsigned int id)
 			changed = true;
 			newver.diff_strings.insert(id);
 		}
-		else newver.diff_strings.erase(id);
+		else
+		{
+			if (newstr.m_name != oldstr.m_name || newstr.m_comment != oldstr.m_comment)
+			{
+				// Point to the previous version's strings again
+				StringInfo& str = newver.m_strings.edit(id);
+				str.m_name    = oldstr.m_name;
+				str.m_comment = oldstr.m_comment;
+			}
+			newver.diff_strings.erase(id);
+		}
 
 		for (map<LANGID, StringValues>::iterator p = newver.m_values.begin(); p != newver.m_values.end(); p++)
 		{
@@ -210,13 +416,20 @@ void Document::checkChangedAll(unsigned int id)
 				p->second.m_changed.insert(id);
 				changed = true;
 			}
-			else p->second.m_changed.erase(id);
+			else
+			{
+				if (p->second.m_virt[id] != q->second.m_virt[id])
+				{
+					p->second.m_virt.edit(id) = q->second.m_virt[id];
+				}
+				p->second.m_changed.erase(id);
+			}
 		}
 
 		if (!changed)
 		{
 			// It hasn't been changed, so copy the modified date from the previous version
-			newstr.m_modified = oldstr.m_modified;
+			modified = oldstr.m_modified;
 		}
 	}
 	else
@@ -228,60 +441,42 @@ void Document::checkChangedAll(unsigned int id)
 			p->second.m_changed.insert(id);
 		}
 	}
+
+	if (newver.m_strings[id].m_modified != modified)
+	{
+		newver.m_strings.edit(id).m_modified = modified;
+	}
 }
 
 unsigned int Document::addString()
 {
-	Version& version = m_versions.back();
+	unsigned int id = createString();
+	if (m_journal != NULL)
+	{
+		m_journal->begin(Journal::JR_ADD_STRING);
+		m_journal->put(id);
+		m_journal->end();
+	}
+	return id;
+}
 
-	// A litte note about the whole capacity() thing:
-	// We cache strings and values in wstring's for the current version.
-	// When, by adding a string, we enlarge the vector, the strings could be
-	// moved somewhere else, and the wchar_t*'s that point to them would become
-	// invalid.
-	// We can't avoid this, so we reassign all wchar_t*'s should this occur.
-	// To reduce the frequency of this event, we manually increase the capacity
-	// in steps of 64 instead a possible vector's brain-dead implementation.
+unsigned int Document::createString()
+{
+	Version& version = m_versions.back();
 
-	// Add it to the list
+	// Add it to the list. The cached strings and values don't move when
+	// their arrays grow, so nothing that points to them has to be updated.
 	unsigned int id;
 	if (m_freelist.empty())
 	{
-		// Increase vector size
 		id = (unsigned int)version.m_strings.size();
 		for (map<LANGID, StringValues>::iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
 		{
-			size_t oldCapacity = p->second.m_phys.capacity();
-			p->second.m_phys.reserve((oldCapacity + 63) & -64);
-			p->second.m_phys.push_back(L"");
-			if (p->second.m_phys.capacity() != oldCapacity)
-			{
-				// When the capacity of m_phys changes, we need to reassign all m_virt's,
-				// because the pointers have probably changed.
-				for (size_t i = 0; i < p->second.m_virt.size(); i++)
-				{
-					p->second.m_virt[i] = p->second.m_phys[i].c_str();
-				}
-			}
-			p->second.m_virt.push_back(p->second.m_phys[id].c_str());
+			StringValues& values = p->second;
+			values.m_phys.push_back(L"");
+			values.m_virt.push_back(values.m_phys[id].c_str());
 		}
-
-		size_t oldCapacity = m_strings.capacity();
-		m_strings.reserve((oldCapacity + 63) & -64);
 		m_strings.push_back(CurrentString());
-		if (m_strings.capacity() != oldCapacity)
-		{
-			// When the capacity of m_strings changes, we need to reassign all version.m_strings's,
-			// because the pointers have probably changed
-			for (size_t i = 0; i < version.m_strings.size(); i++)
-			{
-				if (version.m_strings[i].m_name != NULL)
-				{
-					version.m_strings[i].m_name    = m_strings[i].m_name.c_str();
-					version.m_strings[i].m_comment = m_strings[i].m_comment.c_str();
-				}
-			}
-		}
 		version.m_strings.push_back(StringInfo());
 	}
 	else
@@ -291,7 +486,7 @@ unsigned int Document::addString()
 		for (map<LANGID, StringValues>::iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
 		{
 			p->second.m_phys[id] = L"";
-			p->second.m_virt[id] = p->second.m_phys[id].c_str();
+			p->second.m_virt.edit(id) = p->second.m_phys[id].c_str();
 		}
 		m_strings[id] = CurrentString();
 	}
@@ -300,11 +495,11 @@ unsigned int Document::addString()
 	si.m_name     = m_strings[id].m_name.c_str();
 	si.m_comment  = m_strings[id].m_comment.c_str();
 	si.m_flags    = SF_NEW;
-	si.m_modified = DateTime().getEpochSeconds();
-	version.m_strings[id] = si;
+	si.m_modified = now();
+	version.m_strings.edit(id) = si;
 
-	m_names.insert(make_pair(m_strings[id].m_name, id));
-	checkChangedAll(id);
+	indexName(id);
+	markChanged(id, true);
 
 	// If we got it from the freelist, remove the id
 	if (!m_freelist.empty())
@@ -315,39 +510,59 @@ unsigned int Document::addString()
 	return id;
 }
 
-bool Document::isValidName(unsigned int id) const
+// Checks for proper formatting (i.e. identifier characters)
+static bool IsValidIdentifier(const wchar_t* name)
 {
-	if (m_curVersion == &m_versions.back())
+	for (const wchar_t* c = name; *c != L'\0'; c++)
 	{
-		const wstring& name = m_curVersion->m_strings[id].m_name;
-
-		if (getType() == DT_NAME)
+		if ((*c < L'A' || *c > L'Z') && (*c < L'a' || *c > L'z') && (*c < L'0' || *c > L'9') &&
+			*c != L'_' && *c != L'-' && *c != L'.' && *c != L' ')
 		{
-			// Check for duplicates
-			multimap<wstring, unsigned int>::const_iterator p = m_names.find(name);
-			if (p != m_names.end())
-			{
-				if (++p != m_names.end() && p->first == name)
-				{
-					// Duplicate entry
-					return false;
-				}
-			}
+			return false;
 		}
+	}
+	return *name != L'\0';
+}
 
-		// Check for proper formatting (i.e. identifier characters)
-		for (wstring::const_iterator c = name.begin(); c != name.end(); c++)
-		{
-			if ((*c < L'A' || *c > L'Z') && (*c < L'a' || *c > L'z') && (*c < L'0' || *c > L'9') &&
-				*c != L'_' && *c != L'-' && *c != L'.' && *c != L' ')
-			{
-				return false;
-			}
-		}
+void Document::indexName(unsigned int id)
+{
+	const StringArray& strings = m_versions.back().m_strings;
+	const wchar_t*     name    = strings[id].m_name;
 
-		return !name.empty();
+	size_t count = m_names.insert(id, strings);
+	if (m_type == DT_NAME && count == 2)
+	{
+		// The other string with this name is a duplicate now
+		unsigned int other = m_names.first(name, strings);
+		m_invalid.insert((other != id) ? other : m_names.next(id));
+	}
+
+	if ((m_type == DT_NAME && count > 1) || !IsValidIdentifier(name))
+	{
+		m_invalid.insert(id);
+	}
+	else
+	{
+		m_invalid.erase(id);
+	}
+}
+
+void Document::unindexName(unsigned int id)
+{
+	const StringArray& strings = m_versions.back().m_strings;
+	const wchar_t*     name    = strings[id].m_name;
+
+	m_invalid.erase(id);
+	if (m_names.erase(id, strings) == 1 && m_type == DT_NAME && IsValidIdentifier(name))
+	{
+		// The other string with this name isn't a duplicate anymore
+		m_invalid.erase(m_names.find(name, strings));
 	}
-	return true;
+}
+
+bool Document::isValidName(unsigned int id) const
+{
+	return m_curVersion != &m_versions.back() || !m_invalid.contains(id);
 }
 
 void Document::setString(unsigned int id, const String& str)
@@ -360,64 +575,96 @@ void Document::setString(unsigned int id, const String& str)
 			if (m_curVersion->m_strings[id].m_name != NULL)
 			{
 				// Remove previous value from name set
-				m_names.erase( m_names.find(m_curVersion->m_strings[id].m_name) );
+				unindexName(id);
 			}
 
-			m_strings[id].m_name               = str.m_name; 
-			m_curVersion->m_strings[id].m_name = m_strings[id].m_name.c_str();
+			m_strings[id].m_name                    = str.m_name; 
+			m_curVersion->m_strings.edit(id).m_name = m_strings[id].m_name.c_str();
 		}
 		
 		if (str.m_flags & String::SF_COMMENT)
 		{
-			m_strings[id].m_comment               = str.m_comment;
-			m_curVersion->m_strings[id].m_comment = m_strings[id].m_comment.c_str();
+			m_strings[id].m_comment                    = str.m_comment;
+			m_curVersion->m_strings.edit(id).m_comment = m_strings[id].m_comment.c_str();
 		}
 
 		if (str.m_flags & String::SF_POSITION)
 		{
-			m_curVersion->m_strings[id].m_position = str.m_position;
+			m_curVersion->m_strings.edit(id).m_position = str.m_position;
 		}
 
 		if (str.m_flags & String::SF_VALUE)
 		{
-			m_curValues->m_phys[id] = str.m_value;
-			m_curValues->m_virt[id] = m_curValues->m_phys[id].c_str();
+			m_curValues->m_phys[id]      = str.m_value;
+			m_curValues->m_virt.edit(id) = m_curValues->m_phys[id].c_str();
 		}
 
 		if (str.m_flags & String::SF_NAME)
 		{
 			// Add new value to name set
-			m_names.insert(make_pair(m_curVersion->m_strings[id].m_name, id));
+			indexName(id);
 		}
 
-		checkChanged(id);
+		markChanged(id, false);
+
+		if (m_journal != NULL)
+		{
+			m_journal->begin(Journal::JR_SET_STRING);
+			m_journal->put(id);
+			m_journal->put(m_curLanguage);
+			m_journal->put(str.m_flags);
+			if (str.m_flags & String::SF_POSITION) m_journal->put(str.m_position);
+			if (str.m_flags & String::SF_NAME)     m_journal->put(str.m_name);
+			if (str.m_flags & String::SF_VALUE)    m_journal->put(str.m_value);
+			if (str.m_flags & String::SF_COMMENT)  m_journal->put(str.m_comment);
+			m_journal->end();
+		}
 	}
 }
 
 void Document::deleteString(unsigned int id)
+{
+	if (m_journal != NULL && m_curVersion == &m_versions.back())
+	{
+		m_journal->begin(Journal::JR_DELETE_STRING);
+		m_journal->put(id);
+		m_journal->end();
+	}
+	removeString(id);
+}
+
+void Document::removeString(unsigned int id)
 {
 	if (m_curVersion == &m_versions.back())
 	{
 		// Deleted names don't count in collisions, obviously
-		m_names.erase( m_names.find( m_curVersion->m_strings[id].m_name) );
+		unindexName(id);
 
 		// We don't store the string for the m_changed's as well. By storing the information
 		// we know it has been deleted and that's all we need. However, we do need to
 		// explicitely remove it from the m_changed lists, so we don't store it accidently.
+		StringInfo& str = m_curVersion->m_strings.edit(id);
 		m_curVersion->diff_strings.insert(id);
-		m_curVersion->m_strings[id].m_name    = NULL;
-		m_curVersion->m_strings[id].m_comment = NULL;
-		m_curVersion->m_strings[id].m_flags   = 0;
+		str.m_name    = NULL;
+		str.m_comment = NULL;
+		str.m_flags   = 0;
 		m_strings[id].m_name.clear();
 		m_strings[id].m_comment.clear();
 		
 		for (map<LANGID, StringValues>::iterator p = m_curVersion->m_values.begin(); p != m_curVersion->m_values.end(); p++)
 		{
 			p->second.m_phys[id].clear();
-			p->second.m_virt[id] = NULL;
+			p->second.m_virt.edit(id) = NULL;
 			p->second.m_changed.erase(id);
 		}
 
+		// Nor should a batch check it
+		m_batchAll.erase(id);
+		for (map<LANGID, IdSet>::iterator p = m_batchValues.begin(); p != m_batchValues.end(); p++)
+		{
+			p->second.erase(id);
+		}
+
 		// This string ID can be reused
 		m_freelist.push(id);
 	}
@@ -427,8 +674,17 @@ void Document::setPosition(unsigned int id, unsigned int position)
 {
 	if (m_curVersion == &m_versions.back() && getType() == DT_INDEX)
 	{
-		m_curVersion->m_strings[id].m_position = position;
-		checkChanged(id);
+		m_curVersion->m_strings.edit(id).m_position = position;
+		markChanged(id, false);
+
+		if (m_journal != NULL)
+		{
+			m_journal->begin(Journal::JR_SET_POSITION);
+			m_journal->put(id);
+			m_journal->put(m_curLanguage);
+			m_journal->put(position);
+			m_journal->end();
+		}
 	}
 }
 
@@ -438,6 +694,7 @@ bool Document::setActiveVersion(int version)
 	{
 		version = (int)m_versions.size() - 1;
 	}
+	load(version);
 	m_curVersion = &m_versions[version];
 
 	map<LANGID, StringValues>::iterator p = m_curVersion->m_values.find(m_curLanguage);
@@ -464,55 +721,225 @@ void Document::saveVersion(const wstring& author, const wstring& notes)
 	version.m_numLanguages   = (unsigned long)version.m_values.size();
 	version.m_numStrings     = 0;
 
-	// Add strings to the string buffer and discard physical copy
+	// Keyframes that append() writes need the last version that changed a string
+	m_lastChanged.resize(version.m_strings.size(), UINT32_MAX);
+	for (IdSet::const_iterator p = version.diff_strings.begin(); p != version.diff_strings.end(); p++)
+	{
+		m_lastChanged[*p] = (uint32_t)(m_versions.size() - 1);
+	}
+
+	// Add the strings that were changed in this version to the string buffer.
+	// The others already point into it. The cached copies aren't used after
+	// that, so they're freed.
 	for (size_t i = 0; i != version.m_strings.size(); i++)
 	{
-		if (version.m_strings[i].m_name != NULL)
+		const StringInfo& str = version.m_strings[i];
+		if (str.m_name != NULL)
 		{
 			version.m_numStrings++;
-			version.m_strings[i].m_name    = m_buffer.addString(m_strings[i].m_name);
-			version.m_strings[i].m_comment = m_buffer.addString(m_strings[i].m_comment);
-			m_strings[i].m_name.clear();
-			m_strings[i].m_comment.clear();
+			if (str.m_name == m_strings[i].m_name.c_str() || str.m_comment == m_strings[i].m_comment.c_str())
+			{
+				StringInfo& info = version.m_strings.edit(i);
+				info.m_name    = m_buffer.addString(info.m_name);
+				info.m_comment = m_buffer.addString(info.m_comment);
+				wstring().swap(m_strings[i].m_name);
+				wstring().swap(m_strings[i].m_comment);
+			}
 		}
 	}
 
 	for (map<LANGID, StringValues>::iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
 	{
+		StringValues& values = p->second;
 		for (size_t i = 0; i != version.m_strings.size(); i++)
 		{
-			if (version.m_strings[i].m_name != NULL)
+			if (values.m_virt[i] != NULL && values.m_virt[i] == values.m_phys[i].c_str())
 			{
-				p->second.m_virt[i] = m_buffer.addString(p->second.m_phys[i]);
-				p->second.m_phys[i].clear();
+				values.m_virt.edit(i) = m_buffer.addString(values.m_phys[i]);
+				wstring().swap(values.m_phys[i]);
 			}
 		}
 
-		version.m_numDifferences += (unsigned long)p->second.m_changed.size();
+		version.m_numDifferences += (unsigned long)values.m_changed.size();
+	}
+
+	if (m_versions.size() > 1)
+	{
+		// Share what turned out to be the same as the previous version again
+		const Version& prev = m_versions[m_versions.size() - 2];
+		version.m_strings.share(prev.m_strings);
+		for (map<LANGID, StringValues>::iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
+		{
+			map<LANGID, StringValues>::const_iterator q = prev.m_values.find(p->first);
+			if (q != prev.m_values.end())
+			{
+				p->second.m_virt.share(q->second.m_virt);
+			}
+		}
 	}
 }
 
 void Document::increaseVersion()
 {
-	// Copy the last version to new version
-	m_versions.push_back( m_versions.back() );
+	// The new version shares the arrays of the last version; the physical
+	// strings move to the new version (and are all empty at this point).
+	m_versions.push_back(Version());
+	Version& last    = m_versions[m_versions.size() - 2];
 	Version& version = m_versions.back();
 
-	// Clear changes
-	version.diff_strings.clear();
+	static_cast<VersionInfo&>(version) = last;
 	version.m_author.clear();
 	version.m_notes.clear();
-	for (size_t i = 0; i != version.m_strings.size(); i++)
+	version.m_strings = last.m_strings;
+	for (map<LANGID, StringValues>::iterator p = last.m_values.begin(); p != last.m_values.end(); p++)
 	{
-		version.m_strings[i].m_flags = 0;
+		StringValues& values = version.m_values[p->first];
+		values.m_virt = p->second.m_virt;
+		values.m_phys.swap(p->second.m_phys);
 	}
 
-	for (map<LANGID, StringValues>::iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
+	// Clear flags; only strings that changed in the last version can have them
+	for (IdSet::const_iterator p = last.diff_strings.begin(); p != last.diff_strings.end(); p++)
 	{
-		p->second.m_changed.clear();
+		if (version.m_strings[*p].m_flags != 0)
+		{
+			version.m_strings.edit(*p).m_flags = 0;
+		}
 	}
 
 	m_oldPostfixes = m_newPostfixes;
+
+	// The last version is saved now, so its changes go in the history
+	size_t saved = m_versions.size() - 2;
+	for (IdSet::const_iterator p = last.diff_strings.begin(); p != last.diff_strings.end(); p++)
+	{
+		addChange((unsigned int)*p, saved, 0, Change::CF_INFO | ((last.m_strings[*p].m_flags & SF_NEW) ? Change::CF_FIRST : 0));
+	}
+	for (map<LANGID, StringValues>::const_iterator p = last.m_values.begin(); p != last.m_values.end(); p++)
+	{
+		bool added = (saved == 0 || m_versions[saved - 1].m_values.find(p->first) == m_versions[saved - 1].m_values.end());
+		for (IdSet::const_iterator q = p->second.m_changed.begin(); q != p->second.m_changed.end(); q++)
+		{
+			addChange((unsigned int)*q, saved, p->first, added ? Change::CF_FIRST : 0);
+		}
+	}
+
+	// Free ids are used in the same order as after reading the file, so a
+	// journal can be replayed on either
+	m_freelist = stack<unsigned int>();
+	for (size_t i = 0; i < version.m_strings.size(); i++)
+	{
+		if (version.m_strings[i].m_name == NULL)
+		{
+			m_freelist.push((unsigned int)i);
+		}
+	}
+}
+
+template <typename Remap>
+void Document::remapPool(Remap& remap)
+{
+	// Changed strings in the current version point to its cached strings
+	// instead. Those chunks are never shared.
+	const Version* current = &m_versions.back();
+
+	set<const void*> done;
+	for (vector<Version>::iterator v = m_versions.begin(); v != m_versions.end(); v++)
+	{
+		for (size_t c = 0; c < v->m_strings.chunkCount(); c++)
+		{
+			if (done.insert(v->m_strings.chunkId(c)).second)
+			{
+				StringInfo* strings = v->m_strings.chunk(c);
+				size_t      first   = c << StringArray::CHUNK_SHIFT;
+				for (size_t i = 0; i < v->m_strings.chunkLength(c); i++)
+				{
+					StringInfo& str = strings[i];
+					if (str.m_name != NULL)
+					{
+						bool cached = (&*v == current);
+						if (!cached || str.m_name    != m_strings[first + i].m_name.c_str())    str.m_name    = remap(str.m_name);
+						if (!cached || str.m_comment != m_strings[first + i].m_comment.c_str()) str.m_comment = remap(str.m_comment);
+					}
+				}
+			}
+		}
+
+		for (map<LANGID, StringValues>::iterator p = v->m_values.begin(); p != v->m_values.end(); p++)
+		{
+			ValueArray& virt = p->second.m_virt;
+			for (size_t c = 0; c < virt.chunkCount(); c++)
+			{
+				if (done.insert(virt.chunkId(c)).second)
+				{
+					const wchar_t** values = virt.chunk(c);
+					size_t          first  = c << ValueArray::CHUNK_SHIFT;
+					for (size_t i = 0; i < virt.chunkLength(c); i++)
+					{
+						if (values[i] != NULL && (&*v != current || values[i] != p->second.m_phys[first + i].c_str()))
+						{
+							values[i] = remap(values[i]);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Moves pointers along with the pool in detach()
+struct PoolRelocator
+{
+	const vector<StringBuffer::Relocation>& relocations;
+
+	const wchar_t* operator()(const wchar_t* str) const {
+		return StringBuffer::relocate(relocations, str);
+	}
+
+	PoolRelocator(const vector<StringBuffer::Relocation>& relocations) : relocations(relocations) {}
+};
+
+// Adds the strings to a new pool in vacuum()
+struct PoolInterner
+{
+	StringBuffer& buffer;
+
+	const wchar_t* operator()(const wchar_t* str) {
+		return buffer.addString(str);
+	}
+
+	PoolInterner(StringBuffer& buffer) : buffer(buffer) {}
+};
+
+void Document::detach()
+{
+	vector<StringBuffer::Relocation> relocations;
+	m_buffer.detach(relocations);
+	if (!relocations.empty())
+	{
+		PoolRelocator relocator(relocations);
+		remapPool(relocator);
+	}
+}
+
+size_t Document::vacuum()
+{
+	StringBuffer::Statistics before, after;
+	m_buffer.getStatistics(before);
+
+	// Intern all strings that are still used into a new pool. The records of
+	// versions that haven't been built yet refer to the old pool's offsets.
+	loadAll();
+	StringBuffer buffer;
+	PoolInterner interner(buffer);
+	remapPool(interner);
+
+	// This also releases the file mapping, if any. The file has the offsets
+	// of the old pool, so it has to be written again completely.
+	m_buffer.swap(buffer);
+	m_canAppend = false;
+	m_buffer.getStatistics(after);
+	return (before.used - after.used) * sizeof(wchar_t);
 }
 
 bool Document::isModified() const
@@ -542,53 +969,348 @@ struct LOOKUP
 	}
 };
 
+void Document::getExportOrder(vector<unsigned int>& ids, vector<const wchar_t*>& names) const
+{
+	const StringArray& strings = m_curVersion->m_strings;
+	if (getType() == DT_INDEX)
+	{
+		// We need to add the strings in the order of position, so we create a lookup table
+		vector<LOOKUP> lookup;
+		lookup.reserve(strings.size());
+		for (size_t i = 0; i < strings.size(); i++)
+		{
+			if (strings[i].m_name != NULL)
+			{
+				LOOKUP entry;
+				entry.m_position = strings[i].m_position;
+				entry.m_index    = i;
+				lookup.push_back(entry);
+			}
+		}
+		std::sort(lookup.begin(), lookup.end());
+
+		for (size_t i = 0; i < lookup.size(); i++)
+		{
+			ids.push_back((unsigned int)lookup[i].m_index);
+		}
+	}
+	else
+	{
+		// Just add the strings in any order
+		for (size_t i = 0; i < strings.size(); i++)
+		{
+			if (strings[i].m_name != NULL)
+			{
+				ids.push_back((unsigned int)i);
+			}
+		}
+	}
+
+	names.resize(ids.size());
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		names[i] = strings[ids[i]].m_name;
+	}
+}
+
+// The values of the exported strings, straight from the document
+class ExportValues : public IDatValues
+{
+	const Document::ValueArray& m_values;
+	const vector<unsigned int>& m_ids;
+public:
+	const wchar_t* getValue(size_t i, size_t& length) const
+	{
+		const wchar_t* value = m_values[m_ids[i]];
+		length = wcslen(value);
+		return value;
+	}
+	ExportValues(const Document::ValueArray& values, const vector<unsigned int>& ids) : m_values(values), m_ids(ids) {}
+};
+
 void Document::exportFile(LANGID language, IFile& output) const
 {
 	map<LANGID, StringValues>::const_iterator p = m_curVersion->m_values.find(language);
 	if (m_curVersion == &m_versions.back() && p != m_curVersion->m_values.end())
 	{
-		const vector<StringInfo>& strings = m_curVersion->m_strings;
-		const StringValues&       values  = p->second;
-		
-		StringList list;
-		list.reserve(strings.size());
-		if (getType() == DT_INDEX)
+		vector<unsigned int>   ids;
+		vector<const wchar_t*> names;
+		getExportOrder(ids, names);
+		DatNames(names, getType() == DT_NAME).write(output, ExportValues(p->second.m_virt, ids));
+	}
+}
+
+// Writes the file of every job with the same names
+class ExportTask : public IParallelTask
+{
+	const DatNames&                           m_names;
+	const vector<unsigned int>&               m_ids;
+	const vector<const Document::ValueArray*> m_values;		// Per job; NULL if the language doesn't exist
+	vector<Document::ExportJob>&              m_jobs;
+
+public:
+	void run(size_t i)
+	{
+		Document::ExportJob& job = m_jobs[i];
+		if (m_values[i] == NULL)
 		{
-			// We need to add the strings in the order of position, so we create a lookup table
-			vector<LOOKUP> lookup(strings.size());
-			for (size_t i = 0; i < strings.size(); i++)
-			{
-				lookup[i].m_position = strings[i].m_position;
-				lookup[i].m_index    = i;
-			}
-			std::sort(lookup.begin(), lookup.end());
+			job.m_failed = true;
+			return;
+		}
 
-			for (size_t i = 0; i < strings.size(); i++)
+		try
+		{
+			m_names.write(*job.m_output, ExportValues(*m_values[i], m_ids));
+		}
+		catch (...)
+		{
+			job.m_failed = true;
+		}
+	}
+
+	ExportTask(const DatNames& names, const vector<unsigned int>& ids, const vector<const Document::ValueArray*>& values, vector<Document::ExportJob>& jobs)
+		: m_names(names), m_ids(ids), m_values(values), m_jobs(jobs) {}
+};
+
+void Document::exportFiles(vector<ExportJob>& jobs) const
+{
+	if (m_curVersion != &m_versions.back())
+	{
+		return;
+	}
+
+	vector<const ValueArray*> values(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		map<LANGID, StringValues>::const_iterator p = m_curVersion->m_values.find(jobs[i].m_language);
+		values[i] = (p != m_curVersion->m_values.end()) ? &p->second.m_virt : NULL;
+	}
+
+	vector<unsigned int>   ids;
+	vector<const wchar_t*> names;
+	getExportOrder(ids, names);
+
+	DatNames   dat(names, getType() == DT_NAME);
+	ExportTask task(dat, ids, values, jobs);
+	RunParallel(task, jobs.size());
+}
+
+// A name in a NameIndex over a vector, for the alignment and the joins
+struct NameRef
+{
+	const wchar_t* m_name;
+};
+
+typedef NameIndex<vector<NameRef> > NameRefIndex;
+
+// Points names[first + row] at the name of every row
+static void GetRowNames(const StringList& strings, wstring& rowNames, vector<NameRef>& names, size_t first)
+{
+	vector<const wchar_t*> rows;
+	strings.getNames(rows, rowNames);
+	for (size_t j = 0; j < rows.size(); j++)
+	{
+		names[first + j].m_name = rows[j];
+	}
+}
+
+// Indexes the names of the rows once, so the set operations probe the index
+// instead of the list. Only the first row with a name is in the index, and
+// first[row] is the first row with the same name as row.
+static void IndexRows(const vector<NameRef>& names, NameRefIndex& index, vector<uint32_t>& first)
+{
+	first.resize(names.size());
+	index.reserve(names.size());
+	for (size_t j = 0; j < names.size(); j++)
+	{
+		first[j] = index.find(names[j].m_name, names);
+		if (first[j] == NameRefIndex::NO_ID)
+		{
+			first[j] = (uint32_t)j;
+			index.insert((unsigned int)j, names);
+		}
+	}
+}
+
+// Copies the value of a row into value
+static void SetValue(wstring& value, const StringList& strings, size_t row)
+{
+	size_t         length;
+	const wchar_t* data = strings.getValue(row, length);
+	value.assign(data, length);
+}
+
+void Document::overwriteStrings(const vector<unsigned int>& ids, const StringList& strings, vector<size_t>& added, ImportReport& report)
+{
+	// Number the names, so equal names get the same number
+	wstring         rowNames;
+	vector<NameRef> names(ids.size() + strings.size());
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		names[i].m_name = m_curVersion->m_strings[ids[i]].m_name;
+	}
+	GetRowNames(strings, rowNames, names, ids.size());
+
+	NameRefIndex     index;
+	vector<uint32_t> symbols(names.size());
+	index.reserve(names.size());
+	for (size_t k = 0; k < names.size(); k++)
+	{
+		uint32_t symbol = index.find(names[k].m_name, names);
+		if (symbol == NameRefIndex::NO_ID)
+		{
+			symbol = (uint32_t)k;
+			index.insert(symbol, names);
+		}
+		symbols[k] = symbol;
+	}
+
+	vector<uint32_t> a(symbols.begin(), symbols.begin() + ids.size());
+	vector<uint32_t> b(symbols.begin() + ids.size(), symbols.end());
+	vector<uint32_t> match;
+	align(a, b, symbols.size(), match);
+
+	// The string each row overwrites
+	vector<uint32_t> target(b.size(), NO_MATCH);
+	vector<bool>     used(a.size());
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (match[i] != NO_MATCH)
+		{
+			target[match[i]] = (uint32_t)i;
+			used[i]          = true;
+		}
+	}
+
+	// A row that didn't align can still belong to a string that moved: the
+	// first string with its name that's left over
+	vector<uint32_t> first(symbols.size(), NO_MATCH), next(a.size(), NO_MATCH);
+	for (size_t i = a.size(); i-- > 0; )
+	{
+		if (!used[i])
+		{
+			next[i]     = first[a[i]];
+			first[a[i]] = (uint32_t)i;
+		}
+	}
+
+	uint32_t lastMoved = NO_MATCH;		// The string the previous row moved, if any
+	for (size_t j = 0; j < b.size(); j++)
+	{
+		uint32_t i     = target[j];
+		bool     moved = false;
+		if (i == NO_MATCH && first[b[j]] != NO_MATCH)
+		{
+			i           = first[b[j]];
+			first[b[j]] = next[i];
+			used[i]     = true;
+			moved       = true;
+		}
+
+		if (i == NO_MATCH)
+		{
+			if (added.empty() || added.back() + 1 != j)
 			{
-				size_t idx = lookup[i].m_index;
-				list.add(strings[idx].m_name, values.m_virt[idx], strings[idx].m_comment);
+				report.m_insertedBlocks++;
 			}
+			added.push_back(j);
+			report.m_inserted++;
 		}
 		else
 		{
-			// Just add the strings in any order
-			for (size_t i = 0; i < strings.size(); i++)
+			if (moved)
 			{
-				if (strings[i].m_name != NULL)
+				if (lastMoved == NO_MATCH || lastMoved + 1 != i)
 				{
-					list.add(strings[i].m_name, values.m_virt[i], strings[i].m_comment);
+					report.m_movedBlocks++;
 				}
+				report.m_moved++;
+			}
+			else
+			{
+				report.m_overwritten++;
+			}
+
+			unsigned int id = ids[i];
+			SetValue(m_curValues->m_phys[id], strings, j);
+			m_curValues->m_virt.edit(id) = m_curValues->m_phys[id].c_str();
+			markChanged(id, false);
+		}
+		lastMoved = moved ? i : NO_MATCH;
+	}
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (!used[i])
+		{
+			report.m_missing++;
+			if (i == 0 || used[i - 1])
+			{
+				report.m_missingBlocks++;
 			}
 		}
-		list.write(output, getType() == DT_NAME);
 	}
 }
 
-void Document::addStrings(const StringList& strings, Method method)
+void Document::addStrings(const StringList& strings, Method method, ImportReport* report)
+{
+	// The strings are recorded, not the changes they make. The rows follow
+	// in records of JOURNAL_ROWS, so the journal can write them as it goes;
+	// values are recorded straight from the list.
+	if (m_journal != NULL)
+	{
+		m_journal->begin(Journal::JR_ADD_STRINGS);
+		m_journal->put(method);
+		m_journal->put(m_curLanguage);
+		m_journal->put((uint32_t)strings.size());
+		m_journal->end();
+
+		wstring buffer;
+		for (size_t i = 0; i < strings.size(); i += JOURNAL_ROWS)
+		{
+			size_t count = min(strings.size() - i, JOURNAL_ROWS);
+			m_journal->begin(Journal::JR_STRING_ROWS);
+			m_journal->put((uint32_t)count);
+			for (size_t j = i; j < i + count; j++)
+			{
+				size_t         length;
+				const wchar_t* value   = strings.getValue(j, length);
+				const wchar_t* name    = strings.getName(j, buffer);
+				const wchar_t* comment = strings.getComment(j);
+				m_journal->put(name, wcslen(name));
+				m_journal->put(value, length);
+				m_journal->put(comment, wcslen(comment));
+			}
+			m_journal->end();
+		}
+	}
+
+	ImportReport counts;
+	beginBatch();
+	try
+	{
+		mergeStrings(strings, method, counts);
+	}
+	catch (...)
+	{
+		commitBatch();
+		throw;
+	}
+	commitBatch();
+
+	if (report != NULL)
+	{
+		*report = counts;
+	}
+}
+
+void Document::mergeStrings(const StringList& strings, Method method, ImportReport& report)
 {
 	if (getType() == DT_INDEX)
 	{
-		size_t left = 0, right = 0;
+		// The rows that are added as new strings, after the existing ones
+		vector<size_t> added;
+		size_t         position = 0;
 
 		if (method == AM_OVERWRITE)
 		{
@@ -608,30 +1330,13 @@ void Document::addStrings(const StringList& strings, Method method)
 			}
 			sort(lookups.begin(), lookups.end());
 
-			do
+			vector<unsigned int> ids(lookups.size());
+			for (size_t i = 0; i < lookups.size(); i++)
 			{
-				// While the names are equal, overwrite
-				while (left < lookups.size() && right < strings.size() && m_strings[lookups[left].m_index].m_name == strings[right].m_name)
-				{
-					size_t index = lookups[left].m_index;
-					m_curValues->m_phys[index] = strings[right].m_value;
-					m_curValues->m_virt[index] = m_curValues->m_phys[index].c_str();
-					checkChanged((unsigned int)index);
-					left++;
-					right++;
-				}
-
-				if (right < strings.size())
-				{
-					// Find the first matching name
-					while (left < lookups.size() && m_strings[lookups[left].m_index].m_name != strings[right].m_name)
-					{
-						left++;
-					}
-				}
-
-				// Continue overwriting, if possible
-			} while (left < lookups.size() && right < strings.size());
+				ids[i] = (unsigned int)lookups[i].m_index;
+			}
+			overwriteStrings(ids, strings, added, report);
+			position = ids.size();
 		}
 		else
 		{
@@ -640,84 +1345,117 @@ void Document::addStrings(const StringList& strings, Method method)
 			{
 				if (m_curVersion->m_strings[i].m_name != NULL)
 				{
-					left++;
+					position++;
 				}
 			}
+
+			added.resize(strings.size());
+			for (size_t i = 0; i < strings.size(); i++)
+			{
+				added[i] = i;
+			}
+			report.m_inserted = (unsigned long)added.size();
 		}
 		
 		// Append the rest
-		for (; right < strings.size(); left++, right++)
+		wstring buffer;
+		for (vector<size_t>::const_iterator row = added.begin(); row != added.end(); row++, position++)
 		{
-			const wstring& name = strings[right].m_name;
+			unsigned int id = createString();
+			unindexName(id);
 
-			unsigned int id = addString();
-			m_names.insert(make_pair(name, id));
+			m_strings[id].m_name = strings.getName(*row, buffer);
 
-			m_strings[id].m_name                   = name;
-			m_curVersion->m_strings[id].m_name     = m_strings[id].m_name.c_str();
-			m_curVersion->m_strings[id].m_comment  = m_strings[id].m_comment.c_str();
-			m_curVersion->m_strings[id].m_position = (unsigned long)left;
+			StringInfo& str = m_curVersion->m_strings.edit(id);
+			str.m_name     = m_strings[id].m_name.c_str();
+			str.m_comment  = m_strings[id].m_comment.c_str();
+			str.m_position = (unsigned long)position;
+			indexName(id);
 
-			m_curValues->m_phys[id] = strings[right].m_value;
-			m_curValues->m_virt[id] = m_curValues->m_phys[id].c_str();
+			SetValue(m_curValues->m_phys[id], strings, *row);
+			m_curValues->m_virt.edit(id) = m_curValues->m_phys[id].c_str();
 
-			checkChanged(id);
+			markChanged(id, false);
 		}
 	}
 	else if (m_curVersion == &m_versions.back() && m_curValues != NULL && method != AM_NONE)
 	{
-		if (method == AM_UNION || method == AM_UNION_OVERWRITE)
+		// Join the strings on the rows: each string is looked up once in an
+		// index of the rows, instead of each row in the list or the document.
+		// match[row] is the lowest string with the name of the first row
+		// that has it.
+		wstring          rowNames;
+		vector<NameRef>  names(strings.size());
+		NameRefIndex     rows;
+		vector<uint32_t> first;
+		GetRowNames(strings, rowNames, names, 0);
+		IndexRows(names, rows, first);
+
+		vector<uint32_t> match(names.size(), NO_MATCH);
+		vector<bool>     found(m_curVersion->m_strings.size());
+		for (size_t i = 0; i < m_curVersion->m_strings.size(); i++)
 		{
-			for (StringList::const_iterator i = strings.begin(); i != strings.end(); i++)
+			const wchar_t* name = m_curVersion->m_strings[i].m_name;
+			if (name != NULL)
 			{
-				const wstring& name = i->m_name;
-				multimap<wstring, unsigned int>::const_iterator p = m_names.find(name);
-				unsigned int id;
-				if (p == m_names.end())
+				unsigned int row = rows.find(name, names);
+				if (row != NameRefIndex::NO_ID)
 				{
-					// Name doesn't exist, add it
-					id = addString();
-					m_names.insert(make_pair(name, id));
+					found[i] = true;
+					if (match[row] == NO_MATCH)
+					{
+						match[row] = (uint32_t)i;
+					}
+				}
+			}
+		}
 
-					m_strings[id].m_name                  = name;
-					m_curVersion->m_strings[id].m_name    = m_strings[id].m_name.c_str();
-					m_curVersion->m_strings[id].m_comment = m_strings[id].m_comment.c_str();
+		if (method == AM_UNION || method == AM_UNION_OVERWRITE)
+		{
+			for (size_t row = 0; row < strings.size(); row++)
+			{
+				unsigned int id = match[first[row]];
+				if (id == NO_MATCH)
+				{
+					// Name doesn't exist, add it; createString() indexed it with an empty name
+					id = createString();
+					unindexName(id);
+
+					m_strings[id].m_name = names[row].m_name;
+
+					StringInfo& str = m_curVersion->m_strings.edit(id);
+					str.m_name    = m_strings[id].m_name.c_str();
+					str.m_comment = m_strings[id].m_comment.c_str();
+					indexName(id);
+					match[first[row]] = id;
+					report.m_inserted++;
 				}
 				else if (method == AM_UNION_OVERWRITE)
 				{
 					// Overwrite it
-					id = p->second;
+					report.m_overwritten++;
 				}
 				else
 				{
 					continue;
 				}
 
-				m_curValues->m_phys[id] = i->m_value;
-				m_curValues->m_virt[id] = m_curValues->m_phys[id].c_str();
+				SetValue(m_curValues->m_phys[id], strings, row);
+				m_curValues->m_virt.edit(id) = m_curValues->m_phys[id].c_str();
 
-				checkChanged(id);
-			}
-		}
-		else if (method == AM_INTERSECT)
-		{
-			for (size_t i = 0; i < m_curVersion->m_strings.size(); i++)
-			{
-				const wchar_t* name = m_curVersion->m_strings[i].m_name;
-				if (name != NULL && strings.find(name) == strings.end())
-				{
-					deleteString((unsigned int)i);
-				}
+				markChanged(id, false);
 			}
 		}
-		else if (method == AM_DIFFERENCE)
+		else if (method == AM_INTERSECT || method == AM_DIFFERENCE)
 		{
-			for (size_t i = 0; i < m_curVersion->m_strings.size(); i++)
+			// Intersect keeps the strings that are in the rows, difference
+			// removes them
+			for (size_t i = 0; i < found.size(); i++)
 			{
-				const wchar_t* name = m_curVersion->m_strings[i].m_name;
-				if (name != NULL && strings.find(name) != strings.end())
+				if (m_curVersion->m_strings[i].m_name != NULL && found[i] != (method == AM_INTERSECT))
 				{
-					deleteString((unsigned int)i);
+					removeString((unsigned int)i);
+					report.m_removed++;
 				}
 			}
 		}
@@ -730,6 +1468,13 @@ Document::Document(Type type, LANGID language)
 	m_versions.resize(1);
 
 	m_type        = type;
+	m_journal     = NULL;
+	m_batch       = 0;
+	m_batchTime   = 0;
+	m_numLoaded   = 0;
+	m_fileFooter  = 0;
+	m_fileEnd     = 0;
+	m_canAppend   = false;
 	m_curLanguage = language;
 	m_curVersion  = &m_versions[0];
 	m_curValues   = &m_curVersion->m_values[language];
@@ -7,9 +7,15 @@
 #include <stack>
 #include <set>
 #include "datetime.h"
+#include "idset.h"
+#include "nameindex.h"
+#include "sharedarray.h"
+#include "stablearray.h"
 #include "stringlist.h"
 #include "strbuf.h"
 
+class Journal;
+
 static const unsigned int SF_NEW       = 0x01;
 static const unsigned int SF_SAVE_MASK = SF_NEW;
 
@@ -64,9 +70,18 @@ public:
 		unsigned char  m_flags;
 		uint64_t       m_modified;
 
-		StringInfo() : m_name(NULL) {}
+		StringInfo() : m_position(0), m_name(NULL), m_comment(NULL), m_flags(0), m_modified(0) {}
+
+		bool operator==(const StringInfo& rhs) const {
+			return m_position == rhs.m_position && m_name == rhs.m_name && m_comment == rhs.m_comment &&
+				m_flags == rhs.m_flags && m_modified == rhs.m_modified;
+		}
 	};
 
+	// Versions share the parts of these arrays that they have in common
+	typedef SharedArray<StringInfo>     StringArray;
+	typedef SharedArray<const wchar_t*> ValueArray;
+
 	struct VersionInfo
 	{
 		std::wstring  m_author;
@@ -80,9 +95,9 @@ public:
 	const std::map<LANGID,std::wstring>& getPostfixes() const { return m_newPostfixes; }
 	void setPostfix(LANGID language, const std::wstring& postfix );
 
-	const std::vector<StringInfo>&     getStrings() const { return m_curVersion->m_strings; }
-	const std::vector<const wchar_t*>& getValues()  const { return m_curValues->m_virt; }
-	const std::vector<const wchar_t*>& getValues(LANGID language) const;
+	const StringArray& getStrings() const { return m_curVersion->m_strings; }
+	const ValueArray&  getValues()  const { return m_curValues->m_virt; }
+	const ValueArray&  getValues(LANGID language) const;
 
 	std::pair<int, int> getStringLifetime(unsigned int id) const;
 	const StringInfo&   getString(unsigned int id, int version = -1) const;
@@ -91,6 +106,15 @@ public:
 	bool hasStringChanged(unsigned int id, int version = -1) const;
 	bool hasValueChanged(unsigned int id,  int version = -1) const;
 
+	// Fills versions with the active version and the older versions that
+	// changed the string or its value in the active language, newest first,
+	// back to where the string or the language was added. The changes are
+	// indexed per string, so this doesn't have to look at every version.
+	void getHistory(unsigned int id, std::vector<int>& versions) const;
+
+	// Returns the lowest id with this name in the last version, or -1
+	int findString(const wchar_t* name) const;
+
 	void   getLanguages(std::set<LANGID>& languages, int version = -1) const;
 	void   addLanguage(LANGID language);
 	void   changeLanguage(LANGID from, LANGID to);
@@ -114,11 +138,77 @@ public:
 	bool isModified() const;
 	bool isValidName(unsigned int id) const;
 
+	// The strings in the last version with an invalid name, in order of id.
+	// This is kept up to date with every change, so it's always ready.
+	const IdSet& getInvalidNames() const { return m_invalid; }
+	bool         hasInvalidNames() const { return !m_invalid.empty(); }
+
 	// Export current language to this filename
 	void exportFile(LANGID language, IFile& output) const;
 
-	void write(IFile& output) const;
-	void addStrings(const StringList& strings, Method method);
+	// Exports several languages at the same time, on a thread per processor.
+	// The names are converted and put in order once for all of them. Jobs
+	// whose file couldn't be written get m_failed set.
+	struct ExportJob
+	{
+		LANGID m_language;
+		IFile* m_output;
+		bool   m_failed;
+
+		ExportJob(LANGID language, IFile* output) : m_language(language), m_output(output), m_failed(false) {}
+	};
+	void exportFiles(std::vector<ExportJob>& jobs) const;
+
+	// Stops using the file the document was read from (see StringBuffer), so
+	// it can be overwritten. Call this before saving over that file.
+	void detach();
+
+	// Rebuilds the string pool with only the strings that older versions still
+	// refer to. Returns the number of bytes that were reclaimed.
+	size_t vacuum();
+
+	// Writes the whole document. Versions that are saved later can then be
+	// appended to that file, which only writes what they changed. That isn't
+	// possible for files in an older format or after vacuum(). Until append()
+	// has written the new trailer, the file still reads as it was before.
+	void write(IFile& output);
+	void append(IFile& file);
+	bool canAppend() const { return m_canAppend; }
+
+	// What an import did with the rows. For AM_OVERWRITE, the rows are
+	// aligned with the strings in order of position; a row that doesn't align
+	// overwrites a left over string with its name elsewhere (moved) or is
+	// added at the end (inserted). Blocks are runs of consecutive rows, or
+	// strings for the missing ones. The other methods only count overwritten,
+	// inserted and removed strings.
+	struct ImportReport
+	{
+		unsigned long m_overwritten;
+		unsigned long m_moved;
+		unsigned long m_movedBlocks;
+		unsigned long m_inserted;
+		unsigned long m_insertedBlocks;
+		unsigned long m_missing;			// Strings that aren't in the rows; they're kept
+		unsigned long m_missingBlocks;
+		unsigned long m_removed;
+
+		ImportReport() : m_overwritten(0), m_moved(0), m_movedBlocks(0), m_inserted(0), m_insertedBlocks(0), m_missing(0), m_missingBlocks(0), m_removed(0) {}
+	};
+
+	void addStrings(const StringList& strings, Method method, ImportReport* report = NULL);
+
+	// Changes made between beginBatch() and commitBatch() are compared with
+	// the previous version once per string, at the commit, and all get the
+	// same modification time. Until then, the changed lists and modification
+	// times of those strings aren't up to date. Batches can be nested.
+	void beginBatch();
+	void commitBatch();
+
+	// The changes to the current version are recorded in the journal, if any,
+	// until the document is saved. replay() makes the changes in a journal
+	// that was started for this document's saved versions again.
+	void setJournal(Journal* journal) { m_journal = journal; }
+	void replay(Journal& journal);
 
 	Document(Type type, LANGID language);
 	Document(IFile& input);
@@ -127,36 +217,141 @@ private:
 	void checkChanged(unsigned int id);
 	void checkChangedAll(unsigned int id);
 
+	// Checks the string now or at the end of the batch, in all languages or
+	// only the active one
+	void     markChanged(unsigned int id, bool all);
+	uint64_t now() const;
+
+	// addString(), deleteString() and addStrings() without recording them in
+	// the journal
+	unsigned int createString();
+	void         removeString(unsigned int id);
+	void         mergeStrings(const StringList& strings, Method method, ImportReport& report);
+
+	// Returns the strings that are exported, in the order of the file
+	void getExportOrder(std::vector<unsigned int>& ids, std::vector<const wchar_t*>& names) const;
+
+	// Overwrites the values of the strings ids, in order of position, with
+	// the rows they align with. Returns the rows that were left in added.
+	void overwriteStrings(const std::vector<unsigned int>& ids, const StringList& strings, std::vector<size_t>& added, ImportReport& report);
+
+	// Adds or removes a string in m_names and updates m_invalid for it and
+	// the strings with the same name
+	void indexName(unsigned int id);
+	void unindexName(unsigned int id);
+
+	// Only the current version uses m_phys; see CurrentString. m_virt points
+	// into m_phys, so the strings in it must never move.
 	struct StringValues
 	{
-		std::vector<std::wstring>   m_phys;
-		std::vector<const wchar_t*> m_virt;
-		std::set<size_t>            m_changed;		// List of values that are different from the prevous version
+		StableArray<std::wstring> m_phys;
+		ValueArray                m_virt;
+		IdSet                     m_changed;		// List of values that are different from the prevous version
 	};
 
 	struct Version : VersionInfo
 	{
-		std::vector<StringInfo>        m_strings;
+		StringArray                    m_strings;
 		std::map<LANGID, StringValues> m_values;
-		std::set<size_t>               diff_strings; // List of m_strings that are different from the previous version
+		IdSet                          diff_strings; // List of m_strings that are different from the previous version
 	};
 
+	// Strings that are changed in the current version are stored here (and
+	// values in m_phys). Unchanged strings point into the pool, like they do
+	// in the previous version, so the versions can share their arrays.
 	struct CurrentString
 	{
-		// Current version cached version of strings
 		std::wstring  m_name;
 		std::wstring  m_comment;
 	};
 
+	// The names of the strings in the last version
+	typedef NameIndex<StringArray> Names;
+
+	// Replaces every pointer into the pool with remap(pointer), once for
+	// every chunk that is shared between versions
+	template <typename Remap> void remapPool(Remap& remap);
+
+	// When a file is read, only the last saved version and the current version
+	// are built. Older versions are built when they're first used, from the
+	// previous version or from a keyframe (a full copy of the version) and
+	// their records in m_history.
+	struct PendingVersion
+	{
+		unsigned long maxString;
+		size_t        strings;		// Offset of the changed strings in m_history
+		unsigned long nStrings;
+		std::map<LANGID, std::pair<size_t, unsigned long> > values;	// Offset and count of changed values
+		size_t        keyframe;		// Offset of the keyframe in m_history, if any
+		bool          loaded;
+	};
+
+	// An entry in a table in the file: two offsets, or a version and an offset
+	typedef std::pair<uint32_t, uint32_t> FileEntry;
+
+	// A saved version that changed a string's info or its value in a
+	// language. The changes of a string are linked from the latest back.
+	struct Change
+	{
+		enum
+		{
+			CF_INFO  = 1,	// The name, comment or position changed, not a value
+			CF_FIRST = 2,	// The string or the language was added in this version
+		};
+
+		uint32_t version;
+		uint32_t prev;		// Previous change of the string, or NO_CHANGE
+		LANGID   language;
+		uint8_t  flags;
+	};
+
+	static const uint32_t NO_CHANGE = 0xFFFFFFFF;
+
+	void addChange(unsigned int id, size_t version, LANGID language, uint8_t flags);
+
+	void load(size_t version) const;
+	void loadAll() const;
+	void loadVersion(size_t version) const;
+	void writeVersion(IFile& output, size_t version);
+	void writeKeyframes(IFile& output);
+	void writeKeyframe(IFile& output, size_t version);
+	void writeFooter(IFile& output);
+
 	// Main data structures
-	std::vector<Version>                      m_versions;
-	std::vector<CurrentString>                m_strings;
+	mutable std::vector<Version>              m_versions;
+	StableArray<CurrentString>                m_strings;
 	std::stack<unsigned int>                  m_freelist;
-	std::multimap<std::wstring, unsigned int> m_names;
+	Names                                     m_names;
+	IdSet                                     m_invalid;	// Strings with an invalid name; see isValidName
 	std::map<LANGID, std::wstring>            m_oldPostfixes;
 	std::map<LANGID, std::wstring>            m_newPostfixes;
 	StringBuffer                              m_buffer;
 	Type                                      m_type;
+	Journal*                                  m_journal;
+
+	// Strings to check at the end of the batch; see beginBatch()
+	int                                       m_batch;
+	uint64_t                                  m_batchTime;
+	IdSet                                     m_batchAll;
+	std::map<LANGID, IdSet>                   m_batchValues;
+
+	// Versions that haven't been built yet; see PendingVersion
+	mutable std::vector<PendingVersion>       m_pending;
+	mutable std::vector<uint8_t>              m_history;
+	mutable size_t                            m_numLoaded;
+
+	// Where the versions are in the file that was last read or written, for
+	// append(). The next versions are written after the footer's trailer.
+	std::vector<FileEntry>                    m_fileVersions;	// Offsets of the strings and values
+	std::vector<FileEntry>                    m_fileKeyframes;	// Version and offset
+	unsigned long                             m_fileFooter;
+	unsigned long                             m_fileEnd;		// End of the trailer
+	bool                                      m_canAppend;
+	std::vector<uint32_t>                     m_lastChanged;	// Last version that changed each string
+
+	// Index of the changes of every string; see Change
+	std::vector<Change>                       m_changes;
+	std::vector<uint32_t>                     m_latestChange;	// Per string, in m_changes
 
 	// Current language/version
 	Version*      m_curVersion;
@@ -1,7 +1,16 @@
 #include "files.h"
 #include "exceptions.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
+#ifdef _WIN32
+
 unsigned long PhysicalFile::read(void* buffer, unsigned long size)
 {
 	SetFilePointer(hFile, m_position, NULL, FILE_BEGIN);
@@ -20,14 +29,29 @@ unsigned long PhysicalFile::write(const void* buffer, unsigned long size)
 	{
 		throw WriteException();
 	}
-	m_size     = GetFileSize(hFile, NULL);
-	m_position = min(m_position + size, m_size);
+	m_position += size;
+	m_size      = max(m_size, m_position);
 	return size;
 }
 
+void PhysicalFile::truncate()
+{
+	SetFilePointer(hFile, m_position, NULL, FILE_BEGIN);
+	if (!SetEndOfFile(hFile))
+	{
+		throw WriteException();
+	}
+	m_size = m_position;
+}
+
+FileMapping* PhysicalFile::map()
+{
+	return (m_mode == READ) ? FileMapping::create(hFile) : NULL;
+}
+
 PhysicalFile::PhysicalFile(const wstring& filename, Mode mode)
 {
-	DWORD dwDesiredAccess       = (mode == WRITE) ? GENERIC_WRITE : GENERIC_READ;
+	DWORD dwDesiredAccess       = (mode == WRITE) ? GENERIC_WRITE : (mode == UPDATE) ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
 	DWORD dwCreationDisposition = (mode == WRITE) ? CREATE_ALWAYS : OPEN_EXISTING;
 	hFile = CreateFile(filename.c_str(), dwDesiredAccess, FILE_SHARE_READ, NULL, dwCreationDisposition, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (hFile == INVALID_HANDLE_VALUE)
@@ -43,6 +67,7 @@ PhysicalFile::PhysicalFile(const wstring& filename, Mode mode)
 		}
 		throw IOException(LoadString(IDS_ERROR_FILE_OPEN));
 	}
+	m_mode     = mode;
 	m_size     = GetFileSize(hFile, NULL);
 	m_position = 0;
 }
@@ -51,3 +76,338 @@ PhysicalFile::~PhysicalFile()
 {
 	CloseHandle(hFile);
 }
+
+#else
+
+unsigned long PhysicalFile::read(void* buffer, unsigned long size)
+{
+	ssize_t done = pread(m_fd, buffer, size, m_position);
+	if (done < 0)
+	{
+		throw ReadException();
+	}
+	m_position = min(m_position + (unsigned long)done, m_size);
+	return (unsigned long)done;
+}
+
+unsigned long PhysicalFile::write(const void* buffer, unsigned long size)
+{
+	ssize_t done = pwrite(m_fd, buffer, size, m_position);
+	if (done < 0)
+	{
+		throw WriteException();
+	}
+	m_position += (unsigned long)done;
+	m_size      = max(m_size, m_position);
+	return (unsigned long)done;
+}
+
+void PhysicalFile::truncate()
+{
+	if (ftruncate(m_fd, m_position) != 0)
+	{
+		throw WriteException();
+	}
+	m_size = m_position;
+}
+
+FileMapping* PhysicalFile::map()
+{
+	return (m_mode == READ) ? FileMapping::create(m_fd) : NULL;
+}
+
+PhysicalFile::PhysicalFile(const wstring& filename, Mode mode)
+{
+	// Convert the name to the multi-byte encoding of the current locale
+	size_t len = wcstombs(NULL, filename.c_str(), 0);
+	if (len == (size_t)-1)
+	{
+		throw FileNotFoundException(filename);
+	}
+	string name(len, '\0');
+	wcstombs(&name[0], filename.c_str(), len + 1);
+
+	int flags = (mode == WRITE) ? O_RDWR | O_CREAT | O_TRUNC : (mode == UPDATE) ? O_RDWR : O_RDONLY;
+	m_fd = open(name.c_str(), flags, 0666);
+	if (m_fd == -1)
+	{
+		if (errno == ENOENT)
+		{
+			throw FileNotFoundException(filename);
+		}
+		if (mode == WRITE)
+		{
+			throw IOException(LoadString(IDS_ERROR_FILE_CREATE));
+		}
+		throw IOException(LoadString(IDS_ERROR_FILE_OPEN));
+	}
+
+	struct stat st;
+	m_mode     = mode;
+	m_size     = (fstat(m_fd, &st) == 0) ? (unsigned long)st.st_size : 0;
+	m_position = 0;
+}
+
+PhysicalFile::~PhysicalFile()
+{
+	close(m_fd);
+}
+
+#endif
+
+unsigned long BufferedFile::size()
+{
+	return (m_writeLength > 0) ? max(m_file.size(), m_writeStart + m_writeLength) : m_file.size();
+}
+
+unsigned long BufferedFile::read(void* buffer, unsigned long size)
+{
+	flush();
+
+	char*         dest = (char*)buffer;
+	unsigned long done = 0;
+	while (done < size)
+	{
+		if (m_position >= m_readStart && m_position < m_readStart + m_readLength)
+		{
+			// Copy what the read buffer has
+			unsigned long offset = m_position - m_readStart;
+			unsigned long n      = min(size - done, m_readLength - offset);
+			memcpy(dest + done, &m_readBuffer[offset], n);
+			done       += n;
+			m_position += n;
+		}
+		else if (size - done >= m_readBuffer.size())
+		{
+			// Too large to buffer
+			m_file.seek(m_position);
+			unsigned long n = m_file.read(dest + done, size - done);
+			done       += n;
+			m_position += n;
+			break;
+		}
+		else
+		{
+			m_file.seek(m_position);
+			m_readStart  = m_position;
+			m_readLength = m_file.read(&m_readBuffer[0], (unsigned long)m_readBuffer.size());
+			if (m_readLength == 0)
+			{
+				break;
+			}
+		}
+	}
+	return done;
+}
+
+unsigned long BufferedFile::write(const void* buffer, unsigned long size)
+{
+	// The read buffer could have what's overwritten
+	m_readLength = 0;
+
+	if (m_writeLength > 0 && (m_position != m_writeStart + m_writeLength || m_writeLength + size > m_writeBuffer.size()))
+	{
+		flush();
+	}
+
+	if (size >= m_writeBuffer.size())
+	{
+		// Too large to buffer
+		m_file.seek(m_position);
+		unsigned long n = m_file.write(buffer, size);
+		m_position += n;
+		return n;
+	}
+
+	if (m_writeLength == 0)
+	{
+		m_writeStart = m_position;
+	}
+	memcpy(&m_writeBuffer[m_writeLength], buffer, size);
+	m_writeLength += size;
+	m_position    += size;
+	return size;
+}
+
+void BufferedFile::truncate()
+{
+	flush();
+	m_file.seek(m_position);
+	m_file.truncate();
+	m_readLength = 0;
+}
+
+FileMapping* BufferedFile::map()
+{
+	flush();
+	return m_file.map();
+}
+
+void BufferedFile::flush()
+{
+	if (m_writeLength > 0)
+	{
+		unsigned long length = m_writeLength;
+		m_writeLength = 0;
+
+		m_file.seek(m_writeStart);
+		if (m_file.write(&m_writeBuffer[0], length) != length)
+		{
+			throw WriteException();
+		}
+	}
+}
+
+BufferedFile::BufferedFile(IFile& file, unsigned long readSize, unsigned long writeSize)
+	: m_file(file), m_position(file.tell()), m_readBuffer(max(readSize, 1UL)), m_readStart(0), m_readLength(0),
+	  m_writeBuffer(max(writeSize, 1UL)), m_writeStart(0), m_writeLength(0)
+{
+}
+
+BufferedFile::~BufferedFile()
+{
+	try
+	{
+		flush();
+	}
+	catch (...)
+	{
+	}
+}
+
+unsigned long MappedFile::read(void* buffer, unsigned long size)
+{
+	if (m_mapping == NULL)
+	{
+		m_file.seek(m_position);
+		size = m_file.read(buffer, size);
+	}
+	else
+	{
+		size = min(size, m_size - m_position);
+		memcpy(buffer, (const char*)m_mapping->data() + m_position, size);
+	}
+	m_position += size;
+	return size;
+}
+
+unsigned long MappedFile::write(const void* buffer, unsigned long size)
+{
+	throw WriteException();
+}
+
+void MappedFile::truncate()
+{
+	throw WriteException();
+}
+
+const void* MappedFile::view(unsigned long size)
+{
+	if (m_mapping == NULL || size > m_size - m_position)
+	{
+		return NULL;
+	}
+	const void* data = (const char*)m_mapping->data() + m_position;
+	m_position += size;
+	return data;
+}
+
+MappedFile::MappedFile(IFile& file)
+	: m_file(file), m_mapping(file.map()), m_position(file.tell()), m_size(file.size())
+{
+	if (m_mapping != NULL && m_mapping->size() < m_size)
+	{
+		delete m_mapping;
+		m_mapping = NULL;
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	delete m_mapping;
+}
+
+const void* ReadView(IFile& input, vector<uint8_t>& copy, unsigned long size)
+{
+	const void* data = input.view(size);
+	if (data == NULL)
+	{
+		if (size > input.size() - input.tell())
+		{
+			throw ReadException();
+		}
+		copy.resize(size);
+		if (size > 0 && input.read(&copy[0], size) != size)
+		{
+			throw ReadException();
+		}
+		data = copy.empty() ? NULL : &copy[0];
+	}
+	return data;
+}
+
+unsigned long MemoryFile::read(void* buffer, unsigned long size)
+{
+	size = min(size, (unsigned long)m_data.size() - m_position);
+	if (size > 0)
+	{
+		memcpy(buffer, &m_data[m_position], size);
+		m_position += size;
+	}
+	return size;
+}
+
+unsigned long MemoryFile::write(const void* buffer, unsigned long size)
+{
+	// Overwrite what's there and append the rest; the vector grows by a
+	// factor, so appending takes amortized constant time
+	const char*   data      = (const char*)buffer;
+	unsigned long overwrite = min(size, (unsigned long)m_data.size() - m_position);
+	if (overwrite > 0)
+	{
+		memcpy(&m_data[m_position], data, overwrite);
+	}
+	m_data.insert(m_data.end(), data + overwrite, data + size);
+	m_position += size;
+	return size;
+}
+
+const void* MemoryFile::view(unsigned long size)
+{
+	if (size > m_data.size() - m_position)
+	{
+		return NULL;
+	}
+	const void* data = m_data.empty() ? NULL : &m_data[0] + m_position;
+	m_position += size;
+	return data;
+}
+
+unsigned long ConstMemoryFile::read(void* buffer, unsigned long size)
+{
+	size = min(size, m_size - m_position);
+	memcpy(buffer, m_data + m_position, size);
+	m_position += size;
+	return size;
+}
+
+unsigned long ConstMemoryFile::write(const void* buffer, unsigned long size)
+{
+	throw WriteException();
+}
+
+void ConstMemoryFile::truncate()
+{
+	throw WriteException();
+}
+
+const void* ConstMemoryFile::view(unsigned long size)
+{
+	if (size > m_size - m_position)
+	{
+		return NULL;
+	}
+	const void* data = m_data + m_position;
+	m_position += size;
+	return data;
+}
\ No newline at end of file
@@ -2,7 +2,9 @@
 #define FILES_H
 
 #include <string>
+#include <vector>
 #include "types.h"
+#include "mapping.h"
 
 class IFile
 {
@@ -13,31 +15,173 @@ public:
 	virtual unsigned long tell() = 0;
 	virtual unsigned long read(void* buffer, unsigned long size) = 0;
 	virtual unsigned long write(const void* buffer, unsigned long size) = 0;
+
+	// Cuts the file off at the current position
+	virtual void          truncate() = 0;
+
+	// Returns a read-only mapping of the entire file, which the caller owns,
+	// or NULL if the file can't be mapped.
+	virtual FileMapping*  map() { return NULL; }
+
+	// Returns the next size bytes of the file in place and moves past them,
+	// or NULL if the file can't do that or has fewer bytes left; read()
+	// them then. The bytes stay valid until the file is written to or
+	// destroyed.
+	virtual const void*   view(unsigned long size) { return NULL; }
+
+	virtual ~IFile() {}
 };
 
+// Returns the next size bytes of the file: in place if the file can view
+// them, or else read into copy. Throws ReadException if there aren't enough.
+const void* ReadView(IFile& input, std::vector<uint8_t>& copy, unsigned long size);
+
 class PhysicalFile : public IFile
 {
-private:
-	HANDLE        hFile;
-	unsigned long m_position;
-	unsigned long m_size;
-
 public:
 	enum Mode
 	{
 		WRITE,
 		READ,
+		UPDATE,		// Reads and writes an existing file
 	};
 
+private:
+#ifdef _WIN32
+	HANDLE        hFile;
+#else
+	int           m_fd;
+#endif
+	Mode          m_mode;
+	unsigned long m_position;
+	unsigned long m_size;
+
+public:
 	bool          eof()                      { return m_position == m_size; }
 	unsigned long size()                     { return m_size; }
 	unsigned long tell()                     { return m_position; }
 	void          seek(unsigned long offset) { m_position = min(offset, m_size); }
 	unsigned long read(void* buffer, unsigned long size);
 	unsigned long write(const void* buffer, unsigned long size);
+	void          truncate();
+	FileMapping*  map();
 
 	PhysicalFile(const std::wstring& name, Mode mode = READ);
 	~PhysicalFile();
 };
 
+// Buffers the reads and writes of another file, so that small reads and
+// writes (e.g. of a single descriptor) don't each go to that file. A read
+// fills the read buffer with the file from the position on; writes are
+// collected and written when the write buffer is full, when the position
+// moves away from them, or before a read, truncate() or map(). The
+// destructor writes what's left but can't report errors, so call flush()
+// when done writing.
+class BufferedFile : public IFile
+{
+public:
+	static const unsigned long DEFAULT_SIZE = 64 * 1024;
+
+	bool          eof()                      { return m_position == size(); }
+	unsigned long size();
+	unsigned long tell()                     { return m_position; }
+	void          seek(unsigned long offset) { m_position = min(offset, size()); }
+	unsigned long read(void* buffer, unsigned long size);
+	unsigned long write(const void* buffer, unsigned long size);
+	void          truncate();
+	FileMapping*  map();
+
+	// Writes the buffered writes to the file
+	void          flush();
+
+	BufferedFile(IFile& file, unsigned long readSize = DEFAULT_SIZE, unsigned long writeSize = DEFAULT_SIZE);
+	~BufferedFile();
+
+private:
+	IFile&            m_file;
+	unsigned long     m_position;
+
+	std::vector<char> m_readBuffer;
+	unsigned long     m_readStart;		// Offset of the read buffer in the file
+	unsigned long     m_readLength;		// Bytes in the read buffer
+
+	std::vector<char> m_writeBuffer;
+	unsigned long     m_writeStart;		// Offset of the write buffer in the file
+	unsigned long     m_writeLength;	// Bytes in the write buffer
+};
+
+// Reads another file through a mapping of it, so parsers can view() the
+// bytes in place. If the file can't be mapped (e.g. it's empty), it's read
+// directly. The file can't be changed through this.
+class MappedFile : public IFile
+{
+public:
+	bool          eof()                      { return m_position == m_size; }
+	unsigned long size()                     { return m_size; }
+	unsigned long tell()                     { return m_position; }
+	void          seek(unsigned long offset) { m_position = min(offset, m_size); }
+	unsigned long read(void* buffer, unsigned long size);
+	unsigned long write(const void* buffer, unsigned long size);
+	void          truncate();
+	FileMapping*  map()                      { return m_file.map(); }
+	const void*   view(unsigned long size);
+
+	MappedFile(IFile& file);
+	~MappedFile();
+
+private:
+	IFile&        m_file;
+	FileMapping*  m_mapping;
+	unsigned long m_position;
+	unsigned long m_size;
+};
+
+// A file in memory that grows as it's written. Its data can be handed over
+// without copying it with swap().
+class MemoryFile : public IFile
+{
+public:
+	bool          eof()                      { return m_position == m_data.size(); }
+	unsigned long size()                     { return (unsigned long)m_data.size(); }
+	unsigned long tell()                     { return m_position; }
+	void          seek(unsigned long offset) { m_position = min(offset, size()); }
+	unsigned long read(void* buffer, unsigned long size);
+	unsigned long write(const void* buffer, unsigned long size);
+	void          truncate()                 { m_data.resize(m_position); }
+	const void*   view(unsigned long size);
+
+	const std::vector<char>& data() const { return m_data; }
+
+	// Exchanges the data of the file with data and starts at the beginning
+	void swap(std::vector<char>& data) { m_data.swap(data); m_position = 0; }
+
+	MemoryFile() : m_position(0) {}
+
+private:
+	std::vector<char> m_data;
+	unsigned long     m_position;
+};
+
+// Reads bytes in memory that it doesn't own, e.g. a MemoryFile's data, which
+// must stay where they are. The file can't be changed through this.
+class ConstMemoryFile : public IFile
+{
+public:
+	bool          eof()                      { return m_position == m_size; }
+	unsigned long size()                     { return m_size; }
+	unsigned long tell()                     { return m_position; }
+	void          seek(unsigned long offset) { m_position = min(offset, m_size); }
+	unsigned long read(void* buffer, unsigned long size);
+	unsigned long write(const void* buffer, unsigned long size);
+	void          truncate();
+	const void*   view(unsigned long size);
+
+	ConstMemoryFile(const void* data, unsigned long size) : m_data((const char*)data), m_position(0), m_size(size) {}
+
+private:
+	const char*   m_data;
+	unsigned long m_position;
+	unsigned long m_size;
+};
+
 #endif
\ No newline at end of file
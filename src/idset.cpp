@@ -0,0 +1,146 @@
+#include <algorithm>
+#include "idset.h"
+using namespace std;
+
+bool IdSet::contains(size_t id) const
+{
+	if (m_dense)
+	{
+		return id / 32 < m_bits.size() && (m_bits[id / 32] & (1U << (id % 32))) != 0;
+	}
+	return binary_search(m_ids.begin(), m_ids.end(), (uint32_t)id);
+}
+
+void IdSet::insert(size_t id)
+{
+	if (m_dense)
+	{
+		if (id / 32 >= m_bits.size())
+		{
+			if ((m_size + 1) * 32 <= id)
+			{
+				// The bitmap would become too sparse
+				toArray();
+				insert(id);
+				return;
+			}
+			m_bits.resize(id / 32 + 1, 0);
+		}
+
+		uint32_t& word = m_bits[id / 32];
+		uint32_t  bit  = 1U << (id % 32);
+		if (~word & bit)
+		{
+			word |= bit;
+			m_size++;
+		}
+		return;
+	}
+
+	// Ids are mostly added in order, so check the end first
+	if (m_ids.empty() || m_ids.back() < id)
+	{
+		m_ids.push_back((uint32_t)id);
+	}
+	else
+	{
+		vector<uint32_t>::iterator p = lower_bound(m_ids.begin(), m_ids.end(), (uint32_t)id);
+		if (*p == id)
+		{
+			return;
+		}
+		m_ids.insert(p, (uint32_t)id);
+	}
+	m_size++;
+
+	// Switch when the array takes more space than a bitmap up to the last id
+	if (m_size * 32 > m_ids.back() + 1)
+	{
+		toBitmap();
+	}
+}
+
+void IdSet::erase(size_t id)
+{
+	if (m_dense)
+	{
+		if (contains(id))
+		{
+			m_bits[id / 32] &= ~(1U << (id % 32));
+			m_size--;
+
+			// Leave some room, so we don't switch back and forth
+			if (m_size * 64 < m_bits.size() * 32)
+			{
+				toArray();
+			}
+		}
+		return;
+	}
+
+	vector<uint32_t>::iterator p = lower_bound(m_ids.begin(), m_ids.end(), (uint32_t)id);
+	if (p != m_ids.end() && *p == id)
+	{
+		m_ids.erase(p);
+		m_size--;
+	}
+}
+
+void IdSet::clear()
+{
+	m_ids.clear();
+	m_bits.clear();
+	m_dense = false;
+	m_size  = 0;
+}
+
+size_t IdSet::nextBit(size_t pos) const
+{
+	size_t word = pos / 32;
+	if (word >= m_bits.size())
+	{
+		return m_bits.size() * 32;
+	}
+
+	uint32_t bits = m_bits[word] & (~0U << (pos % 32));
+	while (bits == 0)
+	{
+		if (++word == m_bits.size())
+		{
+			return m_bits.size() * 32;
+		}
+		bits = m_bits[word];
+	}
+
+	pos = word * 32;
+	for (; (bits & 1) == 0; bits >>= 1)
+	{
+		pos++;
+	}
+	return pos;
+}
+
+void IdSet::toBitmap()
+{
+	vector<uint32_t> bits(m_ids.empty() ? 0 : m_ids.back() / 32 + 1, 0);
+	for (size_t i = 0; i < m_ids.size(); i++)
+	{
+		bits[m_ids[i] / 32] |= 1U << (m_ids[i] % 32);
+	}
+	m_bits.swap(bits);
+	vector<uint32_t>().swap(m_ids);
+	m_dense = true;
+}
+
+void IdSet::toArray()
+{
+	vector<uint32_t> ids;
+	ids.reserve(m_size);
+	for (const_iterator p = begin(); p != end(); p++)
+	{
+		ids.push_back((uint32_t)*p);
+	}
+	m_ids.swap(ids);
+	vector<uint32_t>().swap(m_bits);
+	m_dense = false;
+}
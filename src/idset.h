@@ -0,0 +1,56 @@
+#ifndef IDSET_H
+#define IDSET_H
+
+#include <vector>
+#include "types.h"
+
+// A set of string ids. Small or sparse sets are stored as a sorted array of
+// ids; once a bitmap over the ids would be smaller, the set becomes a bitmap.
+// Either way, iteration is in increasing order.
+class IdSet
+{
+public:
+	class const_iterator
+	{
+	public:
+		size_t operator*() const { return m_set->m_dense ? m_pos : m_set->m_ids[m_pos]; }
+
+		const_iterator& operator++()    { m_pos = m_set->m_dense ? m_set->nextBit(m_pos + 1) : m_pos + 1; return *this; }
+		const_iterator  operator++(int) { const_iterator tmp(*this); ++*this; return tmp; }
+
+		bool operator==(const const_iterator& rhs) const { return m_pos == rhs.m_pos; }
+		bool operator!=(const const_iterator& rhs) const { return m_pos != rhs.m_pos; }
+
+	private:
+		friend class IdSet;
+		const_iterator(const IdSet* set, size_t pos) : m_set(set), m_pos(pos) {}
+
+		const IdSet* m_set;
+		size_t       m_pos;		// Index in the array or bit in the bitmap
+	};
+
+	const_iterator begin() const { return const_iterator(this, m_dense ? nextBit(0) : 0); }
+	const_iterator end()   const { return const_iterator(this, m_dense ? m_bits.size() * 32 : m_ids.size()); }
+
+	bool   contains(size_t id) const;
+	size_t size()  const { return m_size; }
+	bool   empty() const { return m_size == 0; }
+
+	void insert(size_t id);
+	void erase(size_t id);
+	void clear();
+
+	IdSet() : m_dense(false), m_size(0) {}
+
+private:
+	size_t nextBit(size_t pos) const;
+	void   toBitmap();
+	void   toArray();
+
+	std::vector<uint32_t> m_ids;	// Sorted ids, when not dense
+	std::vector<uint32_t> m_bits;	// Bitmap, when dense
+	bool                  m_dense;
+	size_t                m_size;
+};
+
+#endif
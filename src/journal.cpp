@@ -0,0 +1,381 @@
+#include <cstring>
+#include "journal.h"
+#include "document.h"
+#include "crc32.h"
+#include "exceptions.h"
+using namespace std;
+
+// Records are written in one go once this many bytes are waiting
+static const size_t FLUSH_SIZE = 64 * 1024;
+
+#pragma pack(1)
+struct JOURNALHEADER
+{
+	uint8_t  signature[4];
+	uint32_t nVersions;		// Saved versions of the document
+	uint64_t saved;			// When the last of them was saved
+};
+
+// Followed by length bytes: the record type and its values
+struct RECORDHEADER
+{
+	uint32_t length;
+	uint32_t crc;
+};
+#pragma pack()
+
+static void MakeHeader(JOURNALHEADER& header, const Document& document)
+{
+	vector<Document::VersionInfo> versions;
+	document.getVersions(versions);
+
+	// The last version is the one that isn't saved yet
+	size_t nVersions = versions.size() - 1;
+	header.signature[0] = 'V';
+	header.signature[1] = 'D';
+	header.signature[2] = 'J';
+	header.signature[3] = 2;
+	header.nVersions = htolel((uint32_t)nVersions);
+	header.saved     = htolell((nVersions > 0) ? versions[nVersions - 1].m_saved : 0);
+}
+
+// Returns true if a complete record starts at pos, and where the next one starts
+static bool IsComplete(const vector<uint8_t>& data, size_t pos, size_t& next)
+{
+	RECORDHEADER header;
+	if (data.size() - pos < sizeof header)
+	{
+		return false;
+	}
+	memcpy(&header, &data[pos], sizeof header);
+
+	size_t length = letohl(header.length);
+	pos += sizeof header;
+	if (length == 0 || data.size() - pos < length || crc32(&data[pos], length) != letohl(header.crc))
+	{
+		return false;
+	}
+	next = pos + length;
+	return true;
+}
+
+void Journal::begin(Record record)
+{
+	m_record = m_buffer.size();
+	m_buffer.resize(m_record + sizeof(RECORDHEADER));
+	m_buffer.push_back((uint8_t)record);
+}
+
+void Journal::put(uint32_t value)
+{
+	uint32_t le = htolel(value);
+	m_buffer.insert(m_buffer.end(), (const uint8_t*)&le, (const uint8_t*)(&le + 1));
+}
+
+void Journal::put(const wstring& str)
+{
+	put(str.c_str(), str.length());
+}
+
+void Journal::put(const wchar_t* str, size_t length)
+{
+	put((uint32_t)length);
+	m_buffer.insert(m_buffer.end(), (const uint8_t*)str, (const uint8_t*)(str + length));
+}
+
+void Journal::end()
+{
+	RECORDHEADER header;
+	size_t length = m_buffer.size() - m_record - sizeof header;
+	header.length = htolel((uint32_t)length);
+	header.crc    = htolel((uint32_t)crc32(&m_buffer[m_record + sizeof header], length));
+	memcpy(&m_buffer[m_record], &header, sizeof header);
+	m_record = m_buffer.size();
+
+	if (m_buffer.size() >= FLUSH_SIZE)
+	{
+		flush();
+	}
+}
+
+void Journal::flush()
+{
+	if (!m_buffer.empty())
+	{
+		m_file.seek(m_file.size());
+		if (m_file.write(&m_buffer[0], (unsigned long)m_buffer.size()) != m_buffer.size())
+		{
+			throw WriteException();
+		}
+		m_buffer.clear();
+		m_record = 0;
+	}
+}
+
+bool Journal::next(Record& record)
+{
+	// The records were checked when the journal was opened
+	if (m_next >= m_data.size())
+	{
+		vector<uint8_t>().swap(m_data);
+		m_read = m_next = 0;
+		return false;
+	}
+
+	RECORDHEADER header;
+	memcpy(&header, &m_data[m_next], sizeof header);
+	m_read = m_next + sizeof header;
+	m_next = m_read + letohl(header.length);
+	record = (Record)m_data[m_read++];
+	return true;
+}
+
+uint32_t Journal::getInt()
+{
+	uint32_t value;
+	if (m_next - m_read < sizeof value)
+	{
+		throw BadFileException();
+	}
+	memcpy(&value, &m_data[m_read], sizeof value);
+	m_read += sizeof value;
+	return letohl(value);
+}
+
+wstring Journal::getString()
+{
+	size_t length = getInt();
+	if ((m_next - m_read) / sizeof(wchar_t) < length)
+	{
+		throw BadFileException();
+	}
+
+	wstring str(length, L'\0');
+	if (length > 0)
+	{
+		memcpy(&str[0], &m_data[m_read], length * sizeof(wchar_t));
+	}
+	m_read += length * sizeof(wchar_t);
+	return str;
+}
+
+void Journal::reset(const Document& document)
+{
+	JOURNALHEADER header;
+	MakeHeader(header, document);
+
+	m_buffer.clear();
+	m_record = 0;
+	vector<uint8_t>().swap(m_data);
+	m_read = m_next = 0;
+
+	m_file.seek(0);
+	if (m_file.write(&header, sizeof header) != sizeof header)
+	{
+		throw WriteException();
+	}
+	m_file.truncate();
+}
+
+Journal::Journal(IFile& file, const Document& document)
+	: m_file(file), m_record(0), m_read(0), m_next(0)
+{
+	JOURNALHEADER header, expected;
+	MakeHeader(expected, document);
+
+	unsigned long size = m_file.size();
+	m_file.seek(0);
+	if (size >= sizeof header && m_file.read(&header, sizeof header) == sizeof header && memcmp(&header, &expected, sizeof header) == 0)
+	{
+		m_data.resize(size - sizeof header);
+		if (!m_data.empty() && m_file.read(&m_data[0], (unsigned long)m_data.size()) != m_data.size())
+		{
+			throw ReadException();
+		}
+
+		// Keep the complete records; the rest was cut off while it was written
+		size_t end = 0;
+		while (IsComplete(m_data, end, end));
+		m_data.resize(end);
+		m_file.seek((unsigned long)(sizeof header + end));
+		m_file.truncate();
+	}
+	else
+	{
+		reset(document);
+	}
+}
+
+//
+// Document functions
+//
+
+// Reads a string id and checks that the string exists
+static unsigned int GetId(Journal& journal, const Document& document)
+{
+	uint32_t id = journal.getInt();
+	if (id >= document.getStrings().size() || document.getStrings()[id].m_name == NULL)
+	{
+		throw BadFileException();
+	}
+	return id;
+}
+
+static LANGID GetLanguage(Journal& journal)
+{
+	uint32_t language = journal.getInt();
+	if (language > 0xFFFF)
+	{
+		throw BadFileException();
+	}
+	return (LANGID)language;
+}
+
+void Document::replay(Journal& journal)
+{
+	// The changes are made like they were made the first time. The ids of new
+	// strings come out the same, because the free ids are used in the same
+	// order after reading and saving a file.
+	LANGID          language = m_curLanguage;
+	Journal::Record record;
+
+	// An import is made once all of its rows have been read. If the journal
+	// was cut off while they were recorded, the next record isn't one of them.
+	vector<StringList::StringInfo> rows;
+	Method                         method    = AM_NONE;
+	size_t                         pending   = 0;
+	bool                           importing = false;
+	while (journal.next(record))
+	{
+		if (importing && record != Journal::JR_STRING_ROWS)
+		{
+			rows.clear();
+			importing = false;
+		}
+
+		switch (record)
+		{
+			case Journal::JR_ADD_STRING:
+				if (addString() != journal.getInt())
+				{
+					throw BadFileException();
+				}
+				break;
+
+			case Journal::JR_SET_STRING:
+			{
+				unsigned int id = GetId(journal, *this);
+				if (!setActiveLanguage(GetLanguage(journal)))
+				{
+					throw BadFileException();
+				}
+
+				String str;
+				str.m_flags = journal.getInt();
+				if (str.m_flags & String::SF_POSITION) str.m_position = journal.getInt();
+				if (str.m_flags & String::SF_NAME)     str.m_name     = journal.getString();
+				if (str.m_flags & String::SF_VALUE)    str.m_value    = journal.getString();
+				if (str.m_flags & String::SF_COMMENT)  str.m_comment  = journal.getString();
+				setString(id, str);
+				break;
+			}
+
+			case Journal::JR_DELETE_STRING:
+				deleteString(GetId(journal, *this));
+				break;
+
+			case Journal::JR_SET_POSITION:
+			{
+				unsigned int id = GetId(journal, *this);
+				if (!setActiveLanguage(GetLanguage(journal)))
+				{
+					throw BadFileException();
+				}
+				setPosition(id, journal.getInt());
+				break;
+			}
+
+			case Journal::JR_ADD_LANGUAGE:
+				addLanguage(GetLanguage(journal));
+				break;
+
+			case Journal::JR_CHANGE_LANGUAGE:
+			{
+				LANGID from = GetLanguage(journal);
+				changeLanguage(from, GetLanguage(journal));
+				break;
+			}
+
+			case Journal::JR_DELETE_LANGUAGE:
+			{
+				LANGID deleted = GetLanguage(journal);
+				if (m_curVersion->m_values.size() < 2)
+				{
+					throw BadFileException();
+				}
+				deleteLanguage(deleted);
+				if (deleted == m_curLanguage)
+				{
+					setActiveVersion();
+				}
+				break;
+			}
+
+			case Journal::JR_SET_POSTFIX:
+			{
+				LANGID postfix = GetLanguage(journal);
+				setPostfix(postfix, journal.getString());
+				break;
+			}
+
+			case Journal::JR_ADD_STRINGS:
+				method = (Method)journal.getInt();
+				if (!setActiveLanguage(GetLanguage(journal)))
+				{
+					throw BadFileException();
+				}
+				pending   = journal.getInt();
+				importing = true;
+				break;
+
+			case Journal::JR_STRING_ROWS:
+			{
+				size_t count = journal.getInt();
+				if (!importing || count > pending)
+				{
+					throw BadFileException();
+				}
+				for (size_t i = 0; i < count; i++)
+				{
+					rows.push_back(StringList::StringInfo());
+					rows.back().m_name    = journal.getString();
+					rows.back().m_value   = journal.getString();
+					rows.back().m_comment = journal.getString();
+				}
+				pending -= count;
+				break;
+			}
+
+			default:
+				throw BadFileException();
+		}
+
+		if (importing && pending == 0)
+		{
+			StringList strings;
+			strings.reserve(rows.size());
+			for (size_t i = 0; i < rows.size(); i++)
+			{
+				strings.add(rows[i].m_name, rows[i].m_value, rows[i].m_comment);
+			}
+			vector<StringList::StringInfo>().swap(rows);
+			importing = false;
+			addStrings(strings, method);
+		}
+	}
+
+	if (!setActiveLanguage(language))
+	{
+		setActiveVersion();
+	}
+}
\ No newline at end of file
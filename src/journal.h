@@ -0,0 +1,68 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <vector>
+#include "files.h"
+
+class Document;
+
+// An append-only log of the changes that were made to a document since it was
+// last saved, so they can be replayed on the saved file if they're lost (see
+// Document::setJournal). A journal only applies to the saved versions it was
+// started for.
+//
+// Records are collected in memory and written in groups by flush(), so
+// recording a change costs next to nothing. Every record has its length and
+// checksum, so a record that was only partly written is ignored.
+class Journal
+{
+public:
+	enum Record
+	{
+		JR_ADD_STRING,
+		JR_SET_STRING,
+		JR_DELETE_STRING,
+		JR_SET_POSITION,
+		JR_ADD_LANGUAGE,
+		JR_CHANGE_LANGUAGE,
+		JR_DELETE_LANGUAGE,
+		JR_SET_POSTFIX,
+		JR_ADD_STRINGS,
+		JR_STRING_ROWS,		// The rows of the JR_ADD_STRINGS before them
+	};
+
+	// Writing records
+	void begin(Record record);
+	void put(uint32_t value);
+	void put(const std::wstring& str);
+	void put(const wchar_t* str, size_t length);
+	void end();
+
+	// Writes the records that were ended since the last flush
+	void flush();
+
+	// Reading records. next() returns false after the last complete record.
+	bool         next(Record& record);
+	uint32_t     getInt();
+	std::wstring getString();
+	bool         hasRecords() const { return m_next < m_data.size(); }
+
+	// Throws away all records and starts over for the document's saved versions
+	void reset(const Document& document);
+
+	// Opens a journal. If it was started for the document's saved versions,
+	// its records can be read and new records are added after them.
+	// Otherwise, it's reset.
+	Journal(IFile& file, const Document& document);
+
+private:
+	IFile&               m_file;
+	std::vector<uint8_t> m_buffer;		// Records that haven't been written yet
+	size_t               m_record;		// Start of the current record in m_buffer
+	std::vector<uint8_t> m_data;		// The records that were read
+	size_t               m_read;		// Position in m_data
+	size_t               m_next;		// Start of the next record in m_data
+};
+
+#endif
\ No newline at end of file
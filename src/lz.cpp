@@ -0,0 +1,184 @@
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include "lz.h"
+using namespace std;
+
+static const size_t MIN_MATCH  = 4;
+static const size_t MAX_OFFSET = 65535;
+static const int    HASH_BITS  = 14;
+
+static inline uint32_t Read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof value);
+	return value;
+}
+
+static inline uint32_t Hash(uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 and up continue in extra bytes, each adding up to 255
+static uint8_t* WriteLength(uint8_t* out, size_t length)
+{
+	for (length -= 15; length >= 255; length -= 255)
+	{
+		*out++ = 255;
+	}
+	*out++ = (uint8_t)length;
+	return out;
+}
+
+static bool ReadLength(const uint8_t*& in, const uint8_t* end, size_t& length)
+{
+	uint8_t byte;
+	do
+	{
+		if (in == end)
+		{
+			return false;
+		}
+		byte    = *in++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+static uint8_t* WriteSequence(uint8_t* out, const uint8_t* literals, size_t nLiterals, size_t offset, size_t length)
+{
+	uint8_t* token = out++;
+	*token = (uint8_t)(((nLiterals < 15) ? nLiterals : 15) << 4);
+	if (nLiterals >= 15)
+	{
+		out = WriteLength(out, nLiterals);
+	}
+	memcpy(out, literals, nLiterals);
+	out += nLiterals;
+
+	if (length > 0)
+	{
+		// Back-reference
+		*out++ = (uint8_t)(offset >> 0);
+		*out++ = (uint8_t)(offset >> 8);
+		length -= MIN_MATCH;
+		*token |= (uint8_t)((length < 15) ? length : 15);
+		if (length >= 15)
+		{
+			out = WriteLength(out, length);
+		}
+	}
+	return out;
+}
+
+size_t lz_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t lz_compress(const void* src, size_t size, void* dst)
+{
+	const uint8_t* in     = (const uint8_t*)src;
+	const uint8_t* end    = in + size;
+	const uint8_t* anchor = in;
+	uint8_t*       out    = (uint8_t*)dst;
+
+	if (size >= MIN_MATCH)
+	{
+		// Last position seen for each hashed 4-byte sequence, plus one
+		vector<uint32_t> table(1 << HASH_BITS, 0);
+
+		const uint8_t* last = end - MIN_MATCH;
+		for (const uint8_t* p = in; p <= last; )
+		{
+			uint32_t value = Read32(p);
+			uint32_t hash  = Hash(value);
+			uint32_t pos   = table[hash];
+			table[hash] = (uint32_t)(p - in) + 1;
+
+			if (pos != 0)
+			{
+				const uint8_t* ref = in + pos - 1;
+				if ((size_t)(p - ref) <= MAX_OFFSET && Read32(ref) == value)
+				{
+					// Found a match, extend it as far as possible
+					const uint8_t* q = p   + MIN_MATCH;
+					const uint8_t* r = ref + MIN_MATCH;
+					while (q < end && *q == *r)
+					{
+						q++;
+						r++;
+					}
+					out = WriteSequence(out, anchor, p - anchor, p - ref, q - p);
+					p = anchor = q;
+					continue;
+				}
+			}
+			p++;
+		}
+	}
+
+	// The stream always ends with a sequence of only literals
+	out = WriteSequence(out, anchor, end - anchor, 0, 0);
+	return out - (uint8_t*)dst;
+}
+
+bool lz_decompress(const void* src, size_t size, void* dst, size_t dstSize)
+{
+	const uint8_t* in     = (const uint8_t*)src;
+	const uint8_t* inEnd  = in + size;
+	uint8_t*       begin  = (uint8_t*)dst;
+	uint8_t*       out    = begin;
+	uint8_t*       outEnd = begin + dstSize;
+
+	while (in < inEnd)
+	{
+		uint8_t token = *in++;
+
+		// Copy literals
+		size_t nLiterals = token >> 4;
+		if (nLiterals == 15 && !ReadLength(in, inEnd, nLiterals))
+		{
+			return false;
+		}
+		if (nLiterals > (size_t)(inEnd - in) || nLiterals > (size_t)(outEnd - out))
+		{
+			return false;
+		}
+		memcpy(out, in, nLiterals);
+		in  += nLiterals;
+		out += nLiterals;
+
+		if (in == inEnd)
+		{
+			// Last sequence
+			break;
+		}
+
+		// Copy back-reference; it may overlap with the output
+		if (inEnd - in < 2)
+		{
+			return false;
+		}
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+
+		size_t length = token & 15;
+		if (length == 15 && !ReadLength(in, inEnd, length))
+		{
+			return false;
+		}
+		length += MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(out - begin) || length > (size_t)(outEnd - out))
+		{
+			return false;
+		}
+		for (const uint8_t* ref = out - offset; length > 0; length--)
+		{
+			*out++ = *ref++;
+		}
+	}
+	return out == outEnd;
+}
@@ -0,0 +1,21 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <cstddef>
+
+// A small LZ77 compressor in the spirit of LZ4: fast, byte-oriented and
+// good enough for repetitive text. The stream is a series of sequences,
+// each a run of literal bytes followed by a back-reference.
+
+// Returns the maximum compressed size of size bytes
+size_t lz_bound(size_t size);
+
+// Compresses size bytes from src into dst, which must hold lz_bound(size)
+// bytes. Returns the compressed size.
+size_t lz_compress(const void* src, size_t size, void* dst);
+
+// Decompresses size bytes from src into exactly dstSize bytes in dst.
+// Returns false if the data is corrupt.
+bool lz_decompress(const void* src, size_t size, void* dst, size_t dstSize);
+
+#endif
@@ -36,9 +36,24 @@ class CommandList
 			"                              the imported strings in.\n"
 			"export <lang> <file>          Exports DAT file. Lang is the language code of\n"
 			"                              the language that will be exported.\n"
+			"export-all <file>             Exports a DAT file for every language at once.\n"
+			"                              The postfix of the language (e.g. _ENGLISH) is\n"
+			"                              put before the extension of the filename.\n"
+			"history <name>                Prints the versions that changed the string with\n"
+			"                              this name, newest first, with its value in the\n"
+			"                              active language.\n"
 			"languages                     If no document is open it prints all supported\n"
 			"                              languages, with their language codes. Otherwise,\n"
 			"                              it prints the languages of the latest version.\n"
+			"save <author> <file>          Saves the changes as a new version by this author\n"
+			"                              and writes the document to a VDF file.\n"
+			"vacuum                        Removes strings that are no longer used from the\n"
+			"                              document and prints the number of bytes saved.\n\n"
+			"Files named mem:<name> are kept in memory instead of on disk, until the last\n"
+			"command has run. A file that's exported or saved to memory can be imported\n"
+			"or opened by the commands after it, e.g.:\n"
+			"open A.vdf export 1033 mem:a.dat open B.vdf import union 1033 mem:a.dat\n"
+			"export 1033 Final.dat\n"
 			;
 	}
 
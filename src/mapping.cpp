@@ -0,0 +1,93 @@
+#include "mapping.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#endif
+using namespace std;
+
+#ifdef _WIN32
+
+FileMapping* FileMapping::create(void* hFile)
+{
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0 || (ULONGLONG)size.QuadPart > (SIZE_T)-1)
+	{
+		return NULL;
+	}
+
+	HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+	{
+		return NULL;
+	}
+
+	// The view keeps the mapping object alive
+	const void* data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(hMapping);
+	return (data != NULL) ? new FileMapping(data, (size_t)size.QuadPart) : NULL;
+}
+
+FileMapping* FileMapping::create(const wstring& filename)
+{
+	HANDLE hFile = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+	FileMapping* mapping = create(hFile);
+	CloseHandle(hFile);
+	return mapping;
+}
+
+FileMapping::~FileMapping()
+{
+	UnmapViewOfFile(m_data);
+}
+
+#else
+
+FileMapping* FileMapping::create(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		return NULL;
+	}
+
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	return (data != MAP_FAILED) ? new FileMapping(data, (size_t)st.st_size) : NULL;
+}
+
+FileMapping* FileMapping::create(const wstring& filename)
+{
+	// Convert the name to the multi-byte encoding of the current locale
+	size_t len = wcstombs(NULL, filename.c_str(), 0);
+	if (len == (size_t)-1)
+	{
+		return NULL;
+	}
+	string name(len, '\0');
+	wcstombs(&name[0], filename.c_str(), len + 1);
+
+	int fd = open(name.c_str(), O_RDONLY);
+	if (fd == -1)
+	{
+		return NULL;
+	}
+	FileMapping* mapping = create(fd);
+	close(fd);
+	return mapping;
+}
+
+FileMapping::~FileMapping()
+{
+	munmap((void*)m_data, m_size);
+}
+
+#endif
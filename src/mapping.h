@@ -0,0 +1,32 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <string>
+
+// A read-only memory mapping of an entire file. The view stays valid after
+// the file it was created from has been closed, but the file must not be
+// truncated or overwritten while the mapping exists.
+class FileMapping
+{
+public:
+	const void* data() const { return m_data; }
+	size_t      size() const { return m_size; }
+
+	// These return NULL if the file can't be mapped (e.g. empty files)
+#ifdef _WIN32
+	static FileMapping* create(void* hFile);
+#else
+	static FileMapping* create(int fd);
+#endif
+	static FileMapping* create(const std::wstring& filename);
+
+	~FileMapping();
+
+private:
+	FileMapping(const void* data, size_t size) : m_data(data), m_size(size) {}
+
+	const void* m_data;
+	size_t      m_size;
+};
+
+#endif
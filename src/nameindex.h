@@ -0,0 +1,262 @@
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+
+#include <vector>
+#include <cwchar>
+#include "types.h"
+
+// A hash index of the names of strings. It doesn't store the names: every
+// function gets the strings (anything where strings[id].m_name is the name of
+// string id), so a string has to be erased before its name changes and
+// inserted again afterwards.
+//
+// Every name has one entry with the number of strings that have it, its
+// lowest id and a chain of all its ids. New ids go to the head of the chain
+// and the chain is linked both ways, so inserting and erasing don't depend
+// on how many strings share the name.
+template <typename Strings>
+class NameIndex
+{
+public:
+	static const uint32_t NO_ID = 0xFFFFFFFF;
+
+	// These return the number of strings with the name afterwards
+	size_t insert(unsigned int id, const Strings& strings)
+	{
+		if (id >= m_next.size())
+		{
+			m_next.resize(id + 1, NO_ID);
+			m_prev.resize(id + 1, NO_ID);
+		}
+		if ((m_size + 1) * 4 > m_slots.size() * 3)
+		{
+			grow(max(m_slots.size() * 2, (size_t)64));
+		}
+
+		const wchar_t* name = strings[id].m_name;
+		uint32_t       hash = Hash(name);
+		size_t         i    = lookup(name, hash, strings);
+		Slot&          slot = m_slots[i];
+		if (slot.count == 0)
+		{
+			slot.hash   = hash;
+			slot.first  = id;
+			slot.lowest = id;
+			slot.count  = 1;
+			m_next[id]  = NO_ID;
+			m_prev[id]  = NO_ID;
+			m_size++;
+			return 1;
+		}
+
+		m_next[id]         = slot.first;
+		m_prev[id]         = NO_ID;
+		m_prev[slot.first] = id;
+		slot.first         = id;
+		if (slot.lowest != NO_ID)
+		{
+			slot.lowest = min(slot.lowest, (uint32_t)id);
+		}
+		return ++slot.count;
+	}
+
+	size_t erase(unsigned int id, const Strings& strings)
+	{
+		if (m_size == 0)
+		{
+			return 0;
+		}
+
+		const wchar_t* name = strings[id].m_name;
+		size_t         i    = lookup(name, Hash(name), strings);
+		Slot&          slot = m_slots[i];
+		if (slot.count == 0 || id >= m_prev.size() || (m_prev[id] == NO_ID && slot.first != id))
+		{
+			// The id isn't in the chain of its name
+			return slot.count;
+		}
+
+		if (--slot.count == 0)
+		{
+			m_next[id] = NO_ID;
+			remove(i);
+			return 0;
+		}
+
+		if (m_prev[id] != NO_ID)
+		{
+			m_next[m_prev[id]] = m_next[id];
+		}
+		else
+		{
+			slot.first = m_next[id];
+		}
+		if (m_next[id] != NO_ID)
+		{
+			m_prev[m_next[id]] = m_prev[id];
+		}
+		m_next[id] = NO_ID;
+		m_prev[id] = NO_ID;
+
+		if (slot.lowest == id)
+		{
+			// find() looks for the new lowest id when it's asked for
+			slot.lowest = NO_ID;
+		}
+		return slot.count;
+	}
+
+	// Returns the lowest id of the strings with this name, or NO_ID
+	unsigned int find(const wchar_t* name, const Strings& strings) const
+	{
+		if (m_size == 0)
+		{
+			return NO_ID;
+		}
+		const Slot& slot = m_slots[lookup(name, Hash(name), strings)];
+		if (slot.count == 0)
+		{
+			return NO_ID;
+		}
+		if (slot.lowest == NO_ID)
+		{
+			// The lowest id was erased; this is the only walk of a chain
+			slot.lowest = slot.first;
+			for (uint32_t id = m_next[slot.first]; id != NO_ID; id = m_next[id])
+			{
+				slot.lowest = min(slot.lowest, id);
+			}
+		}
+		return slot.lowest;
+	}
+
+	// Returns the id at the head of the chain of this name, or NO_ID. With
+	// next(), this visits every id with the name, in no particular order.
+	unsigned int first(const wchar_t* name, const Strings& strings) const
+	{
+		if (m_size == 0)
+		{
+			return NO_ID;
+		}
+		const Slot& slot = m_slots[lookup(name, Hash(name), strings)];
+		return (slot.count != 0) ? slot.first : NO_ID;
+	}
+
+	// Returns the next id in the chain of the name of id, or NO_ID
+	unsigned int next(unsigned int id) const
+	{
+		return m_next[id];
+	}
+
+	// Returns the number of strings with this name
+	size_t count(const wchar_t* name, const Strings& strings) const
+	{
+		return (m_size != 0) ? m_slots[lookup(name, Hash(name), strings)].count : 0;
+	}
+
+	// Makes room for this many names without growing
+	void reserve(size_t size)
+	{
+		size_t capacity = 64;
+		while (size * 4 > capacity * 3)
+		{
+			capacity *= 2;
+		}
+		if (capacity > m_slots.size())
+		{
+			grow(capacity);
+		}
+	}
+
+	void clear()
+	{
+		m_slots.clear();
+		m_next.clear();
+		m_prev.clear();
+		m_size = 0;
+	}
+
+	NameIndex() : m_size(0) {}
+
+private:
+	struct Slot
+	{
+		uint32_t         hash;
+		uint32_t         first;		// Head of the chain
+		mutable uint32_t lowest;	// Lowest id with the name, NO_ID if not known
+		uint32_t         count;		// Zero for an empty slot
+
+		Slot() : hash(0), first(NO_ID), lowest(NO_ID), count(0) {}
+	};
+
+	// FNV-1a
+	static uint32_t Hash(const wchar_t* name)
+	{
+		uint32_t hash = 2166136261u;
+		for (; *name != L'\0'; name++)
+		{
+			hash = (hash ^ (uint32_t)*name) * 16777619u;
+		}
+		return hash;
+	}
+
+	// Returns the slot of the name, or the empty slot where it belongs
+	size_t lookup(const wchar_t* name, uint32_t hash, const Strings& strings) const
+	{
+		size_t mask = m_slots.size() - 1;
+		size_t i    = hash & mask;
+		while (m_slots[i].count != 0 && (m_slots[i].hash != hash || wcscmp(strings[m_slots[i].first].m_name, name) != 0))
+		{
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+
+	// Empties slot i and moves the slots after it back, so every name can
+	// still be found from the slot it hashes to
+	void remove(size_t i)
+	{
+		size_t mask = m_slots.size() - 1;
+		for (size_t j = (i + 1) & mask; m_slots[j].count != 0; j = (j + 1) & mask)
+		{
+			size_t home = m_slots[j].hash & mask;
+			if (((j - home) & mask) >= ((j - i) & mask))
+			{
+				m_slots[i] = m_slots[j];
+				i = j;
+			}
+		}
+		m_slots[i] = Slot();
+		m_size--;
+	}
+
+	void grow(size_t capacity)
+	{
+		std::vector<Slot> slots(capacity);
+		m_slots.swap(slots);
+
+		size_t mask = capacity - 1;
+		for (size_t s = 0; s < slots.size(); s++)
+		{
+			if (slots[s].count != 0)
+			{
+				size_t i = slots[s].hash & mask;
+				while (m_slots[i].count != 0)
+				{
+					i = (i + 1) & mask;
+				}
+				m_slots[i] = slots[s];
+			}
+		}
+	}
+
+	std::vector<Slot>     m_slots;		// Power-of-two sized, linear probing
+	std::vector<uint32_t> m_next;		// Next id in the chain, by id
+	std::vector<uint32_t> m_prev;		// Previous id in the chain, by id
+	size_t                m_size;		// Used slots
+};
+
+template <typename Strings>
+const uint32_t NameIndex<Strings>::NO_ID;
+
+#endif
\ No newline at end of file
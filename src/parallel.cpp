@@ -0,0 +1,123 @@
+#include <vector>
+#include "parallel.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+// The jobs of a task that are left. Every thread takes the next job until
+// there are none left.
+struct Pool
+{
+	IParallelTask* task;
+	size_t         count;
+	volatile long  next;
+};
+
+#ifdef _WIN32
+
+static unsigned int __stdcall Worker(void* param)
+{
+	Pool* pool = (Pool*)param;
+	for (;;)
+	{
+		size_t i = (size_t)InterlockedIncrement(&pool->next) - 1;
+		if (i >= pool->count)
+		{
+			break;
+		}
+		pool->task->run(i);
+	}
+	return 0;
+}
+
+static size_t GetNumProcessors()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+
+void RunParallel(IParallelTask& task, size_t count)
+{
+	Pool pool = {&task, count, 0};
+
+	// The calling thread is one of the workers
+	vector<HANDLE> threads;
+	size_t nThreads = min(count, GetNumProcessors());
+	for (size_t t = 1; t < nThreads; t++)
+	{
+		HANDLE hThread = (HANDLE)_beginthreadex(NULL, 0, Worker, &pool, 0, NULL);
+		if (hThread != NULL)
+		{
+			threads.push_back(hThread);
+		}
+	}
+	Worker(&pool);
+
+	if (!threads.empty())
+	{
+		WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+	}
+	for (size_t t = 0; t < threads.size(); t++)
+	{
+		CloseHandle(threads[t]);
+	}
+}
+
+#else
+
+static pthread_mutex_t g_poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* Worker(void* param)
+{
+	Pool* pool = (Pool*)param;
+	for (;;)
+	{
+		pthread_mutex_lock(&g_poolLock);
+		size_t i = (size_t)pool->next++;
+		pthread_mutex_unlock(&g_poolLock);
+		if (i >= pool->count)
+		{
+			break;
+		}
+		pool->task->run(i);
+	}
+	return NULL;
+}
+
+static size_t GetNumProcessors()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (size_t)n : 1;
+}
+
+void RunParallel(IParallelTask& task, size_t count)
+{
+	Pool pool = {&task, count, 0};
+
+	// The calling thread is one of the workers
+	vector<pthread_t> threads;
+	size_t nThreads = (count < GetNumProcessors()) ? count : GetNumProcessors();
+	for (size_t t = 1; t < nThreads; t++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, Worker, &pool) == 0)
+		{
+			threads.push_back(thread);
+		}
+	}
+	Worker(&pool);
+
+	for (size_t t = 0; t < threads.size(); t++)
+	{
+		pthread_join(threads[t], NULL);
+	}
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+
+// A task that's split into jobs that can run at the same time
+class IParallelTask
+{
+public:
+	// Runs job i. This is called from several threads at once, and must not
+	// throw; a job that fails has to record that itself.
+	virtual void run(size_t i) = 0;
+	virtual ~IParallelTask() {}
+};
+
+// Runs jobs 0 to count - 1 of the task on a pool of threads, at most one per
+// processor, and returns when they're all done. The calling thread runs
+// jobs as well.
+void RunParallel(IParallelTask& task, size_t count);
+
+#endif
\ No newline at end of file
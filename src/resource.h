@@ -1,7 +1,7 @@
 #ifndef RESOURCE_H
 #define RESOURCE_H
 
-#include "Resources\resource.en.h"
-#include "Resources\resource.h"
+#include "resources/resource.en.h"
+#include "resources/resource.h"
 
 #endif
\ No newline at end of file
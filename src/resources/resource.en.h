@@ -67,6 +67,9 @@
 #define IDS_FILEINFO_INDEX_INDEXED      151
 #define IDS_ERROR_WINDOW_CREATE         152
 #define IDS_ERROR_FILE_CREATE           153
+#define IDS_QUERY_RECOVER_CHANGES       154
+#define IDS_TITLE_RECOVER_CHANGES       155
+#define IDS_ERROR_RECOVER_CHANGES       156
 #define IDC_EDIT1                       1001
 #define IDC_EDIT2                       1002
 #define IDC_LIST1                       1003
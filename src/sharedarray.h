@@ -0,0 +1,156 @@
+#ifndef SHAREDARRAY_H
+#define SHAREDARRAY_H
+
+#include <vector>
+
+// An array that is stored in fixed-size chunks which are shared between
+// copies of the array. Copying only copies the chunk pointers; a chunk is
+// copied when an element in it is changed while it's shared (copy-on-write).
+//
+// There's deliberately no non-const operator[]; use edit() to change an
+// element, so reading never unshares a chunk.
+template <typename T>
+class SharedArray
+{
+public:
+	static const size_t CHUNK_SHIFT = 8;
+	static const size_t CHUNK_SIZE  = 1 << CHUNK_SHIFT;
+
+	size_t size()  const { return m_size; }
+	bool   empty() const { return m_size == 0; }
+
+	const T& operator[](size_t i) const { return m_chunks[i >> CHUNK_SHIFT]->items[i & (CHUNK_SIZE - 1)]; }
+
+	T& edit(size_t i)
+	{
+		Chunk*& chunk = m_chunks[i >> CHUNK_SHIFT];
+		if (chunk->refs > 1)
+		{
+			unshare(chunk);
+		}
+		return chunk->items[i & (CHUNK_SIZE - 1)];
+	}
+
+	void push_back(const T& value)
+	{
+		if ((m_size & (CHUNK_SIZE - 1)) == 0)
+		{
+			m_chunks.push_back(new Chunk);
+		}
+		else if (m_chunks.back()->refs > 1)
+		{
+			unshare(m_chunks.back());
+		}
+		m_chunks.back()->items[m_size++ & (CHUNK_SIZE - 1)] = value;
+	}
+
+	void resize(size_t size, const T& value = T())
+	{
+		while (m_size < size)
+		{
+			push_back(value);
+		}
+
+		size_t nChunks = (size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+		while (m_chunks.size() > nChunks)
+		{
+			release(m_chunks.back());
+			m_chunks.pop_back();
+		}
+		m_size = size;
+	}
+
+	void clear()
+	{
+		resize(0);
+	}
+
+	void swap(SharedArray& other)
+	{
+		m_chunks.swap(other.m_chunks);
+		std::swap(m_size, other.m_size);
+	}
+
+	// Shares the chunks that are equal to the same chunk of another array
+	void share(const SharedArray& other)
+	{
+		for (size_t c = 0; c < m_chunks.size() && c < other.m_chunks.size(); c++)
+		{
+			if (m_chunks[c] != other.m_chunks[c] && chunkLength(c) == other.chunkLength(c))
+			{
+				const T* a = m_chunks[c]->items;
+				const T* b = other.m_chunks[c]->items;
+				size_t   n = chunkLength(c), i;
+				for (i = 0; i < n && a[i] == b[i]; i++);
+				if (i == n)
+				{
+					release(m_chunks[c]);
+					m_chunks[c] = other.m_chunks[c];
+					m_chunks[c]->refs++;
+				}
+			}
+		}
+	}
+
+	// Direct access to the chunks. Changes through chunk() are seen by all
+	// arrays that share the chunk; chunkId() identifies a shared chunk.
+	size_t      chunkCount()          const { return m_chunks.size(); }
+	size_t      chunkLength(size_t c) const { return (c + 1 < m_chunks.size()) ? CHUNK_SIZE : m_size - (c << CHUNK_SHIFT); }
+	const void* chunkId(size_t c)     const { return m_chunks[c]; }
+	T*          chunk(size_t c)             { return m_chunks[c]->items; }
+
+	SharedArray() : m_size(0) {}
+
+	SharedArray(const SharedArray& other) : m_chunks(other.m_chunks), m_size(other.m_size)
+	{
+		for (size_t c = 0; c < m_chunks.size(); c++)
+		{
+			m_chunks[c]->refs++;
+		}
+	}
+
+	SharedArray& operator=(const SharedArray& other)
+	{
+		SharedArray copy(other);
+		swap(copy);
+		return *this;
+	}
+
+	~SharedArray()
+	{
+		for (size_t c = 0; c < m_chunks.size(); c++)
+		{
+			release(m_chunks[c]);
+		}
+	}
+
+private:
+	struct Chunk
+	{
+		size_t refs;
+		T      items[CHUNK_SIZE];
+
+		Chunk() : refs(1) {}
+	};
+
+	static void unshare(Chunk*& chunk)
+	{
+		Chunk* copy = new Chunk(*chunk);
+		copy->refs = 1;
+		chunk->refs--;
+		chunk = copy;
+	}
+
+	static void release(Chunk* chunk)
+	{
+		if (--chunk->refs == 0)
+		{
+			delete chunk;
+		}
+	}
+
+	std::vector<Chunk*> m_chunks;
+	size_t              m_size;
+};
+
+#endif
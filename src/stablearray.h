@@ -0,0 +1,96 @@
+#ifndef STABLEARRAY_H
+#define STABLEARRAY_H
+
+#include <vector>
+
+// An array that is stored in fixed-size chunks, so its elements never move
+// when it grows. Pointers into an element (e.g., the c_str() of a wstring)
+// stay valid until the element is changed or the array shrinks past it.
+//
+// Copying an array copies the elements, so the copy's elements are at
+// other addresses; swap() keeps them where they are.
+template <typename T>
+class StableArray
+{
+public:
+	static const size_t CHUNK_SHIFT = 8;
+	static const size_t CHUNK_SIZE  = 1 << CHUNK_SHIFT;
+
+	size_t size()  const { return m_size; }
+	bool   empty() const { return m_size == 0; }
+
+	const T& operator[](size_t i) const { return m_chunks[i >> CHUNK_SHIFT][i & (CHUNK_SIZE - 1)]; }
+	T&       operator[](size_t i)       { return m_chunks[i >> CHUNK_SHIFT][i & (CHUNK_SIZE - 1)]; }
+
+	void push_back(const T& value)
+	{
+		if (m_size == m_chunks.size() << CHUNK_SHIFT)
+		{
+			m_chunks.push_back(new T[CHUNK_SIZE]);
+		}
+		(*this)[m_size++] = value;
+	}
+
+	void resize(size_t size, const T& value = T())
+	{
+		while (m_size < size)
+		{
+			push_back(value);
+		}
+
+		// Removed elements are reset, so they start out fresh when they're added again
+		size_t nChunks = (size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+		while (m_chunks.size() > nChunks)
+		{
+			delete[] m_chunks.back();
+			m_chunks.pop_back();
+		}
+		for (size_t i = size; i < (m_chunks.size() << CHUNK_SHIFT) && i < m_size; i++)
+		{
+			(*this)[i] = T();
+		}
+		m_size = size;
+	}
+
+	void clear()
+	{
+		resize(0);
+	}
+
+	void swap(StableArray& other)
+	{
+		m_chunks.swap(other.m_chunks);
+		std::swap(m_size, other.m_size);
+	}
+
+	StableArray() : m_size(0) {}
+
+	StableArray(const StableArray& other) : m_size(0)
+	{
+		for (size_t i = 0; i < other.size(); i++)
+		{
+			push_back(other[i]);
+		}
+	}
+
+	StableArray& operator=(const StableArray& other)
+	{
+		StableArray copy(other);
+		swap(copy);
+		return *this;
+	}
+
+	~StableArray()
+	{
+		for (size_t c = 0; c < m_chunks.size(); c++)
+		{
+			delete[] m_chunks[c];
+		}
+	}
+
+private:
+	std::vector<T*> m_chunks;
+	size_t          m_size;
+};
+
+#endif
\ No newline at end of file
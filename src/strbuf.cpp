@@ -1,47 +1,284 @@
+#include <algorithm>
 #include "strbuf.h"
+#include "crc32.h"
 #include "exceptions.h"
+#include "lz.h"
 using namespace std;
 
-static const size_t  STRING_BUFFER_SIZE = 512*1024;	// 512 kB
+static const size_t   MAX_CHUNK_SIZE     = 1024*1024;	// Characters; chunks stop doubling at this size
+static const size_t   BLOCK_SIZE         = 32*1024;		// Characters per compressed block
+static const size_t   MIN_INDEX_SIZE     = 1024;		// Must be a power of two
+static const uint32_t EMPTY_SLOT         = UINT32_MAX;
+
+#pragma pack(1)
+struct POOLINFO
+{
+	uint32_t size;		// In characters
+	uint32_t nBlocks;
+};
+
+// Blocks always start and end on string boundaries and follow each other
+// in the pool, so the block index doesn't need to store their offsets.
+struct BLOCKDESC
+{
+	uint32_t length;	// In characters
+	uint32_t packedSize;	// In bytes; equal to the unpacked size if stored as-is
+};
+
+// In the index that readBlocks() reads, blocks still follow each other in
+// the pool, but not in the file. Checked indexes also store the CRC of the
+// packed data; unchecked ones end each entry before it.
+struct BLOCKENTRY
+{
+	uint32_t length;
+	uint32_t packedSize;
+	uint32_t offset;
+	uint32_t crc;
+};
+#pragma pack()
+
+static size_t EntrySize(bool checked)
+{
+	return checked ? sizeof(BLOCKENTRY) : sizeof(BLOCKENTRY) - sizeof(uint32_t);
+}
+
+struct StringBuffer::BlockRange
+{
+	size_t buffer;
+	size_t start;
+	size_t length;
+};
+
+// FNV-1a over the UTF-16 code units of the string
+static uint32_t HashString(const wchar_t* str, size_t length)
+{
+	uint32_t hash = 2166136261U;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ (uint16_t)str[i]) * 16777619U;
+	}
+	return hash;
+}
+
+// Orders pooled strings the way the old std::map index did, so the offset
+// table in the file stays the same
+struct EntryLess
+{
+	const wchar_t* const* strings;
+	bool operator()(uint32_t left, uint32_t right) const {
+		return wcscmp(strings[left], strings[right]) < 0;
+	}
+};
+
+const StringBuffer::Entry* StringBuffer::find(const wchar_t* str, size_t length, uint32_t hash) const
+{
+	if (!m_slots.empty())
+	{
+		size_t mask = m_slots.size() - 1;
+		for (size_t i = hash & mask; m_slots[i].entry != EMPTY_SLOT; i = (i + 1) & mask)
+		{
+			if (m_slots[i].hash == hash)
+			{
+				const Entry& entry = m_entries[m_slots[i].entry];
+				if (entry.length == length && wmemcmp(entry.str, str, length) == 0)
+				{
+					return &entry;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+void StringBuffer::insert(const Entry& entry, uint32_t hash) const
+{
+	// Keep the load factor at or below 50%
+	if ((m_entries.size() + 1) * 2 > m_slots.size())
+	{
+		grow();
+	}
+
+	size_t mask = m_slots.size() - 1;
+	size_t i    = hash & mask;
+	while (m_slots[i].entry != EMPTY_SLOT)
+	{
+		i = (i + 1) & mask;
+	}
+	m_slots[i].hash  = hash;
+	m_slots[i].entry = (uint32_t)m_entries.size();
+	m_entries.push_back(entry);
+}
+
+void StringBuffer::grow() const
+{
+	vector<Slot> slots(max(m_slots.size() * 2, MIN_INDEX_SIZE));
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		slots[i].entry = EMPTY_SLOT;
+	}
+
+	// Rehash using the stored hashes; the strings aren't touched
+	size_t mask = slots.size() - 1;
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if (m_slots[i].entry != EMPTY_SLOT)
+		{
+			size_t j = m_slots[i].hash & mask;
+			while (slots[j].entry != EMPTY_SLOT)
+			{
+				j = (j + 1) & mask;
+			}
+			slots[j] = m_slots[i];
+		}
+	}
+	m_slots.swap(slots);
+}
+
+void StringBuffer::buildIndex() const
+{
+	// The strings in the pool are stored back to back, so we can just walk it
+	for (size_t i = 0; i < m_buffers.size(); i++)
+	{
+		if (m_buffers[i].data == NULL)
+		{
+			unpack(i);
+		}
+
+		const Buffer& buffer = m_buffers[i];
+		for (size_t pos = 0; pos < buffer.used; )
+		{
+			Entry entry;
+			entry.str    = buffer.data + pos;
+			entry.offset = (uint32_t)(m_starts[i] + pos);
+			entry.length = (uint32_t)wcslen(entry.str);
+
+			uint32_t hash = HashString(entry.str, entry.length);
+			if (find(entry.str, entry.length, hash) == NULL)
+			{
+				insert(entry, hash);
+			}
+			pos += entry.length + 1;
+		}
+	}
+	m_indexed = true;
+}
+
+// Blocks are only checked here, when they're first used, so opening a file
+// doesn't have to read all of them
+void StringBuffer::unpack(size_t i) const
+{
+	Buffer& buffer = m_buffers[i];
+	if (buffer.checked && crc32(buffer.packed, buffer.packedSize) != buffer.crc)
+	{
+		throw BadFileException();
+	}
+
+	size_t   size = buffer.used * sizeof(wchar_t);
+	wchar_t* data = new wchar_t[buffer.used];
+
+	bool valid = true;
+	if (buffer.packedSize == size)
+	{
+		memcpy(data, buffer.packed, size);
+	}
+	else
+	{
+		valid = lz_decompress(buffer.packed, buffer.packedSize, data, size);
+	}
+
+	if (!valid || data[buffer.used - 1] != L'\0')
+	{
+		delete[] data;
+		throw BadFileException();
+	}
+	buffer.data = data;
+}
 
 const wchar_t* StringBuffer::addString(const wstring& str)
 {
-	// First, check the index
-	wchar_t* src = (wchar_t*)str.c_str();
-	Index::const_iterator p = m_index.find(src);
-	if (p != m_index.end())
+	return addString(str.c_str());
+}
+
+const wchar_t* StringBuffer::addString(const wchar_t* str)
+{
+	if (!m_indexed)
 	{
-		return p->first;
+		buildIndex();
 	}
 
-	Buffer* buffer = (m_buffers.size() == 0) ? NULL : &m_buffers.back();
-	if (buffer == NULL || buffer->size - buffer->used < str.length())
+	// First, check the index
+	size_t   length = wcslen(str);
+	uint32_t hash   = HashString(str, length);
+	const Entry* p  = find(str, length, hash);
+	if (p != NULL)
 	{
-		// Allocate new buffer
-		Buffer strbuf;
-		strbuf.size = STRING_BUFFER_SIZE;
-		strbuf.data = new wchar_t[strbuf.size];
-		strbuf.used = 0;
-		m_starts.push_back( (buffer != NULL) ? m_starts.back() + buffer->used : 0);
-		m_buffers.push_back(strbuf);
-		buffer = &m_buffers.back();
+		return p->str;
 	}
 
 	// Copy string
-	wchar_t* dest = buffer->data + buffer->used;
-	wcscpy_s( dest, buffer->size - buffer->used, str.c_str() );
+	wchar_t*      dest   = allocate(length + 1);
+	const Buffer& buffer = m_buffers.back();
+	wmemcpy(dest, str, length + 1);
 
 	// Add to index
-	Desc desc;
-	desc.buffer  = m_buffers.size() - 1;
-	desc.offset  = buffer->used;
-	m_index.insert(make_pair(dest, desc));
-
-	buffer->used += str.length() + 1;
+	Entry entry;
+	entry.str    = dest;
+	entry.offset = (uint32_t)(m_starts.back() + (dest - buffer.data));
+	entry.length = (uint32_t)length;
+	insert(entry, hash);
 
 	return dest;
 }
 
+wchar_t* StringBuffer::allocate(size_t length)
+{
+	Buffer* buffer = (m_buffers.size() == 0) ? NULL : &m_buffers.back();
+	if (buffer == NULL || buffer->size - buffer->used < length)
+	{
+		// Start a new chunk; the tail of the last one is lost, since strings
+		// in the pool are stored back to back.
+		Buffer chunk;
+		chunk.size       = max(m_chunkSize, length);
+		chunk.data       = new wchar_t[chunk.size];
+		chunk.used       = 0;
+		chunk.owned      = true;
+		chunk.packed     = NULL;
+		chunk.packedSize = 0;
+		chunk.crc        = 0;
+		chunk.checked    = false;
+		if (length <= m_chunkSize && m_chunkSize < MAX_CHUNK_SIZE)
+		{
+			// Oversized strings get a chunk of their own and don't count
+			m_chunkSize = min(m_chunkSize * 2, MAX_CHUNK_SIZE);
+		}
+		m_starts.push_back( (buffer != NULL) ? m_starts.back() + buffer->used : 0);
+		m_buffers.push_back(chunk);
+		buffer = &m_buffers.back();
+	}
+
+	wchar_t* data = buffer->data + buffer->used;
+	buffer->used += length;
+	return data;
+}
+
+void StringBuffer::getStatistics(Statistics& stats) const
+{
+	stats.nChunks   = m_buffers.size();
+	stats.allocated = 0;
+	stats.used      = 0;
+	stats.wasted    = 0;
+	for (size_t i = 0; i < m_buffers.size(); i++)
+	{
+		const Buffer& buffer = m_buffers[i];
+		stats.allocated += buffer.size;
+		stats.used      += buffer.used;
+		if (i + 1 < m_buffers.size())
+		{
+			stats.wasted += buffer.size - buffer.used;
+		}
+	}
+}
+
 void StringBuffer::read(IFile& input)
 {
 	// Read string count
@@ -52,67 +289,306 @@ void StringBuffer::read(IFile& input)
 	}
 	unsigned long nStrings = letohl(leSize);
 
-	// Read string offsets
-	vector<uint32_t> leOffsets(nStrings + 1);
-	unsigned long size = (nStrings + 1) * sizeof(uint32_t);
-	if (input.read(&leOffsets[0], size) != size)
+	// Skip the string offsets; the index is rebuilt from the strings themselves
+	// when it's needed. The last offset is the size of the pool.
+	if (nStrings > (input.size() - input.tell()) / sizeof(uint32_t))
+	{
+		throw ReadException();
+	}
+	input.seek(input.tell() + nStrings * sizeof(uint32_t));
+
+	uint32_t leTotal;
+	if (input.read(&leTotal, sizeof leTotal) != sizeof leTotal)
 	{
 		throw ReadException();
 	}
 
 	Buffer buffer;
-	buffer.size = letohl( (unsigned long)leOffsets.back() );
-	buffer.used = buffer.size;
-	buffer.data = NULL;
+	buffer.size       = letohl(leTotal);
+	buffer.used       = buffer.size;
+	buffer.data       = NULL;
+	buffer.owned      = true;
+	buffer.packed     = NULL;
+	buffer.packedSize = 0;
+	buffer.crc        = 0;
+	buffer.checked    = false;
 
-	try
+	unsigned long start = input.tell();
+	unsigned long size  = (unsigned long)(buffer.used * sizeof(wchar_t));
+	if (buffer.size > (input.size() - start) / sizeof(wchar_t))
 	{
-		// Read strings
-		buffer.data = new wchar_t[buffer.size];
+		throw ReadException();
+	}
 
-		unsigned long size = (unsigned long)(buffer.used * sizeof(wchar_t));
-		if (input.read(buffer.data, size) != size)
+	FileMapping* mapping = input.map();
+	// Optimized string functions may assume that wide strings are aligned
+	if (mapping != NULL && start + size <= mapping->size() &&
+		((uintptr_t)mapping->data() + start) % sizeof(wchar_t) == 0)
+	{
+		// Use the strings straight from the file; the mapping is read-only,
+		// but we never append to this buffer since it's full.
+		buffer.data  = (wchar_t*)((const char*)mapping->data() + start);
+		buffer.owned = false;
+		input.seek(start + size);
+	}
+	else
+	{
+		delete mapping;
+		mapping = NULL;
+		try
+		{
+			// Read strings
+			buffer.data = new wchar_t[buffer.size];
+			if (input.read(buffer.data, size) != size)
+			{
+				throw ReadException();
+			}
+		}
+		catch (...)
+		{
+			delete[] buffer.data;
+			throw;
+		}
+	}
+
+	if (buffer.size > 0 && buffer.data[buffer.size - 1] != L'\0')
+	{
+		if (buffer.owned) delete[] buffer.data;
+		delete mapping;
+		throw BadFileException();
+	}
+
+	m_buffers.push_back(buffer);
+	m_starts.push_back(0);
+	m_mapping = mapping;
+	m_indexed = (buffer.used == 0);
+}
+
+void StringBuffer::readCompressed(IFile& input)
+{
+	POOLINFO info;
+	if (input.read(&info, sizeof info) != sizeof info)
+	{
+		throw ReadException();
+	}
+	unsigned long size    = letohl(info.size);
+	unsigned long nBlocks = letohl(info.nBlocks);
+	if (nBlocks > (input.size() - input.tell()) / sizeof(BLOCKDESC))
+	{
+		throw ReadException();
+	}
+
+	vector<uint8_t>  copy;
+	const BLOCKDESC* blocks = (const BLOCKDESC*)ReadView(input, copy, nBlocks * sizeof(BLOCKDESC));
+
+	// Every block becomes a buffer that is unpacked when it's first used
+	unsigned long  start  = input.tell();
+	size_t         total  = 0;
+	size_t         packed = 0;
+	vector<Buffer> buffers(nBlocks);
+	vector<size_t> starts(nBlocks);
+	for (unsigned long i = 0; i < nBlocks; i++)
+	{
+		Buffer& buffer = buffers[i];
+		buffer.data       = NULL;
+		buffer.size       = letohl(blocks[i].length);
+		buffer.used       = buffer.size;
+		buffer.owned      = true;
+		buffer.packed     = NULL;
+		buffer.packedSize = letohl(blocks[i].packedSize);
+		buffer.crc        = 0;
+		buffer.checked    = false;
+		if (buffer.used == 0 || buffer.used > size - total || buffer.packedSize == 0)
+		{
+			throw BadFileException();
+		}
+		if (buffer.packedSize > input.size() - start - packed)
 		{
 			throw ReadException();
 		}
+		starts[i] = total;
+		total    += buffer.used;
+		packed   += buffer.packedSize;
+	}
+
+	if (total != size)
+	{
+		throw BadFileException();
+	}
 
-		// Create index
-		m_buffers.push_back(buffer);
-		m_starts.push_back(0);
-		for (size_t i = 0; i < leOffsets.size(); i++)
+	FileMapping* mapping = input.map();
+	if (mapping != NULL && start + packed <= mapping->size())
+	{
+		// Leave the compressed blocks in the file
+		m_packed = (const uint8_t*)mapping->data() + start;
+		input.seek((unsigned long)(start + packed));
+	}
+	else
+	{
+		delete mapping;
+		mapping = NULL;
+
+		m_packedCopy = new uint8_t[packed];
+		if (input.read(m_packedCopy, (unsigned long)packed) != packed)
 		{
-			Desc desc;
-			desc.buffer = 0;
-			desc.offset = letohl( (unsigned long)leOffsets[i] );
-			m_index.insert(make_pair(buffer.data + desc.offset, desc));
+			throw ReadException();
 		}
+		m_packed = m_packedCopy;
 	}
-	catch (...)
+
+	for (unsigned long i = 0, offset = 0; i < nBlocks; i++)
 	{
-		delete[] buffer.data;
-		throw;
+		buffers[i].packed = m_packed + offset;
+		offset += (unsigned long)buffers[i].packedSize;
 	}
+
+	m_buffers.swap(buffers);
+	m_starts.swap(starts);
+	m_packedSize = packed;
+	m_mapping    = mapping;
+	m_indexed    = (size == 0);
+}
+
+void StringBuffer::readBlocks(IFile& input, bool checked)
+{
+	POOLINFO info;
+	if (input.read(&info, sizeof info) != sizeof info)
+	{
+		throw ReadException();
+	}
+	unsigned long size    = letohl(info.size);
+	unsigned long nBlocks = letohl(info.nBlocks);
+	size_t entrySize = EntrySize(checked);
+	if (nBlocks > (input.size() - input.tell()) / entrySize)
+	{
+		throw ReadException();
+	}
+
+	vector<uint8_t>   copy;
+	const uint8_t*    entries = (const uint8_t*)ReadView(input, copy, nBlocks * entrySize);
+	unsigned long     end     = input.tell();
+
+	size_t            total  = 0;
+	size_t            packed = 0;
+	vector<Buffer>    buffers(nBlocks);
+	vector<size_t>    starts(nBlocks);
+	vector<FileBlock> blocks(nBlocks);
+	for (unsigned long i = 0; i < nBlocks; i++)
+	{
+		BLOCKENTRY entry = {0, 0, 0, 0};
+		memcpy(&entry, entries + i * entrySize, entrySize);
+
+		FileBlock& block = blocks[i];
+		block.length     = letohl(entry.length);
+		block.packedSize = letohl(entry.packedSize);
+		block.offset     = letohl(entry.offset);
+		block.crc        = letohl(entry.crc);
+		if (block.length == 0 || block.length > size - total || block.packedSize == 0)
+		{
+			throw BadFileException();
+		}
+		if (block.offset > input.size() || block.packedSize > input.size() - block.offset)
+		{
+			throw ReadException();
+		}
+
+		Buffer& buffer = buffers[i];
+		buffer.data       = NULL;
+		buffer.size       = block.length;
+		buffer.used       = block.length;
+		buffer.owned      = true;
+		buffer.packed     = NULL;
+		buffer.packedSize = block.packedSize;
+		buffer.crc        = block.crc;
+		buffer.checked    = checked;
+
+		starts[i] = total;
+		total    += buffer.used;
+		packed   += buffer.packedSize;
+	}
+
+	if (total != size)
+	{
+		throw BadFileException();
+	}
+
+	FileMapping* mapping = input.map();
+	if (mapping != NULL && input.size() <= mapping->size())
+	{
+		// Leave the compressed blocks in the file
+		for (unsigned long i = 0; i < nBlocks; i++)
+		{
+			buffers[i].packed = (const uint8_t*)mapping->data() + blocks[i].offset;
+		}
+	}
+	else
+	{
+		delete mapping;
+		mapping = NULL;
+
+		m_packedCopy = new uint8_t[packed];
+		for (unsigned long i = 0, offset = 0; i < nBlocks; i++)
+		{
+			input.seek(blocks[i].offset);
+			if (input.read(m_packedCopy + offset, blocks[i].packedSize) != blocks[i].packedSize)
+			{
+				throw ReadException();
+			}
+			buffers[i].packed = m_packedCopy + offset;
+			offset += blocks[i].packedSize;
+		}
+		m_packed = m_packedCopy;
+	}
+	input.seek(end);
+
+	m_buffers.swap(buffers);
+	m_starts.swap(starts);
+	if (checked)
+	{
+		m_fileBlocks.swap(blocks);
+	}
+	// Blocks without a CRC can't go into a checked index, so writeBlocks()
+	// writes them again
+	m_fileSize   = checked ? size : 0;
+	m_packedSize = packed;
+	m_mapping    = mapping;
+	m_indexed    = (size == 0);
 }
 
 void StringBuffer::write(IFile& output) const
 {
-	uint32_t leSize = htolel((unsigned long)m_index.size());
+	if (!m_indexed)
+	{
+		buildIndex();
+	}
+
+	uint32_t leSize = htolel((unsigned long)m_entries.size());
 	if (output.write(&leSize, sizeof leSize) != sizeof leSize)
 	{
 		throw WriteException();
 	}
 
 	//
-	// Write string offsets
+	// Write string offsets, in string order
 	//
-	int i = 0;
-	vector<uint32_t> offsets( m_index.size() + 1 );
-	for (Index::const_iterator p = m_index.begin(); p != m_index.end(); p++, i++)
+	vector<const wchar_t*> strings(m_entries.size());
+	vector<uint32_t>       order(m_entries.size());
+	for (size_t i = 0; i < m_entries.size(); i++)
 	{
-		offsets[i] = htolel((uint32_t)(m_starts[p->second.buffer] + p->second.offset));
+		strings[i] = m_entries[i].str;
+		order[i]   = (uint32_t)i;
 	}
-	offsets[i] = htolel((uint32_t)m_starts.back() + m_buffers.back().used);	// Size of written buffer
-	
+	EntryLess less = { strings.empty() ? NULL : &strings[0] };
+	sort(order.begin(), order.end(), less);
+
+	size_t i = 0;
+	vector<uint32_t> offsets( m_entries.size() + 1 );
+	for (; i < order.size(); i++)
+	{
+		offsets[i] = htolel(m_entries[order[i]].offset);
+	}
+	offsets[i] = htolel((uint32_t)(m_buffers.empty() ? 0 : m_starts.back() + m_buffers.back().used));	// Size of written buffer
+
 	if (output.write(&offsets[0], (unsigned long)(offsets.size() * sizeof(uint32_t))) != offsets.size() * sizeof(uint32_t))
 	{
 		throw WriteException();
@@ -129,39 +605,310 @@ void StringBuffer::write(IFile& output) const
 	}
 }
 
+// Cuts the pool from the given offset into blocks. Blocks that were read from
+// a file are kept as they are, other buffers are split between strings.
+void StringBuffer::cutBlocks(size_t from, vector<BlockRange>& ranges) const
+{
+	for (size_t i = 0; i < m_buffers.size(); i++)
+	{
+		const Buffer& buffer = m_buffers[i];
+		if (m_starts[i] + buffer.used <= from)
+		{
+			continue;
+		}
+
+		if (buffer.packed != NULL)
+		{
+			BlockRange range = {i, 0, buffer.used};
+			ranges.push_back(range);
+			continue;
+		}
+
+		for (size_t pos = (from > m_starts[i]) ? from - m_starts[i] : 0; pos < buffer.used; )
+		{
+			size_t end = pos + wcslen(buffer.data + pos) + 1;
+			while (end < buffer.used)
+			{
+				size_t next = end + wcslen(buffer.data + end) + 1;
+				if (next - pos > BLOCK_SIZE)
+				{
+					break;
+				}
+				end = next;
+			}
+			BlockRange range = {i, pos, end - pos};
+			ranges.push_back(range);
+			pos = end;
+		}
+	}
+}
+
+// Returns the data to write for a block, which is compressed into packed
+// unless it was read compressed or doesn't compress.
+const void* StringBuffer::packBlock(const BlockRange& range, vector<uint8_t>& packed, size_t& size) const
+{
+	const Buffer& buffer = m_buffers[range.buffer];
+	if (buffer.packed != NULL)
+	{
+		if (!buffer.checked && buffer.data == NULL)
+		{
+			// Make sure it unpacks before it gets a CRC
+			unpack(range.buffer);
+		}
+		size = buffer.packedSize;
+		return buffer.packed;
+	}
+
+	const wchar_t* str = buffer.data + range.start;
+	size_t         raw = range.length * sizeof(wchar_t);
+	packed.resize(lz_bound(raw));
+	size = lz_compress(str, raw, &packed[0]);
+	if (size >= raw)
+	{
+		// Incompressible; store it as-is
+		size = raw;
+		return str;
+	}
+	return &packed[0];
+}
+
+void StringBuffer::writeBlocks(IFile& output, bool all)
+{
+	if (all)
+	{
+		m_fileBlocks.clear();
+		m_fileSize = 0;
+	}
+
+	vector<BlockRange> ranges;
+	cutBlocks(m_fileSize, ranges);
+
+	vector<uint8_t> packed;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		size_t      size;
+		const void* data = packBlock(ranges[i], packed, size);
+
+		const Buffer& buffer = m_buffers[ranges[i].buffer];
+		FileBlock block;
+		block.length     = (uint32_t)ranges[i].length;
+		block.packedSize = (uint32_t)size;
+		block.offset     = (uint32_t)output.tell();
+		block.crc        = (buffer.packed != NULL && buffer.checked) ? buffer.crc : (uint32_t)crc32(data, size);
+		if (output.write(data, (unsigned long)size) != size)
+		{
+			throw WriteException();
+		}
+		m_fileBlocks.push_back(block);
+		m_fileSize += ranges[i].length;
+	}
+}
+
+void StringBuffer::writeIndex(IFile& output) const
+{
+	POOLINFO info;
+	info.size    = htolel((uint32_t)m_fileSize);
+	info.nBlocks = htolel((uint32_t)m_fileBlocks.size());
+	if (output.write(&info, sizeof info) != sizeof info)
+	{
+		throw WriteException();
+	}
+
+	vector<BLOCKENTRY> blocks(m_fileBlocks.size());
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		blocks[i].length     = htolel(m_fileBlocks[i].length);
+		blocks[i].packedSize = htolel(m_fileBlocks[i].packedSize);
+		blocks[i].offset     = htolel(m_fileBlocks[i].offset);
+		blocks[i].crc        = htolel(m_fileBlocks[i].crc);
+	}
+
+	unsigned long size = (unsigned long)(blocks.size() * sizeof(BLOCKENTRY));
+	if (size > 0 && output.write(&blocks[0], size) != size)
+	{
+		throw WriteException();
+	}
+}
+
+void StringBuffer::skipIndex(IFile& input, bool checked)
+{
+	POOLINFO info;
+	if (input.read(&info, sizeof info) != sizeof info)
+	{
+		throw ReadException();
+	}
+
+	unsigned long nBlocks   = letohl(info.nBlocks);
+	size_t        entrySize = EntrySize(checked);
+	if (nBlocks > (input.size() - input.tell()) / entrySize)
+	{
+		throw ReadException();
+	}
+	input.seek((unsigned long)(input.tell() + nBlocks * entrySize));
+}
+
 uint32_t StringBuffer::getStringOffset(const wchar_t* str) const
 {
 	if (str != NULL)
 	{
-		const Desc& desc = m_index.find(str)->second;
-		return (uint32_t)(m_starts[desc.buffer] + desc.offset);
+		if (!m_indexed)
+		{
+			buildIndex();
+		}
+
+		size_t       length = wcslen(str);
+		const Entry* entry  = find(str, length, HashString(str, length));
+		if (entry != NULL)
+		{
+			return entry->offset;
+		}
 	}
 	return UINT32_MAX;
 }
 
+bool StringBuffer::hasString(uint32_t offset) const
+{
+	return m_starts.size() > 0 && offset < m_starts.back() + m_buffers.back().used;
+}
+
 const wchar_t* StringBuffer::getString(uint32_t offset) const
 {
-	if (m_starts.size() > 0 && offset < m_starts.back() + m_buffers.back().used)
+	if (hasString(offset))
 	{
-		size_t i;
-		for (i = 0; (i < m_starts.size() - 1) && (offset > m_starts[i+1]); i++)
+		// Find the last buffer that starts at or before the offset; an offset
+		// on a boundary is the first string of the buffer that starts there.
+		size_t i = upper_bound(m_starts.begin(), m_starts.end(), (size_t)offset) - m_starts.begin() - 1;
+		if (m_buffers[i].data == NULL)
 		{
-			offset -= m_starts[i+1];
+			unpack(i);
 		}
-		return m_buffers[i].data + offset;
+		return m_buffers[i].data + (offset - m_starts[i]);
 	}
 	return NULL;
 }
 
+void StringBuffer::detach(vector<Relocation>& relocations)
+{
+	if (m_mapping != NULL)
+	{
+		if (m_packedSize > 0 && m_packedCopy == NULL)
+		{
+			// Blocks that haven't been unpacked yet still need their packed
+			// data. The blocks needn't be next to each other in the file.
+			m_packedCopy = new uint8_t[m_packedSize];
+			for (size_t i = 0, offset = 0; i < m_buffers.size(); i++)
+			{
+				Buffer& buffer = m_buffers[i];
+				if (buffer.packed != NULL)
+				{
+					memcpy(m_packedCopy + offset, buffer.packed, buffer.packedSize);
+					buffer.packed = m_packedCopy + offset;
+					offset += buffer.packedSize;
+				}
+			}
+			m_packed = m_packedCopy;
+		}
+
+		size_t first = relocations.size();
+		for (size_t i = 0; i < m_buffers.size(); i++)
+		{
+			Buffer& buffer = m_buffers[i];
+			if (!buffer.owned)
+			{
+				wchar_t* data = new wchar_t[buffer.used];
+				wmemcpy(data, buffer.data, buffer.used);
+
+				Relocation relocation;
+				relocation.from = (uintptr_t)buffer.data;
+				relocation.size = buffer.used * sizeof(wchar_t);
+				relocation.to   = data;
+				relocations.push_back(relocation);
+
+				buffer.data  = data;
+				buffer.size  = buffer.used;
+				buffer.owned = true;
+			}
+		}
+
+		if (m_indexed)
+		{
+			vector<Relocation> moved(relocations.begin() + first, relocations.end());
+			for (size_t i = 0; i < m_entries.size(); i++)
+			{
+				m_entries[i].str = relocate(moved, m_entries[i].str);
+			}
+		}
+
+		delete m_mapping;
+		m_mapping = NULL;
+	}
+}
+
+const wchar_t* StringBuffer::relocate(const vector<Relocation>& relocations, const wchar_t* str)
+{
+	for (size_t i = 0; i < relocations.size(); i++)
+	{
+		uintptr_t offset = (uintptr_t)str - relocations[i].from;
+		if (offset < relocations[i].size)
+		{
+			return (const wchar_t*)((const char*)relocations[i].to + offset);
+		}
+	}
+	return str;
+}
+
 void StringBuffer::clear()
 {
 	for (size_t i = 0; i < m_buffers.size(); i++)
 	{
-		delete[] m_buffers[i].data;
+		if (m_buffers[i].owned)
+		{
+			delete[] m_buffers[i].data;
+		}
 	}
+	delete m_mapping;
+	delete[] m_packedCopy;
+	m_mapping    = NULL;
+	m_packed     = NULL;
+	m_packedSize = 0;
+	m_packedCopy = NULL;
+	m_chunkSize  = m_initialSize;
+	m_fileSize   = 0;
+	m_indexed    = true;
+	m_fileBlocks.clear();
 	m_buffers.clear();
 	m_starts.clear();
-	m_index.clear();
+	m_entries.clear();
+	m_slots.clear();
+}
+
+void StringBuffer::swap(StringBuffer& other)
+{
+	m_entries.swap(other.m_entries);
+	m_slots.swap(other.m_slots);
+	m_buffers.swap(other.m_buffers);
+	m_starts.swap(other.m_starts);
+	m_fileBlocks.swap(other.m_fileBlocks);
+	std::swap(m_fileSize,    other.m_fileSize);
+	std::swap(m_indexed,     other.m_indexed);
+	std::swap(m_mapping,     other.m_mapping);
+	std::swap(m_packed,      other.m_packed);
+	std::swap(m_packedSize,  other.m_packedSize);
+	std::swap(m_packedCopy,  other.m_packedCopy);
+	std::swap(m_initialSize, other.m_initialSize);
+	std::swap(m_chunkSize,   other.m_chunkSize);
+}
+
+StringBuffer::StringBuffer(size_t initialSize)
+{
+	m_initialSize = max(initialSize, (size_t)1);
+	m_chunkSize   = m_initialSize;
+	m_fileSize    = 0;
+	m_indexed     = true;
+	m_mapping     = NULL;
+	m_packed      = NULL;
+	m_packedSize  = 0;
+	m_packedCopy  = NULL;
 }
 
 StringBuffer::~StringBuffer()
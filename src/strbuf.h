@@ -1,7 +1,6 @@
 #ifndef STRBUF_H
 #define STRBUF_H
 
-#include <map>
 #include <string>
 #include <vector>
 #include "files.h"
@@ -10,35 +9,125 @@
 class StringBuffer
 {
 public:
+	// A part of the pool that was moved out of a file mapping by detach()
+	struct Relocation
+	{
+		uintptr_t      from;
+		size_t         size;	// In bytes
+		const wchar_t* to;
+	};
+
 	uint32_t       getStringOffset(const wchar_t* str) const;
 	const wchar_t* getString(uint32_t offset) const;
+	bool           hasString(uint32_t offset) const;	// Doesn't unpack anything
+
+	// The compressed format stores the pool as blocks that are compressed
+	// separately, so a block is only unpacked when one of its strings is used.
+	// readCompressed() reads the blocks and their index in one piece. In the
+	// newer format the blocks can be anywhere in the file: writeBlocks() writes
+	// the strings that aren't in the file yet (or all of them), and writeIndex()
+	// the index of every block in the file, which readBlocks() reads. The index
+	// is checked if it has a CRC per block; a block is checked when it's
+	// unpacked, and only writeIndex() writes checked indexes.
 	void           write(IFile& output) const;
+	void           writeBlocks(IFile& output, bool all);
+	void           writeIndex(IFile& output) const;
 
 	void           read(IFile& input);
+	void           readCompressed(IFile& input);
+	void           readBlocks(IFile& input, bool checked);
+	static void    skipIndex(IFile& input, bool checked);	// Throws ReadException if it's cut off
+	const wchar_t* addString(const wchar_t* str);
 	const wchar_t* addString(const std::wstring& str);
 	void           clear();
+	void           swap(StringBuffer& other);
+
+	// When the pool was read from a mapped file, the strings are used straight
+	// from the mapping. detach() copies them to memory owned by the buffer and
+	// releases the mapping; pointers to the strings must then be relocated.
+	bool           isMapped() const { return m_mapping != NULL; }
+	void           detach(std::vector<Relocation>& relocations);
+	static const wchar_t* relocate(const std::vector<Relocation>& relocations, const wchar_t* str);
+
+	// Memory use of the pool, in characters. A chunk's unused tail is wasted
+	// once a string didn't fit and a new chunk was started after it.
+	struct Statistics
+	{
+		size_t nChunks;
+		size_t allocated;
+		size_t used;
+		size_t wasted;
+	};
+	void getStatistics(Statistics& stats) const;
 
+	// New strings are allocated from chunks that start at initialSize
+	// characters and double in size; larger strings get their own chunk.
+	explicit StringBuffer(size_t initialSize = 4096);
 	~StringBuffer();
 
 private:
-	struct Desc
+	// A pooled string. The index is an open-addressing hash table over
+	// these entries, so interning doesn't allocate per string.
+	struct Entry
+	{
+		const wchar_t* str;
+		uint32_t       offset;
+		uint32_t       length;
+	};
+
+	struct Slot
+	{
+		uint32_t hash;
+		uint32_t entry;
+	};
+
+	// A part of a buffer that is written as one block
+	struct BlockRange;
+
+	struct FileBlock
 	{
-		size_t buffer;
-		size_t offset;
+		uint32_t length;		// In characters
+		uint32_t packedSize;
+		uint32_t offset;		// In the file
+		uint32_t crc;			// Of the packed data
 	};
 
 	struct Buffer
 	{
-		wchar_t* data;
-		size_t   size;
-		size_t   used;
+		wchar_t*       data;		// NULL while the block is still compressed
+		size_t         size;
+		size_t         used;
+		bool           owned;
+		const uint8_t* packed;		// Compressed contents as read from the file
+		size_t         packedSize;
+		uint32_t       crc;
+		bool           checked;		// Whether crc was read with the block
 	};
 
-	typedef std::map<const wchar_t*, Desc, wcsless> Index;
+	// The index is only built when it's first needed, so it's a cache
+	const Entry* find(const wchar_t* str, size_t length, uint32_t hash) const;
+	void         insert(const Entry& entry, uint32_t hash) const;
+	void         grow() const;
+	void         buildIndex() const;
+	void         unpack(size_t i) const;	// Throws BadFileException if the block is bad
+	wchar_t*     allocate(size_t length);
+	void         cutBlocks(size_t from, std::vector<BlockRange>& ranges) const;
+	const void*  packBlock(const BlockRange& range, std::vector<uint8_t>& packed, size_t& size) const;
 
-	Index			    m_index;
-	std::vector<Buffer> m_buffers;
-	std::vector<size_t> m_starts;
+	mutable std::vector<Entry>  m_entries;
+	mutable std::vector<Slot>   m_slots;
+	mutable bool                m_indexed;
+	// Compressed blocks are only unpacked when they're first accessed
+	mutable std::vector<Buffer> m_buffers;
+	std::vector<size_t>         m_starts;
+	FileMapping*                m_mapping;
+	const uint8_t*              m_packed;		// The compressed blocks, in the mapping or m_packedCopy
+	size_t                      m_packedSize;
+	uint8_t*                    m_packedCopy;
+	size_t                      m_initialSize;
+	size_t                      m_chunkSize;	// Size of the next chunk
+	std::vector<FileBlock>      m_fileBlocks;	// The blocks in the file that was last read or written
+	size_t                      m_fileSize;		// Characters in those blocks
 };
 
 #endif
\ No newline at end of file
@@ -27,55 +27,164 @@ struct INDEX
 	}
 };
 
+static const size_t NO_STRING = (size_t)-1;
+
 StringList::const_iterator StringList::find(const wstring& name) const
 {
+	wstring buffer;
 	if (m_sorted)
 	{
 		// Do a binary search
 		string ascii = WideToAnsi(name);
 		unsigned long crc = crc32(ascii.c_str(), ascii.length());
-		int low = 0, high = (int)m_strings.size() - 1;
+		int low = 0, high = (int)size() - 1;
 		while (high >= low)
 		{
 			int i = (low + high) / 2;
-			if (crc == m_strings[i].m_crc)
+			if (crc == getCrc(i))
 			{
 				// Found the correct CRC, search all equal CRCs
-				while (i > 0 && crc == m_strings[i-1].m_crc) i--;
-				for (; i < (int)m_strings.size() && crc == m_strings[i].m_crc; i++)
+				while (i > 0 && crc == getCrc(i-1)) i--;
+				for (; i < (int)size() && crc == getCrc(i); i++)
 				{
-					if (m_strings[i].m_name == name)
+					if (name == getName(i, buffer))
 					{
-						return const_iterator(m_strings, i);
+						return const_iterator(*this, i);
 					}
 				}
 				break;
 			}
-			if (crc < m_strings[i].m_crc) high = i - 1;
+			if (crc < getCrc(i)) high = i - 1;
 			else low = i + 1;
 		}
 	}
 	else
 	{
 		// Do a linear search
-		for (size_t i = 0; i < m_strings.size(); i++)
+		for (size_t i = 0; i < size(); i++)
 		{
-			if (m_strings[i].m_name == name)
+			if (name == getName(i, buffer))
 			{
-				return const_iterator(m_strings, i);
+				return const_iterator(*this, i);
 			}
 		}
 	}
 	return end();
 }
 
+const wchar_t* StringList::getName(size_t i, wstring& buffer) const
+{
+	if (m_mapping == NULL)
+	{
+		return m_strings[i].m_name.c_str();
+	}
+	const Entry& entry = m_entries[i];
+	buffer.clear();
+	AppendAnsiToWide(buffer, m_data + entry.m_name, entry.m_lenName);
+	return buffer.c_str();
+}
+
+void StringList::getNames(vector<const wchar_t*>& names, wstring& buffer) const
+{
+	names.resize(size());
+	if (m_mapping == NULL)
+	{
+		for (size_t i = 0; i < m_strings.size(); i++)
+		{
+			names[i] = m_strings[i].m_name.c_str();
+		}
+		return;
+	}
+
+	// A name converts to at most one character per byte
+	size_t total = 0;
+	for (size_t i = 0; i < m_entries.size(); i++)
+	{
+		total += m_entries[i].m_lenName + 1;
+	}
+	buffer.clear();
+	buffer.reserve(total);
+
+	vector<size_t> offsets(m_entries.size());
+	for (size_t i = 0; i < m_entries.size(); i++)
+	{
+		offsets[i] = buffer.size();
+		AppendAnsiToWide(buffer, m_data + m_entries[i].m_name, m_entries[i].m_lenName);
+		buffer.push_back(L'\0');
+	}
+	for (size_t i = 0; i < m_entries.size(); i++)
+	{
+		names[i] = buffer.c_str() + offsets[i];
+	}
+}
+
+const wchar_t* StringList::getValue(size_t i, size_t& length) const
+{
+	if (m_mapping == NULL)
+	{
+		length = m_strings[i].m_value.length();
+		return m_strings[i].m_value.c_str();
+	}
+	length = m_entries[i].m_lenValue;
+	return (const wchar_t*)(m_data + m_entries[i].m_value);
+}
+
+const StringList::StringInfo& StringList::operator[](size_t i) const
+{
+	if (m_mapping == NULL)
+	{
+		return m_strings[i];
+	}
+	if (m_current != i)
+	{
+		size_t         length;
+		const wchar_t* value = getValue(i, length);
+		getName(i, m_buffer.m_name);
+		m_buffer.m_value.assign(value, length);
+		m_current = i;
+	}
+	return m_buffer;
+}
+
+StringList::StringInfo& StringList::operator[](size_t i)
+{
+	unmap();
+	return m_strings[i];
+}
+
+void StringList::unmap()
+{
+	if (m_mapping != NULL)
+	{
+		m_strings.resize(m_entries.size());
+		for (size_t i = 0; i < m_entries.size(); i++)
+		{
+			size_t         length;
+			const wchar_t* value = getValue(i, length);
+			getName(i, m_strings[i].m_name);
+			m_strings[i].m_value.assign(value, length);
+			m_strings[i].m_crc = m_entries[i].m_crc;
+		}
+
+		delete m_mapping;
+		m_mapping = NULL;
+		m_entries.clear();
+		m_buffer  = StringInfo();
+		m_current = NO_STRING;
+	}
+}
+
 void StringList::reserve(size_t newSize)
 {
-	m_strings.reserve(newSize);
+	if (m_mapping == NULL)
+	{
+		m_strings.reserve(newSize);
+	}
 }
 
 void StringList::add(const std::wstring& name, const std::wstring& value, const std::wstring& comment)
 {
+	unmap();
 	unsigned long crc = m_strings.empty() ? 0 : m_strings.back().m_crc;
 
 	m_strings.push_back(String());
@@ -95,74 +204,230 @@ void StringList::add(const std::wstring& name, const std::wstring& value, const
 
 void StringList::sort()
 {
-	std::sort(m_strings.begin(), m_strings.end());
+	// A mapped list only sorts its entries
+	if (m_mapping != NULL)
+	{
+		std::sort(m_entries.begin(), m_entries.end());
+		m_current = NO_STRING;
+	}
+	else
+	{
+		std::sort(m_strings.begin(), m_strings.end());
+	}
 	m_sorted = true;
 }
 
+// The values of a StringList, for DatNames
+class ListValues : public IDatValues
+{
+	const StringList& m_strings;
+public:
+	const wchar_t* getValue(size_t i, size_t& length) const { return m_strings.getValue(i, length); }
+	ListValues(const StringList& strings) : m_strings(strings) {}
+};
+
 void StringList::write(IFile& output, bool doSort)
 {
-	// Write number of strings
-	uint32_t leNumStrings = htolel((unsigned long)m_strings.size());
-	if (output.write((char*)&leNumStrings, sizeof(uint32_t)) != sizeof(uint32_t))
+	// The names of a mapped list are converted one after another into one
+	// buffer; the pointers into it are taken when it's complete
+	wstring        buffer;
+	vector<size_t> offsets(size());
+	for (size_t i = 0; i < size(); i++)
 	{
-		throw WriteException();
+		offsets[i] = buffer.size();
+		if (m_mapping != NULL)
+		{
+			const Entry& entry = m_entries[i];
+			AppendAnsiToWide(buffer, m_data + entry.m_name, entry.m_lenName);
+			buffer.push_back(L'\0');
+		}
 	}
 
-	// Create strings info
-	unsigned long sizeValues = 0;
-	unsigned long sizeNames  = 0;
+	vector<const wchar_t*> names(size());
+	for (size_t i = 0; i < size(); i++)
+	{
+		names[i] = (m_mapping != NULL) ? buffer.c_str() + offsets[i] : m_strings[i].m_name.c_str();
+	}
+	DatNames(names, doSort).write(output, ListValues(*this));
+}
 
-	vector<string> names(m_strings.size());
-	vector<DESC>   desc(m_strings.size());
-	vector<INDEX>  indices(m_strings.size());
-	for (size_t i = 0; i < m_strings.size(); i++)
+DatNames::DatNames(const vector<const wchar_t*>& names, bool sort)
+	: m_offsets(names.size() + 1), m_crcs(names.size()), m_order(names.size())
+{
+	vector<INDEX> indices(names.size());
+	for (size_t i = 0; i < names.size(); i++)
 	{
-		names[i] = WideToAnsi(m_strings[i].m_name);
-		indices[i].crc   = (unsigned long)crc32(names[i].c_str(), names[i].length());
+		m_offsets[i] = m_data.size();
+		size_t length = AppendWideToAnsi(m_data, names[i]);
+		m_crcs[i]     = (uint32_t)crc32(m_data.c_str() + m_offsets[i], length);
+		indices[i].crc   = m_crcs[i];
 		indices[i].index = i;
-		desc[i].lenValue = letohl((unsigned long)m_strings[i].m_value.length());
-		desc[i].lenName  = letohl((unsigned long)names[i].length());
-		desc[i].crc      = letohl(indices[i].crc);
-		sizeValues += (unsigned long)(m_strings[i].m_value.length() * sizeof(wchar_t));
-		sizeNames  += (unsigned long)(names[i].length() * sizeof(char));
 	}
+	m_offsets[names.size()] = m_data.size();
 
-	if (doSort)
+	if (sort)
 	{
 		// Sort strings info
 		std::sort(indices.begin(), indices.end());
 	}
 
-	char* data = new char[sizeValues + sizeNames];
-	unsigned long offsetValues = 0;
-	unsigned long offsetNames  = sizeValues;
-	for (size_t i = 0; i < m_strings.size(); i++)
+	for (size_t i = 0; i < indices.size(); i++)
 	{
-		size_t idx = indices[i].index;
-		memcpy(data + offsetValues, m_strings[idx].m_value.c_str(), m_strings[idx].m_value.length() * sizeof(wchar_t));
-		memcpy(data + offsetNames, names[idx].c_str(), names[idx].length() * sizeof(char));
-		offsetValues += (unsigned long)(m_strings[idx].m_value.length() * sizeof(wchar_t));
-		offsetNames  += (unsigned long)(names[idx].length() * sizeof(char));
+		m_order[i] = (uint32_t)indices[i].index;
+	}
+}
+
+// Collects what's written in a buffer and writes it to the file when it's full
+class ChunkWriter
+{
+	IFile&       m_output;
+	vector<char> m_buffer;
+	size_t       m_used;
+
+public:
+	void write(const void* data, size_t size)
+	{
+		if (m_used + size > m_buffer.size())
+		{
+			flush();
+			if (size >= m_buffer.size())
+			{
+				// Too large to buffer
+				if (m_output.write(data, (unsigned long)size) != size)
+				{
+					throw WriteException();
+				}
+				return;
+			}
+		}
+		memcpy(&m_buffer[m_used], data, size);
+		m_used += size;
+	}
 
-		// Write strings info
-		if (output.write(&desc[idx], sizeof(DESC)) != sizeof(DESC))
+	void flush()
+	{
+		if (m_used > 0 && m_output.write(&m_buffer[0], (unsigned long)m_used) != m_used)
 		{
-			delete[] data;
 			throw WriteException();
 		}
+		m_used = 0;
 	}
 
-	// Write raw data
-	if (output.write(data, sizeValues + sizeNames) != sizeValues + sizeNames)
+	ChunkWriter(IFile& output, size_t size) : m_output(output), m_buffer(size), m_used(0) {}
+};
+
+void DatNames::write(IFile& output, const IDatValues& values) const
+{
+	ChunkWriter writer(output, CHUNK_SIZE);
+
+	// Write number of strings
+	uint32_t leNumStrings = htolel((unsigned long)size());
+	writer.write(&leNumStrings, sizeof(uint32_t));
+
+	// The values are read in the order of the file, which is random for
+	// sorted files, so their lengths are taken in one pass in order first
+	// (getValue() may have to find the end of the value)
+	vector<uint32_t> lengths(size());
+	for (size_t i = 0; i < lengths.size(); i++)
 	{
-		delete[] data;
-		throw WriteException();
+		size_t length;
+		values.getValue(i, length);
+		lengths[i] = (uint32_t)length;
 	}
-	delete[] data;
+
+	// Write strings info
+	for (size_t i = 0; i < m_order.size(); i++)
+	{
+		size_t idx = m_order[i];
+		DESC desc;
+		desc.crc      = htolel(m_crcs[idx]);
+		desc.lenValue = htolel(lengths[idx]);
+		desc.lenName  = htolel((unsigned long)(m_offsets[idx + 1] - m_offsets[idx]));
+		writer.write(&desc, sizeof(DESC));
+	}
+
+	// Write raw data: the values, then the names
+	for (size_t i = 0; i < m_order.size(); i++)
+	{
+		size_t         idx = m_order[i];
+		size_t         length;
+		const wchar_t* value = values.getValue(idx, length);
+		writer.write(value, length * sizeof(wchar_t));
+	}
+	for (size_t i = 0; i < m_order.size(); i++)
+	{
+		size_t idx = m_order[i];
+		writer.write(m_data.c_str() + m_offsets[idx], m_offsets[idx + 1] - m_offsets[idx]);
+	}
+	writer.flush();
 }
 
 StringList::StringList(IFile& input)
+	: m_mapping(NULL), m_data(NULL), m_current(NO_STRING)
 {
+	// Use the file in place if it can be mapped
+	unsigned long start = input.tell();
+	m_mapping = input.map();
+	if (m_mapping != NULL)
+	{
+		// The sizes are added up in 64 bits, so a bad file can't make them wrap
+		const char* file = (const char*)m_mapping->data();
+		uint64_t    size = m_mapping->size();
+		uint64_t    pos  = (uint64_t)start + sizeof(uint32_t);
+		if (pos > size)
+		{
+			delete m_mapping;
+			throw ReadException();
+		}
+		unsigned long nStrings = letohl(*(const uint32_t*)(file + start));
+
+		const DESC* desc = (const DESC*)(file + pos);
+		pos += (uint64_t)nStrings * sizeof(DESC);
+		if (pos > size)
+		{
+			delete m_mapping;
+			throw ReadException();
+		}
+
+		// Calculate total strings size
+		uint64_t sizeValues = 0;
+		uint64_t sizeNames  = 0;
+		m_sorted = true;
+		for (unsigned long i = 0; i < nStrings; i++)
+		{
+			sizeValues += sizeof(wchar_t) * (uint64_t)letohl(desc[i].lenValue);
+			sizeNames  += 1 * (uint64_t)letohl(desc[i].lenName);
+			if (m_sorted && i > 0 && letohl(desc[i].crc) < letohl(desc[i-1].crc))
+			{
+				m_sorted = false;
+			}
+		}
+		if (pos + sizeValues + sizeNames > size)
+		{
+			delete m_mapping;
+			throw ReadException();
+		}
+
+		// Only keep where the strings are
+		uint32_t offsetValues = (uint32_t)pos;
+		uint32_t offsetNames  = (uint32_t)(pos + sizeValues);
+		m_entries.resize(nStrings);
+		for (unsigned long i = 0; i < nStrings; i++)
+		{
+			Entry& entry = m_entries[i];
+			entry.m_crc      = letohl(desc[i].crc);
+			entry.m_value    = offsetValues;
+			entry.m_lenValue = letohl(desc[i].lenValue);
+			entry.m_name     = offsetNames;
+			entry.m_lenName  = letohl(desc[i].lenName);
+			offsetValues += (uint32_t)(sizeof(wchar_t) * entry.m_lenValue);
+			offsetNames  += entry.m_lenName;
+		}
+		m_data = file;
+		input.seek((unsigned long)(pos + sizeValues + sizeNames));
+		return;
+	}
+
 	// Read number of strings
 	uint32_t leNumStrings;
 	if (input.read((char*)&leNumStrings, sizeof(uint32_t)) != sizeof(uint32_t))
@@ -173,7 +438,7 @@ StringList::StringList(IFile& input)
 
 	// Read strings info
 	vector<DESC> desc(nStrings);
-	if (input.read((char*)&desc[0], nStrings * sizeof(DESC)) != nStrings * sizeof(DESC))
+	if (nStrings > 0 && input.read((char*)&desc[0], nStrings * sizeof(DESC)) != nStrings * sizeof(DESC))
 	{
 		throw ReadException();
 	}
@@ -184,7 +449,7 @@ StringList::StringList(IFile& input)
 	m_sorted = true;
 	for (size_t i = 0; i < desc.size(); i++)
 	{
-		sizeValues += 2 * letohl(desc[i].lenValue);
+		sizeValues += sizeof(wchar_t) * letohl(desc[i].lenValue);
 		sizeNames  += 1 * letohl(desc[i].lenName);
 		if (m_sorted && i > 0 && desc[i].crc < desc[i-1].crc)
 		{
@@ -210,13 +475,19 @@ StringList::StringList(IFile& input)
 		m_strings[i].m_crc   = letohl(desc[i].crc);
 		m_strings[i].m_name  = AnsiToWide(string((char*)(data + offsetNames), letohl(desc[i].lenName)));
 		m_strings[i].m_value = wstring((wchar_t*)(data + offsetValues), letohl(desc[i].lenValue));
-		offsetValues += 2 * letohl(desc[i].lenValue);
+		offsetValues += sizeof(wchar_t) * letohl(desc[i].lenValue);
 		offsetNames  += 1 * letohl(desc[i].lenName);
 	}
 	delete[] data;
 }
 
 StringList::StringList()
+	: m_mapping(NULL), m_data(NULL), m_current(NO_STRING)
 {
 	m_sorted = true;
+}
+
+StringList::~StringList()
+{
+	delete m_mapping;
 }
\ No newline at end of file
@@ -6,6 +6,10 @@
 #include <vector>
 #include "files.h"
 
+// A list of strings, as in a DAT file. A list that's read from a file that
+// can be mapped is a view of the mapping: only the string info of the file
+// is read, and names and values are only converted when they're used. Adding
+// to it or changing a string turns it into an ordinary list first.
 class StringList
 {
 public:
@@ -25,13 +29,26 @@ private:
 		}
 	};
 
+	// A string in the mapping; the offsets are from the start of the file
+	struct Entry
+	{
+		uint32_t m_crc;
+		uint32_t m_value;
+		uint32_t m_lenValue;	// In characters
+		uint32_t m_name;
+		uint32_t m_lenName;		// In characters
+		bool operator < (const Entry& e) const {
+			return m_crc < e.m_crc;
+		}
+	};
+
 public:
 	class const_iterator
 	{
 		friend class StringList;
 
 	public:
-		const StringInfo& operator *()  const { return m_strings[m_index]; }
+		const StringInfo& operator *()  const { return m_list[m_index]; }
 		const StringInfo* operator ->() const { return (&**this); }
 		const_iterator& operator ++()    { m_index++; return *this; }
 		const_iterator& operator --()	 { m_index--; return *this; }
@@ -39,40 +56,107 @@ public:
 		const_iterator& operator --(int) { m_index--; return *this; }
 
 		bool operator ==(const const_iterator& it) const {
-			return &m_strings == &it.m_strings && m_index == it.m_index;
+			return &m_list == &it.m_list && m_index == it.m_index;
 		}
 		bool operator !=(const const_iterator& it) const {
 			return !(*this == it);
 		}
 
 	private:
-		const_iterator(const std::vector<String>& strings, std::vector<String>::size_type index)
-			: m_strings(strings), m_index(index) {}
+		const_iterator(const StringList& list, size_t index)
+			: m_list(list), m_index(index) {}
 
-		const std::vector<String>&     m_strings;
-		std::vector<String>::size_type m_index;
+		const StringList& m_list;
+		size_t            m_index;
 	};
 
-	size_t size() const { return m_strings.size(); }
+	size_t size() const { return (m_mapping != NULL) ? m_entries.size() : m_strings.size(); }
 	void   reserve(size_t newSize);
 	void   add(const std::wstring& name, const std::wstring& value, const std::wstring& comment);
 
 	void sort();
 
-	const StringInfo& operator[](size_t i) const { return m_strings[i]; }
-	      StringInfo& operator[](size_t i)       { return m_strings[i]; }
+	// For a mapped list, the const operator[] and the iterators convert the
+	// string into a buffer in the list, which is valid until another string
+	// is converted. The non-const operator[] turns it into an ordinary list.
+	const StringInfo& operator[](size_t i) const;
+	      StringInfo& operator[](size_t i);
+
+	// These return the name or value of string i without copying it when
+	// possible. A name is converted into buffer if needed; a value may point
+	// into the mapping, so it isn't terminated and only valid with the list.
+	const wchar_t* getName (size_t i, std::wstring& buffer) const;
+	const wchar_t* getValue(size_t i, size_t& length) const;
+
+	// Points names[i] at the name of every string, for when they're all
+	// needed at once. The names of a mapped list are converted into buffer
+	// in one go. They are valid until the list or buffer changes.
+	void getNames(std::vector<const wchar_t*>& names, std::wstring& buffer) const;
+
+	// DAT files have no comments, so a mapped list doesn't either
+	const wchar_t* getComment(size_t i) const { return (m_mapping != NULL) ? L"" : m_strings[i].m_comment.c_str(); }
 
 	const_iterator find( const std::wstring& name ) const;
-	const_iterator begin() const { return const_iterator(m_strings, 0); }
-	const_iterator end()   const { return const_iterator(m_strings, m_strings.size()); }
+	const_iterator begin() const { return const_iterator(*this, 0); }
+	const_iterator end()   const { return const_iterator(*this, size()); }
 
 	void write(IFile& file, bool sort = false);
 	StringList(IFile& file);
 	StringList();
+	~StringList();
 
 private:
+	// Turns a mapped list into an ordinary list
+	void unmap();
+
+	uint32_t getCrc(size_t i) const { return (m_mapping != NULL) ? m_entries[i].m_crc : (uint32_t)m_strings[i].m_crc; }
+
+	// Lists own their mapping, so they can't be copied
+	StringList(const StringList&);
+	StringList& operator=(const StringList&);
+
 	std::vector<String> m_strings;
 	bool                m_sorted;
+
+	// For a mapped list
+	FileMapping*        m_mapping;
+	const char*         m_data;			// The start of the file in the mapping
+	std::vector<Entry>  m_entries;
+	mutable size_t      m_current;		// The string that's in m_buffer, if any
+	mutable StringInfo  m_buffer;
+};
+
+// The values of a DAT file, by the index of their name in DatNames
+class IDatValues
+{
+public:
+	virtual const wchar_t* getValue(size_t i, size_t& length) const = 0;
+	virtual ~IDatValues() {}
+};
+
+// The names of a DAT file, converted to ANSI and put in the order of the file
+// once. Languages have the same names, so the files of several languages
+// can be written from one DatNames, with only their values. write() can be
+// called from several threads at once.
+class DatNames
+{
+public:
+	// Writes the file in chunks of CHUNK_SIZE bytes, straight from the names
+	// and values; besides the chunk, it only needs the length of every value
+	static const size_t CHUNK_SIZE = 256 * 1024;
+	void write(IFile& output, const IDatValues& values) const;
+
+	size_t size() const { return m_crcs.size(); }
+
+	// With sort, the names are written in order of CRC (for name-indexed
+	// files); otherwise in the order they're given
+	DatNames(const std::vector<const wchar_t*>& names, bool sort);
+
+private:
+	std::string           m_data;		// All names, one after another
+	std::vector<size_t>   m_offsets;	// Of every name in m_data, and the end
+	std::vector<uint32_t> m_crcs;
+	std::vector<uint32_t> m_order;
 };
 
 #endif
\ No newline at end of file
@@ -1,10 +1,31 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stdint.h>
+
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+// The parts of windows.h that the code outside of the user interface uses,
+// so that it also builds elsewhere
+#include <algorithm>
+#include <cstring>
 
-#include <stdint.h>
+typedef uint16_t LANGID;
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+typedef void*    HWND;
+
+struct FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+};
+
+using std::min;
+using std::max;
+#endif
 
 #ifdef _MSC_VER
 #define TLS_ATTR __declspec(thread)
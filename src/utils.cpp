@@ -1,8 +1,14 @@
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <vector>
 #include "utils.h"
 using namespace std;
 
+#ifdef _WIN32
+
 wstring GetWindowStr(HWND hWnd)
 {
 	int len = GetWindowTextLength(hWnd);
@@ -57,6 +63,34 @@ string WideToAnsi(const wchar_t* cstr, const char* defChar)
 	}
 }
 
+size_t AppendAnsiToWide(wstring& result, const char* str, size_t length)
+{
+	if (length == 0)
+	{
+		return 0;
+	}
+	int    size   = MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, str, (int)length, NULL, 0);
+	size_t offset = result.size();
+	result.resize(offset + size);
+	MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, str, (int)length, &result[offset], size);
+	return size;
+}
+
+size_t AppendWideToAnsi(string& result, const wchar_t* cstr, const char* defChar)
+{
+	// The size includes the terminating zero, which is cut off again
+	int    size   = WideCharToMultiByte(CP_ACP, WC_COMPOSITECHECK | WC_NO_BEST_FIT_CHARS | WC_DEFAULTCHAR, cstr, -1, NULL, 0, defChar, NULL);
+	size_t offset = result.size();
+	if (size <= 1)
+	{
+		return 0;
+	}
+	result.resize(offset + size);
+	WideCharToMultiByte(CP_ACP, WC_COMPOSITECHECK | WC_NO_BEST_FIT_CHARS | WC_DEFAULTCHAR, cstr, -1, &result[offset], size, defChar, NULL);
+	result.resize(offset + size - 1);
+	return size - 1;
+}
+
 wstring GetLanguageName(LANGID language)
 {
 	LCID locale = MAKELCID(language, SORT_DEFAULT);
@@ -79,6 +113,13 @@ wstring GetEnglishLanguageName(LANGID language)
 	return str;
 }
 
+wstring GetDefaultPostfix(LANGID language)
+{
+	wstring postfix = L"_" + GetEnglishLanguageName(language);
+	transform(postfix.begin(), postfix.end(), postfix.begin(), toupper);
+	return postfix;
+}
+
 
 static BOOL CALLBACK LangGroupLocaleEnumProc(LGRPID, LCID Locale, LPTSTR, LONG_PTR lParam)
 {
@@ -150,4 +191,129 @@ wstring LoadString(UINT id, ...)
         delete[] buf;
         throw;
     }
-}
\ No newline at end of file
+}
+
+#else
+
+// Without the Windows code pages, ANSI is taken to be Latin-1
+wstring AnsiToWide(const char* cstr)
+{
+	wstring result;
+	AppendAnsiToWide(result, cstr, strlen(cstr));
+	return result;
+}
+
+string WideToAnsi(const wchar_t* cstr, const char* defChar)
+{
+	string result;
+	AppendWideToAnsi(result, cstr, defChar);
+	return result;
+}
+
+size_t AppendAnsiToWide(wstring& result, const char* str, size_t length)
+{
+	size_t offset = result.size();
+	result.resize(offset + length);
+	for (size_t i = 0; i < length; i++)
+	{
+		result[offset + i] = (unsigned char)str[i];
+	}
+	return length;
+}
+
+size_t AppendWideToAnsi(string& result, const wchar_t* cstr, const char* defChar)
+{
+	size_t offset = result.size();
+	for (const wchar_t* p = cstr; *p != L'\0'; p++)
+	{
+		if ((unsigned long)*p < 0x100)
+		{
+			result += (char)*p;
+		}
+		else
+		{
+			result += defChar;
+		}
+	}
+	return result.size() - offset;
+}
+
+// The languages that the editor is most often used with
+static const struct
+{
+	LANGID         id;
+	const wchar_t* name;
+} Languages[] = {
+	{1028, L"Chinese (Traditional)"}, {1029, L"Czech"},  {1031, L"German"},  {1033, L"English"},
+	{1036, L"French"},   {1038, L"Hungarian"}, {1040, L"Italian"}, {1041, L"Japanese"},
+	{1042, L"Korean"},   {1045, L"Polish"},    {1046, L"Portuguese"}, {1049, L"Russian"},
+	{2052, L"Chinese (Simplified)"}, {3082, L"Spanish"},
+};
+
+wstring GetLanguageName(LANGID language)
+{
+	return GetEnglishLanguageName(language);
+}
+
+wstring GetEnglishLanguageName(LANGID language)
+{
+	for (size_t i = 0; i < sizeof Languages / sizeof *Languages; i++)
+	{
+		if (Languages[i].id == language)
+		{
+			return Languages[i].name;
+		}
+	}
+	return FormatString(L"Language %u", (unsigned int)language);
+}
+
+wstring GetDefaultPostfix(LANGID language)
+{
+	wstring postfix = L"_" + GetEnglishLanguageName(language);
+	transform(postfix.begin(), postfix.end(), postfix.begin(), towupper);
+	return postfix;
+}
+
+void GetLanguageList(set<LANGID>& languages)
+{
+	languages.clear();
+	for (size_t i = 0; i < sizeof Languages / sizeof *Languages; i++)
+	{
+		languages.insert(Languages[i].id);
+	}
+}
+
+static wstring FormatString(const wchar_t* format, va_list args)
+{
+	// vswprintf doesn't say how long the result is, so grow until it fits
+	vector<wchar_t> buf(256);
+	for (;;)
+	{
+		va_list copy;
+		va_copy(copy, args);
+		int n = vswprintf(&buf[0], buf.size(), format, copy);
+		va_end(copy);
+		if (n >= 0 && (size_t)n < buf.size())
+		{
+			return wstring(&buf[0], n);
+		}
+		buf.resize(buf.size() * 2);
+	}
+}
+
+wstring FormatString(const wchar_t* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	wstring str = FormatString(format, args);
+	va_end(args);
+	return str;
+}
+
+// There are no string resources outside of Windows
+wstring LoadString(UINT id, ...)
+{
+	return FormatString(L"String %u", id);
+}
+
+#endif
\ No newline at end of file
@@ -12,9 +12,11 @@ struct wcsless {
 	}
 };
 
+#ifdef _WIN32
 // Returns GetWindowText as std::wstring
 std::wstring GetWindowStr(HWND hWnd);
 std::wstring GetDlgItemStr(HWND hWnd, int idItem);
+#endif
 
 // Convert an ANSI string to a wide (UCS-2) string
 std::wstring AnsiToWide(const char* cstr);
@@ -30,10 +32,21 @@ static std::string WideToAnsi(const std::wstring& str, const char* defChar = " "
 	return WideToAnsi(str.c_str(), defChar);
 }
 
+// Appends the ANSI string to result; this only allocates when result has
+// to grow. Returns the length of the ANSI string.
+size_t AppendWideToAnsi(std::string& result, const wchar_t* cstr, const char* defChar = " ");
+
+// Appends the wide string of the ANSI characters to result, in the same way
+size_t AppendAnsiToWide(std::wstring& result, const char* str, size_t length);
+
 void GetLanguageList(std::set<LANGID>& languages);
 std::wstring GetLanguageName(LANGID language);
 std::wstring GetEnglishLanguageName(LANGID language);
 
+// Returns the postfix of exported files for a language that has none set:
+// an underscore and the uppercased English language name
+std::wstring GetDefaultPostfix(LANGID language);
+
 std::wstring FormatString(const wchar_t* format, ...);
 std::wstring LoadString(UINT id, ...);
 
@@ -1,8 +1,15 @@
+#include <climits>
+#include <cstring>
 #include "document.h"
 #include "exceptions.h"
 using namespace std;
 
-static const uint8_t VDF_VERSION = 0x01;
+// Version 2 compresses the string pool, version 3 adds keyframes,
+// version 4 can be appended to and version 5 has a CRC per pool block
+static const uint8_t VDF_VERSION = 0x05;
+
+// Every this many versions, a full copy of the version is written
+static const size_t KEYFRAME_INTERVAL = 32;
 
 #pragma pack(1)
 struct FILEINFO
@@ -49,8 +56,79 @@ struct POSTFIXINFO
 	uint16_t language;
 	uint32_t length;
 };
+
+// A keyframe is followed by maxString KEYSTRINGDESCs and, per language, the
+// language and maxString value offsets
+struct KEYFRAMEDESC
+{
+	uint32_t version;
+	uint32_t maxString;
+	uint32_t nLanguages;
+};
+
+struct KEYSTRINGDESC
+{
+	uint32_t position;
+	uint32_t name;
+	uint32_t comment;
+	uint8_t  flags;
+	uint32_t changed;	// Last version that changed the string, or NO_VERSION
+};
+
+// The keyframe table is at the end of the file, found through the trailer
+struct KEYFRAMEENTRY
+{
+	uint32_t version;
+	uint32_t offset;
+};
+
+struct KEYFRAMETRAILER
+{
+	uint32_t nKeyframes;
+	uint32_t table;
+};
+
+// Version 4 files are the signature and segments that were written by
+// write() and append(). A segment is the pool blocks that weren't in the file
+// yet, the versions (each with its strings followed by its values) and the
+// keyframes. The footer after the last segment says where everything is:
+//
+//   FILEINFO, pool index, postfixes, VERSIONENTRY[nVersions],
+//   nKeyframes, KEYFRAMEENTRY[nKeyframes], FOOTERTRAILER
+//
+// Appending a segment writes it after the trailer, and the new footer and
+// trailer after that, so the file stays readable until the new trailer has
+// been written; see FindFooter(). The old footers are left in the file until
+// it's written again completely.
+struct VERSIONENTRY
+{
+	uint32_t strings;
+	uint32_t values;
+};
+
+struct FOOTERTRAILER
+{
+	uint32_t footer;
+	uint8_t  signature[4];
+};
 #pragma pack()
 
+static const uint32_t NO_STRING   = 0xFFFFFFFF;
+static const uint32_t NO_VERSION  = 0xFFFFFFFF;
+static const size_t   NO_KEYFRAME = (size_t)-1;
+
+// The latest change of a string while reading the versions
+struct LatestString
+{
+	uint32_t      position;
+	uint32_t      name;
+	uint32_t      comment;
+	uint8_t       flags;
+	unsigned long version;
+
+	LatestString() : position(0), name(NO_STRING), comment(NO_STRING), flags(0), version(ULONG_MAX) {}
+};
+
 static void WriteString(IFile& output, const wstring& str)
 {
 	unsigned long size = (unsigned long)((str.length() + 1) * sizeof(wstring::value_type));
@@ -60,23 +138,171 @@ static void WriteString(IFile& output, const wstring& str)
 	}
 }
 
-static wstring ReadString(IFile& input, unsigned long len)
+// Appends size bytes of records to history and returns where they start
+static size_t ReadRecords(IFile& input, vector<uint8_t>& history, size_t size)
 {
-	wstring::value_type* buf = new wstring::value_type[len];
-	unsigned long size = (unsigned long)(len * sizeof(wstring::value_type));
-	if (input.read(buf, size) != size)
+	size_t offset = history.size();
+	history.resize(offset + size);
+	if (size > 0 && input.read(&history[offset], (unsigned long)size) != size)
 	{
-		delete[] buf;
 		throw ReadException();
 	}
-	wstring str = buf;
-	delete[] buf;
+	return offset;
+}
+
+static wstring ReadString(IFile& input, unsigned long len)
+{
+	// The characters are copied straight into the string if the file can
+	// view them; the view may not be aligned for wchar_t
+	vector<uint8_t> copy;
+	unsigned long   size = (unsigned long)(len * sizeof(wstring::value_type));
+	const void*     data = ReadView(input, copy, size);
+
+	wstring str(len, L'\0');
+	if (len > 0)
+	{
+		memcpy(&str[0], data, size);
+	}
+	str.resize(wcslen(str.c_str()));
 	return str;
 }
 
-void Document::write(IFile& output) const
+// Returns whether the footer at offset ends right at the trailer at end
+static bool IsFooter(IFile& input, uint8_t version, unsigned long offset, unsigned long end)
+{
+	try
+	{
+		input.seek(offset);
+		FILEINFO info;
+		if (offset >= end || input.read(&info, sizeof info) != sizeof info)
+		{
+			return false;
+		}
+
+		StringBuffer::skipIndex(input, version >= 5);
+		for (unsigned long i = 0; i < letohl(info.nPostfixes); i++)
+		{
+			POSTFIXINFO postfix;
+			if (input.read(&postfix, sizeof postfix) != sizeof postfix
+			 || letohl(postfix.length) > (end - input.tell()) / sizeof(wstring::value_type))
+			{
+				return false;
+			}
+			input.seek(input.tell() + letohl(postfix.length) * sizeof(wstring::value_type));
+		}
+
+		if (input.tell() > end || letohl(info.nVersions) > (end - input.tell()) / sizeof(VERSIONENTRY))
+		{
+			return false;
+		}
+		input.seek(input.tell() + letohl(info.nVersions) * sizeof(VERSIONENTRY));
+
+		uint32_t leNumKeyframes;
+		if (input.read(&leNumKeyframes, sizeof leNumKeyframes) != sizeof leNumKeyframes
+		 || input.tell() > end || letohl(leNumKeyframes) > (end - input.tell()) / sizeof(KEYFRAMEENTRY))
+		{
+			return false;
+		}
+		return input.tell() + letohl(leNumKeyframes) * sizeof(KEYFRAMEENTRY) == end;
+	}
+	catch (IOException&)
+	{
+		return false;
+	}
+}
+
+// Returns the footer of the last complete trailer in the file and sets end to
+// the end of that trailer. That's normally the end of the file, but if an
+// append() didn't finish, the file ends in a partial segment after it.
+static unsigned long FindFooter(IFile& input, const uint8_t signature[4], unsigned long& end)
+{
+	static const unsigned long CHUNK_SIZE = 64 * 1024;
+
+	// Search the file backwards, a chunk at a time; the chunks overlap by a
+	// trailer so one that is split between chunks isn't missed
+	vector<uint8_t> chunk;
+	for (unsigned long last = input.size(); last >= sizeof(FOOTERTRAILER) + 4; )
+	{
+		unsigned long start = max(4UL, last - min(last, CHUNK_SIZE));
+		chunk.resize(last - start);
+		input.seek(start);
+		if (input.read(&chunk[0], (unsigned long)chunk.size()) != chunk.size())
+		{
+			throw ReadException();
+		}
+
+		for (unsigned long pos = last - sizeof(FOOTERTRAILER) + 1; pos-- > start; )
+		{
+			FOOTERTRAILER trailer;
+			memcpy(&trailer, &chunk[pos - start], sizeof trailer);
+			if (memcmp(trailer.signature, signature, sizeof trailer.signature) == 0
+			 && IsFooter(input, signature[3], letohl(trailer.footer), pos))
+			{
+				end = pos + sizeof trailer;
+				return letohl(trailer.footer);
+			}
+		}
+
+		if (start == 4)
+		{
+			break;
+		}
+		last = start + sizeof(FOOTERTRAILER) - 1;
+	}
+	throw BadFileException();
+}
+
+static void WriteKeyframe(IFile& output, size_t version, const vector<LatestString>& strings, const map<LANGID, vector<uint32_t> >& values)
+{
+	KEYFRAMEDESC desc;
+	desc.version    = htolel((uint32_t)version);
+	desc.maxString  = htolel((uint32_t)strings.size());
+	desc.nLanguages = htolel((uint32_t)values.size());
+	if (output.write(&desc, sizeof desc) != sizeof desc)
+	{
+		throw WriteException();
+	}
+
+	vector<KEYSTRINGDESC> keys(strings.size());
+	for (size_t i = 0; i < strings.size(); i++)
+	{
+		const LatestString& str = strings[i];
+		keys[i].position = htolel(str.position);
+		keys[i].name     = htolel(str.name);
+		keys[i].comment  = htolel(str.comment);
+		keys[i].flags    = (str.version == version) ? str.flags : 0;
+		keys[i].changed  = htolel((str.version == ULONG_MAX) ? NO_VERSION : (uint32_t)str.version);
+	}
+	unsigned long size = (unsigned long)(keys.size() * sizeof(KEYSTRINGDESC));
+	if (size > 0 && output.write(&keys[0], size) != size)
+	{
+		throw WriteException();
+	}
+
+	for (map<LANGID, vector<uint32_t> >::const_iterator p = values.begin(); p != values.end(); p++)
+	{
+		uint16_t leLang = htoles(p->first);
+		if (output.write(&leLang, sizeof leLang) != sizeof leLang)
+		{
+			throw WriteException();
+		}
+
+		vector<uint32_t> offsets(p->second.size());
+		for (size_t i = 0; i < offsets.size(); i++)
+		{
+			offsets[i] = htolel(p->second[i]);
+		}
+		size = (unsigned long)(offsets.size() * sizeof(uint32_t));
+		if (size > 0 && output.write(&offsets[0], size) != size)
+		{
+			throw WriteException();
+		}
+	}
+}
+
+void Document::write(IFile& output)
 {
-	vector<size_t> starts;
+	loadAll();
 
 	// Write file signature
 	uint8_t signature[4] = {'V','D','F', VDF_VERSION};
@@ -85,107 +311,305 @@ void Document::write(IFile& output) const
 		throw WriteException();
 	}
 
-	// Write counts
-	FILEINFO info;
-	info.nVersions  = htolel((unsigned long)m_versions.size());
-	info.nPostfixes = htolel((unsigned long)m_newPostfixes.size());
-	info.language   = htoles(m_curLanguage);
-	info.type       = (uint8_t)m_type;
-	if (output.write(&info, sizeof info) != sizeof info)
+	// If this fails, the file can't be appended to
+	m_canAppend = false;
+	m_fileVersions.clear();
+	m_fileKeyframes.clear();
+
+	m_buffer.writeBlocks(output, true);
+	for (size_t v = 0; v < m_versions.size(); v++)
+	{
+		writeVersion(output, v);
+	}
+	writeKeyframes(output);
+	writeFooter(output);
+	m_canAppend = true;
+}
+
+void Document::append(IFile& file)
+{
+	if (!m_canAppend)
+	{
+		file.seek(0);
+		write(file);
+		file.truncate();
+		return;
+	}
+
+	// Only the versions that were saved since are written, after the strings
+	// they added to the pool. The old footer and trailer are left as they are,
+	// so the file can still be read as it was until the new trailer has been
+	// written. If this fails, the file has to be written again.
+	m_canAppend = false;
+	size_t        first = m_fileVersions.size();
+	unsigned long end   = m_fileEnd;
+	try
+	{
+		file.seek(end);
+		m_buffer.writeBlocks(file, false);
+		for (size_t v = first; v < m_versions.size(); v++)
+		{
+			writeVersion(file, v);
+		}
+
+		// Keyframes are written from the last version, which is always built
+		size_t last = m_versions.size() - 1;
+		if (last >= first && last > 0 && last % KEYFRAME_INTERVAL == 0)
+		{
+			writeKeyframe(file, last);
+		}
+
+		writeFooter(file);
+		file.truncate();
+	}
+	catch (...)
+	{
+		// Cut off what was written, if we still can
+		try
+		{
+			file.seek(end);
+			file.truncate();
+		}
+		catch (...)
+		{
+		}
+		throw;
+	}
+	m_canAppend = true;
+}
+
+void Document::writeVersion(IFile& output, size_t v)
+{
+	const Version& version = m_versions[v];
+	FileEntry      entry;
+	entry.first = (uint32_t)output.tell();
+
+	VERSIONDESC desc;
+	desc.saved      = htolell(version.m_saved);
+	desc.lenAuthor  = htolel((unsigned long)version.m_author.length() + 1);
+	desc.lenNotes   = htolel((unsigned long)version.m_notes.length() + 1);
+	desc.maxString  = htolel((unsigned long)version.m_strings.size());
+	desc.nStrings   = htolel((unsigned long)version.diff_strings.size());
+	desc.nLanguages = htolel((unsigned long)version.m_values.size());
+
+	if (output.write(&desc, sizeof desc) != sizeof desc)
 	{
 		throw WriteException();
 	}
 
-	m_buffer.write(output);
+	WriteString(output, version.m_author);
+	WriteString(output, version.m_notes);
 
-	// Write postfixes
-	for (map<LANGID,wstring>::const_iterator p = m_newPostfixes.begin(); p != m_newPostfixes.end(); p++)
+	// Write changed string infos
+	for (IdSet::const_iterator p = version.diff_strings.begin(); p != version.diff_strings.end(); p++)
 	{
-		POSTFIXINFO info;
-		info.language = htolel(p->first);
-		info.length   = htolel((unsigned long)p->second.length() + 1);
-		if (output.write(&info, sizeof info) != sizeof info)
+		const StringInfo& str = version.m_strings[*p];
+
+		STRINGDESC desc;
+		desc.id       = htolel((uint32_t)*p);
+		desc.position = htolel(str.m_position);
+		desc.name     = htolel(m_buffer.getStringOffset(str.m_name));
+		desc.comment  = htolel(m_buffer.getStringOffset(str.m_comment));
+		desc.flags    = htolel(str.m_flags & SF_SAVE_MASK);
+		if (output.write(&desc, sizeof desc) != sizeof desc)
 		{
 			throw WriteException();
 		}
-		WriteString(output, p->second);
 	}
 
-	// Write versions
-	for (vector<Version>::const_iterator v = m_versions.begin(); v != m_versions.end(); v++)
+	// Writes language
+	for (map<LANGID, StringValues>::const_iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
 	{
-		VERSIONDESC version;
-		version.saved      = htolell(v->m_saved);
-		version.lenAuthor  = htolel((unsigned long)v->m_author.length() + 1);
-		version.lenNotes   = htolel((unsigned long)v->m_notes.length() + 1);
-		version.maxString  = htolel((unsigned long)v->m_strings.size());
-		version.nStrings   = htolel((unsigned long)v->diff_strings.size());
-		version.nLanguages = htolel((unsigned long)v->m_values.size());
-
-		if (output.write(&version, sizeof version) != sizeof version)
+		uint16_t leLang = htoles(p->first);
+		if (output.write(&leLang, sizeof leLang) != sizeof leLang)
 		{
 			throw WriteException();
 		}
+	}
 
-		WriteString(output, v->m_author);
-		WriteString(output, v->m_notes);
+	// Write changed values, per language
+	entry.second = (uint32_t)output.tell();
+	for (map<LANGID, StringValues>::const_iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
+	{
+		const StringValues& values = p->second;
 
-		// Write changed string infos
-		for (set<size_t>::const_iterator p = v->diff_strings.begin(); p != v->diff_strings.end(); p++)
+		uint32_t leNumValues = htolel((unsigned long)values.m_changed.size());
+		if (output.write(&leNumValues, sizeof leNumValues) != sizeof leNumValues)
 		{
-			const StringInfo& str = v->m_strings[*p];
-
-			STRINGDESC desc;
-			desc.id       = htolel((uint32_t)*p);
-			desc.position = htolel(str.m_position);
-			desc.name     = htolel(m_buffer.getStringOffset(str.m_name));
-			desc.comment  = htolel(m_buffer.getStringOffset(str.m_comment));
-			desc.flags    = htolel(str.m_flags & SF_SAVE_MASK);
-			if (output.write(&desc, sizeof desc) != sizeof desc)
-			{
-				throw WriteException();
-			}
+			throw WriteException();
 		}
 
-		// Writes language
-		for (map<LANGID, StringValues>::const_iterator p = v->m_values.begin(); p != v->m_values.end(); p++)
+		for (IdSet::const_iterator q = values.m_changed.begin(); q != values.m_changed.end(); q++)
 		{
-			uint16_t leLang = htoles(p->first);
-			if (output.write(&leLang, sizeof leLang) != sizeof leLang)
+			VALUEDESC desc;
+			desc.id     = htolel((uint32_t)*q);
+			desc.offset = htolel((uint32_t)m_buffer.getStringOffset(values.m_virt[*q]));
+
+			if (output.write(&desc, sizeof(VALUEDESC)) != sizeof(VALUEDESC))
 			{
 				throw WriteException();
 			}
 		}
 	}
+	m_fileVersions.push_back(entry);
+}
+
+// The keyframes are built by applying the changes like the reader does, so
+// a version built from a keyframe is the same as one built from its changes
+void Document::writeKeyframes(IFile& output)
+{
+	vector<LatestString>           strings;
+	map<LANGID, vector<uint32_t> > values;
 
-	// Write changed values, per language, per version
-	for (vector<Version>::const_iterator v = m_versions.begin(); v != m_versions.end(); v++)
+	for (size_t v = 0; v < m_versions.size(); v++)
 	{
-		for (map<LANGID, StringValues>::const_iterator p = v->m_values.begin(); p != v->m_values.end(); p++)
+		const Version& version = m_versions[v];
+
+		strings.resize(version.m_strings.size());
+		for (IdSet::const_iterator p = version.diff_strings.begin(); p != version.diff_strings.end(); p++)
 		{
-			const StringValues& values = p->second;
+			const StringInfo& src = version.m_strings[*p];
+			LatestString&     str = strings[*p];
+			str.position = (uint32_t)src.m_position;
+			str.name     = m_buffer.getStringOffset(src.m_name);
+			str.comment  = m_buffer.getStringOffset(src.m_comment);
+			str.flags    = src.m_flags & SF_SAVE_MASK;
+			str.version  = (unsigned long)v;
+		}
 
-			uint32_t leNumValues = htolel((unsigned long)values.m_changed.size());
-			if (output.write(&leNumValues, sizeof leNumValues) != sizeof leNumValues)
+		map<LANGID, vector<uint32_t> > next;
+		for (map<LANGID, StringValues>::const_iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
+		{
+			vector<uint32_t>& offsets = next[p->first];
+			map<LANGID, vector<uint32_t> >::iterator q = values.find(p->first);
+			if (q != values.end())
 			{
-				throw WriteException();
+				offsets.swap(q->second);
 			}
+			offsets.resize(version.m_strings.size(), NO_STRING);
 
-			for (set<size_t>::const_iterator q = values.m_changed.begin(); q != values.m_changed.end(); q++)
+			for (IdSet::const_iterator i = p->second.m_changed.begin(); i != p->second.m_changed.end(); i++)
 			{
-				VALUEDESC desc;
-				desc.id     = htolel((uint32_t)*q);
-				desc.offset = htolel((uint32_t)m_buffer.getStringOffset(values.m_virt[*q]));
-
-				if (output.write(&desc, sizeof(VALUEDESC)) != sizeof(VALUEDESC))
-				{
-					throw WriteException();
-				}
+				offsets[*i] = m_buffer.getStringOffset(p->second.m_virt[*i]);
 			}
 		}
+		values.swap(next);
+
+		if (v > 0 && v % KEYFRAME_INTERVAL == 0)
+		{
+			m_fileKeyframes.push_back(make_pair((uint32_t)v, (uint32_t)output.tell()));
+			WriteKeyframe(output, v, strings, values);
+		}
 	}
 }
 
+// Writes the keyframe of a version that's built, using m_lastChanged for
+// what the reader derives from the changes
+void Document::writeKeyframe(IFile& output, size_t v)
+{
+	const Version&       version = m_versions[v];
+	vector<LatestString> strings(version.m_strings.size());
+	for (size_t i = 0; i < strings.size() && i < m_lastChanged.size(); i++)
+	{
+		if (m_lastChanged[i] != NO_VERSION)
+		{
+			const StringInfo& src = version.m_strings[i];
+			LatestString&     str = strings[i];
+			str.position = (uint32_t)src.m_position;
+			str.name     = m_buffer.getStringOffset(src.m_name);
+			str.comment  = m_buffer.getStringOffset(src.m_comment);
+			str.flags    = src.m_flags & SF_SAVE_MASK;
+			str.version  = m_lastChanged[i];
+		}
+	}
+
+	map<LANGID, vector<uint32_t> > values;
+	for (map<LANGID, StringValues>::const_iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
+	{
+		vector<uint32_t>& offsets = values[p->first];
+		offsets.resize(p->second.m_virt.size());
+		for (size_t i = 0; i < offsets.size(); i++)
+		{
+			offsets[i] = m_buffer.getStringOffset(p->second.m_virt[i]);
+		}
+	}
+
+	m_fileKeyframes.push_back(make_pair((uint32_t)v, (uint32_t)output.tell()));
+	WriteKeyframe(output, v, strings, values);
+}
+
+void Document::writeFooter(IFile& output)
+{
+	m_fileFooter = output.tell();
+
+	FILEINFO info;
+	info.nVersions  = htolel((unsigned long)m_versions.size());
+	info.nPostfixes = htolel((unsigned long)m_newPostfixes.size());
+	info.language   = htoles(m_curLanguage);
+	info.type       = (uint8_t)m_type;
+	if (output.write(&info, sizeof info) != sizeof info)
+	{
+		throw WriteException();
+	}
+
+	m_buffer.writeIndex(output);
+
+	// Write postfixes
+	for (map<LANGID,wstring>::const_iterator p = m_newPostfixes.begin(); p != m_newPostfixes.end(); p++)
+	{
+		POSTFIXINFO info;
+		info.language = htolel(p->first);
+		info.length   = htolel((unsigned long)p->second.length() + 1);
+		if (output.write(&info, sizeof info) != sizeof info)
+		{
+			throw WriteException();
+		}
+		WriteString(output, p->second);
+	}
+
+	vector<VERSIONENTRY> versions(m_fileVersions.size());
+	for (size_t i = 0; i < versions.size(); i++)
+	{
+		versions[i].strings = htolel(m_fileVersions[i].first);
+		versions[i].values  = htolel(m_fileVersions[i].second);
+	}
+	unsigned long size = (unsigned long)(versions.size() * sizeof(VERSIONENTRY));
+	if (size > 0 && output.write(&versions[0], size) != size)
+	{
+		throw WriteException();
+	}
+
+	uint32_t leNumKeyframes = htolel((uint32_t)m_fileKeyframes.size());
+	if (output.write(&leNumKeyframes, sizeof leNumKeyframes) != sizeof leNumKeyframes)
+	{
+		throw WriteException();
+	}
+
+	vector<KEYFRAMEENTRY> keyframes(m_fileKeyframes.size());
+	for (size_t i = 0; i < keyframes.size(); i++)
+	{
+		keyframes[i].version = htolel(m_fileKeyframes[i].first);
+		keyframes[i].offset  = htolel(m_fileKeyframes[i].second);
+	}
+	size = (unsigned long)(keyframes.size() * sizeof(KEYFRAMEENTRY));
+	if (size > 0 && output.write(&keyframes[0], size) != size)
+	{
+		throw WriteException();
+	}
+
+	FOOTERTRAILER trailer;
+	trailer.footer       = htolel((uint32_t)m_fileFooter);
+	trailer.signature[0] = 'V';
+	trailer.signature[1] = 'D';
+	trailer.signature[2] = 'F';
+	trailer.signature[3] = VDF_VERSION;
+	if (output.write(&trailer, sizeof trailer) != sizeof trailer)
+	{
+		throw WriteException();
+	}
+	m_fileEnd = output.tell();
+}
+
 Document::Document(IFile& input)
 {
 	try
@@ -202,12 +626,30 @@ Document::Document(IFile& input)
 			throw BadFileException();
 		}
 
-		// Currently, we only support Version 1 of the VDF file format
-		if (version != VDF_VERSION)
+		// Version 1 only differs in the layout of the string pool, version 2
+		// in that it has no keyframes. Version 3 has the keyframe table at
+		// the end, version 4 starts at the footer and version 5 only differs
+		// from it in the pool's block index.
+		if (version > VDF_VERSION)
 		{
 			throw UnsupportedVersionException();
 		}
 
+		bool                  segmented = (version >= 4);
+		unsigned long         footer    = 0;
+		unsigned long         end       = 0;
+		// The tables are used in place if the file can view them
+		const VERSIONENTRY*   versionTable = NULL;
+		const KEYFRAMEENTRY*  keyframes    = NULL;
+		unsigned long         nKeyframes   = 0;
+		vector<uint8_t>       versionCopy;
+		vector<uint8_t>       keyframeCopy;
+		if (segmented)
+		{
+			footer = FindFooter(input, signature, end);
+			input.seek(footer);
+		}
+
 		// Read file info
 		FILEINFO info;
 		if (input.read(&info, sizeof info) != sizeof info)
@@ -219,11 +661,25 @@ Document::Document(IFile& input)
 		unsigned long nPostfixes = letohl(info.nPostfixes);
 		m_curLanguage            = letohs(info.language);
 		m_type                   = (Type)info.type;
+		m_journal                = NULL;
+		m_batch                  = 0;
+		m_batchTime              = 0;
 
 		m_versions.resize(nVersions + 1);
 
 		// Read string data
-		m_buffer.read(input);
+		if (version == 1)
+		{
+			m_buffer.read(input);
+		}
+		else if (!segmented)
+		{
+			m_buffer.readCompressed(input);
+		}
+		else
+		{
+			m_buffer.readBlocks(input, version >= 5);
+		}
 
 		// Read postfixes
 		for (unsigned long i = 0; i < nPostfixes; i++)
@@ -238,9 +694,43 @@ Document::Document(IFile& input)
 		}
 		m_newPostfixes = m_oldPostfixes;
 
-		// Read versions
+		// Read where the versions and keyframes are
+		if (segmented)
+		{
+			if (nVersions > (input.size() - input.tell()) / sizeof(VERSIONENTRY))
+			{
+				throw ReadException();
+			}
+			unsigned long size = (unsigned long)(nVersions * sizeof(VERSIONENTRY));
+			versionTable = (const VERSIONENTRY*)ReadView(input, versionCopy, size);
+
+			uint32_t leNumKeyframes;
+			if (input.read(&leNumKeyframes, sizeof leNumKeyframes) != sizeof leNumKeyframes)
+			{
+				throw ReadException();
+			}
+			if (letohl(leNumKeyframes) > (input.size() - input.tell()) / sizeof(KEYFRAMEENTRY))
+			{
+				throw ReadException();
+			}
+			nKeyframes = letohl(leNumKeyframes);
+			size       = (unsigned long)(nKeyframes * sizeof(KEYFRAMEENTRY));
+			keyframes  = (const KEYFRAMEENTRY*)ReadView(input, keyframeCopy, size);
+		}
+
+		// Read versions. The changes are kept in m_history and applied to the
+		// latest strings; only the last version is built from those.
+		vector<LatestString> latest;
+		unsigned long        numStrings = 0;
+
+		m_pending.resize(nVersions);
 		for (size_t v = 0; v < nVersions; v++)
 		{
+			if (segmented)
+			{
+				input.seek(letohl(versionTable[v].strings));
+			}
+
 			VERSIONDESC desc;
 			if (input.read(&desc, sizeof desc) != sizeof desc)
 			{
@@ -256,26 +746,40 @@ Document::Document(IFile& input)
 			unsigned long nStrings   = letohl(desc.nStrings);
 			unsigned long maxString  = letohl(desc.maxString);
 
-			// Read changed strings
-			version.m_strings.resize(maxString);
-			for (unsigned long i = 0; i < nStrings; i++)
+			PendingVersion& pending = m_pending[v];
+			pending.maxString = maxString;
+			pending.strings   = ReadRecords(input, m_history, nStrings * sizeof(STRINGDESC));
+			pending.nStrings  = nStrings;
+			pending.keyframe  = NO_KEYFRAME;
+			pending.loaded    = false;
+
+			// Apply changed strings
+			for (size_t i = maxString; i < latest.size(); i++)
 			{
-				STRINGDESC desc;
-				if (input.read(&desc, sizeof desc) != sizeof desc)
+				if (m_buffer.hasString(latest[i].name))
 				{
-					throw ReadException();
+					numStrings--;
 				}
+			}
+			latest.resize(maxString);
+			for (unsigned long i = 0; i < nStrings; i++)
+			{
+				STRINGDESC desc;
+				memcpy(&desc, &m_history[pending.strings + i * sizeof desc], sizeof desc);
 
 				unsigned long id = letohl(desc.id);
-				version.diff_strings.insert(id);
+				if (id >= maxString)
+				{
+					throw BadFileException();
+				}
 
-				// Set for current version
-				StringInfo& str = version.m_strings[ id ];
-				str.m_position = letohl(desc.position);
-				str.m_flags    = letohl(desc.flags);
-				str.m_name     = m_buffer.getString(letohl(desc.name));
-				str.m_comment  = m_buffer.getString(letohl(desc.comment));
-				str.m_modified = version.m_saved;
+				LatestString& str = latest[id];
+				numStrings += (m_buffer.hasString(letohl(desc.name)) ? 1 : 0) - (m_buffer.hasString(str.name) ? 1 : 0);
+				str.position = letohl(desc.position);
+				str.name     = letohl(desc.name);
+				str.comment  = letohl(desc.comment);
+				str.flags    = desc.flags;
+				str.version  = (unsigned long)v;
 			}
 
 			// Read languages
@@ -289,29 +793,25 @@ Document::Document(IFile& input)
 				version.m_values[ letohs(leLang) ];
 			}
 
-			version.m_numDifferences = (unsigned long)version.diff_strings.size();
+			version.m_numDifferences = nStrings;
 			version.m_numLanguages	 = (unsigned long)version.m_values.size();
-			version.m_numStrings     = 0;
-
-			// Copy this version's strings to next version and clear flags
-			m_versions[v+1].m_strings = version.m_strings;
-			for (size_t i = 0; i < m_versions[v+1].m_strings.size(); i++)
-			{
-				m_versions[v+1].m_strings[i].m_flags = 0;
-				if (m_versions[v+1].m_strings[i].m_name != NULL)
-				{
-					version.m_numStrings++;
-				}
-			}
+			version.m_numStrings     = numStrings;
 		}
 
-		// Copy the languages from the last version to the current version
-		m_versions[nVersions].m_values = m_versions[nVersions - 1].m_values;
-
 		// Read values, per language, per version
+		map<LANGID, vector<uint32_t> > latestValues;
 		for (size_t v = 0; v < nVersions; v++)
 		{
-			Version& version = m_versions[v];
+			Version&        version = m_versions[v];
+			PendingVersion& pending = m_pending[v];
+			if (segmented)
+			{
+				input.seek(letohl(versionTable[v].values));
+			}
+
+			// A language's values only carry over from the previous version if
+			// that version had the language as well
+			map<LANGID, vector<uint32_t> > values;
 			for (map<LANGID, StringValues>::iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
 			{
 				uint32_t leNumValues;
@@ -321,48 +821,227 @@ Document::Document(IFile& input)
 				}
 				unsigned long nValues = letohl(leNumValues);
 
-				// Read changed values
-				StringValues& values = p->second;
-				values.m_virt.resize( version.m_strings.size() );
+				vector<uint32_t>& offsets = values[p->first];
+				map<LANGID, vector<uint32_t> >::iterator q = latestValues.find(p->first);
+				if (q != latestValues.end())
+				{
+					offsets.swap(q->second);
+				}
+				offsets.resize(pending.maxString, NO_STRING);
+
+				size_t records = ReadRecords(input, m_history, nValues * sizeof(VALUEDESC));
+				pending.values[p->first] = make_pair(records, nValues);
 				for (unsigned long j = 0; j < nValues; j++)
 				{
 					VALUEDESC desc;
-					if (input.read(&desc, sizeof(VALUEDESC)) != sizeof(VALUEDESC))
+					memcpy(&desc, &m_history[records + j * sizeof desc], sizeof desc);
+
+					unsigned long id = letohl(desc.id);
+					if (id >= offsets.size())
 					{
-						throw ReadException();
+						throw BadFileException();
 					}
+					offsets[id] = letohl(desc.offset);
+				}
+				version.m_numDifferences += nValues;
+			}
+			latestValues.swap(values);
+		}
 
-					unsigned long id  = letohl(desc.id);
-					values.m_virt[id] = m_buffer.getString(letohl(desc.offset));
-					values.m_changed.insert(id);
+		// Index the changes per string, from the oldest version up
+		for (size_t v = 0; v < nVersions; v++)
+		{
+			const PendingVersion& pending = m_pending[v];
+			for (unsigned long i = 0; i < pending.nStrings; i++)
+			{
+				STRINGDESC desc;
+				memcpy(&desc, &m_history[pending.strings + i * sizeof desc], sizeof desc);
+				addChange(letohl(desc.id), v, 0, Change::CF_INFO | ((desc.flags & SF_NEW) ? Change::CF_FIRST : 0));
+			}
+
+			for (map<LANGID, pair<size_t, unsigned long> >::const_iterator p = pending.values.begin(); p != pending.values.end(); p++)
+			{
+				bool added = (v == 0 || m_versions[v - 1].m_values.find(p->first) == m_versions[v - 1].m_values.end());
+				for (unsigned long j = 0; j < p->second.second; j++)
+				{
+					VALUEDESC desc;
+					memcpy(&desc, &m_history[p->second.first + j * sizeof desc], sizeof desc);
+					addChange(letohl(desc.id), v, p->first, added ? Change::CF_FIRST : 0);
 				}
-				version.m_numDifferences += (unsigned long)values.m_changed.size();
+			}
+		}
+
+		// Build the last saved version; only its own changes keep their flags
+		size_t   last    = nVersions - 1;
+		Version& saved   = m_versions[last];
+		saved.m_strings.resize(latest.size());
+		for (size_t i = 0; i < latest.size(); i++)
+		{
+			const LatestString& src = latest[i];
+			if (src.version != ULONG_MAX)
+			{
+				StringInfo& str = saved.m_strings.edit(i);
+				str.m_position = src.position;
+				str.m_name     = m_buffer.getString(src.name);
+				str.m_comment  = m_buffer.getString(src.comment);
+				str.m_flags    = (src.version == last) ? src.flags : 0;
+				str.m_modified = m_versions[src.version].m_saved;
+			}
+		}
+		for (unsigned long i = 0; i < m_pending[last].nStrings; i++)
+		{
+			STRINGDESC desc;
+			memcpy(&desc, &m_history[m_pending[last].strings + i * sizeof desc], sizeof desc);
+			saved.diff_strings.insert(letohl(desc.id));
+		}
 
-				// Copy values to next version, if it also has the language
-				map<LANGID, StringValues>::iterator q = m_versions[v+1].m_values.find(p->first);
-				if (q != m_versions[v+1].m_values.end())
+		for (map<LANGID, StringValues>::iterator p = saved.m_values.begin(); p != saved.m_values.end(); p++)
+		{
+			const vector<uint32_t>& offsets = latestValues[p->first];
+			p->second.m_virt.resize(offsets.size());
+			for (size_t i = 0; i < offsets.size(); i++)
+			{
+				if (offsets[i] != NO_STRING)
 				{
-					q->second.m_virt = values.m_virt;
+					p->second.m_virt.edit(i) = m_buffer.getString(offsets[i]);
 				}
 			}
+
+			const pair<size_t, unsigned long>& records = m_pending[last].values[p->first];
+			for (unsigned long j = 0; j < records.second; j++)
+			{
+				VALUEDESC desc;
+				memcpy(&desc, &m_history[records.first + j * sizeof desc], sizeof desc);
+				p->second.m_changed.insert(letohl(desc.id));
+			}
 		}
 
+		// Only the versions before it are built lazily
+		m_pending.pop_back();
+		m_numLoaded = 0;
+
+		// Read the keyframes of those versions
+		if (version == 3)
+		{
+			KEYFRAMETRAILER trailer;
+			input.seek(input.size() - sizeof trailer);
+			if (input.size() < sizeof trailer || input.read(&trailer, sizeof trailer) != sizeof trailer)
+			{
+				throw ReadException();
+			}
+
+			nKeyframes = letohl(trailer.nKeyframes);
+			input.seek(letohl(trailer.table));
+			if (nKeyframes > (input.size() - input.tell()) / sizeof(KEYFRAMEENTRY))
+			{
+				throw ReadException();
+			}
+			unsigned long size = (unsigned long)(nKeyframes * sizeof(KEYFRAMEENTRY));
+			keyframes = (const KEYFRAMEENTRY*)ReadView(input, keyframeCopy, size);
+		}
+
+		for (size_t k = 0; k < nKeyframes; k++)
+		{
+			size_t v = letohl(keyframes[k].version);
+			if (v >= m_pending.size())
+			{
+				continue;
+			}
+
+			KEYFRAMEDESC desc;
+			input.seek(letohl(keyframes[k].offset));
+			if (input.read(&desc, sizeof desc) != sizeof desc)
+			{
+				throw ReadException();
+			}
+
+			PendingVersion& pending = m_pending[v];
+			const Version&  version = m_versions[v];
+			if (letohl(desc.version) != v || letohl(desc.maxString) != pending.maxString || letohl(desc.nLanguages) != version.m_values.size())
+			{
+				throw BadFileException();
+			}
+
+			size_t nLanguages = version.m_values.size();
+			pending.keyframe  = ReadRecords(input, m_history, pending.maxString * sizeof(KEYSTRINGDESC)
+				+ nLanguages * (sizeof(uint16_t) + pending.maxString * sizeof(uint32_t)));
+
+			// Check it here, so building the version can't fail (the string
+			// buffer has already checked that all of its blocks unpack)
+			const uint8_t* data = &m_history[pending.keyframe];
+			for (size_t i = 0; i < pending.maxString; i++, data += sizeof(KEYSTRINGDESC))
+			{
+				KEYSTRINGDESC key;
+				memcpy(&key, data, sizeof key);
+				if (letohl(key.changed) != NO_VERSION && letohl(key.changed) > v)
+				{
+					throw BadFileException();
+				}
+			}
+			for (size_t i = 0; i < nLanguages; i++, data += sizeof(uint16_t) + pending.maxString * sizeof(uint32_t))
+			{
+				uint16_t leLang;
+				memcpy(&leLang, data, sizeof leLang);
+				if (version.m_values.find(letohs(leLang)) == version.m_values.end())
+				{
+					throw BadFileException();
+				}
+			}
+		}
+
+		if (m_pending.empty())
+		{
+			vector<uint8_t>().swap(m_history);
+		}
+
+		// The current version starts out as a copy of the last version, without
+		// flags and changes
+		Version& current = m_versions[nVersions];
+		current.m_strings = saved.m_strings;
+		for (IdSet::const_iterator p = saved.diff_strings.begin(); p != saved.diff_strings.end(); p++)
+		{
+			if (saved.m_strings[*p].m_flags != 0)
+			{
+				current.m_strings.edit(*p).m_flags = 0;
+			}
+		}
+		for (map<LANGID, StringValues>::iterator p = saved.m_values.begin(); p != saved.m_values.end(); p++)
+		{
+			current.m_values[p->first].m_virt = p->second.m_virt;
+		}
+
+		// Remember where everything is, so new versions can be appended
+		m_lastChanged.resize(latest.size());
+		for (size_t i = 0; i < latest.size(); i++)
+		{
+			m_lastChanged[i] = (latest[i].version == ULONG_MAX) ? NO_VERSION : (uint32_t)latest[i].version;
+		}
+		for (size_t v = 0; v < nVersions && segmented; v++)
+		{
+			m_fileVersions.push_back(make_pair(letohl(versionTable[v].strings), letohl(versionTable[v].values)));
+		}
+		for (size_t k = 0; k < nKeyframes && segmented; k++)
+		{
+			m_fileKeyframes.push_back(make_pair(letohl(keyframes[k].version), letohl(keyframes[k].offset)));
+		}
+		m_fileFooter = footer;
+		m_fileEnd    = end;
+		// Older files are written again in the current version
+		m_canAppend  = (version == VDF_VERSION);
+
 		// Set cached values
 		m_curVersion  = &m_versions.back();
 		m_curValues   = &m_curVersion->m_values[m_curLanguage];
 
-		// Set names set and create freelist
+		// Set names set and create freelist. The current version starts out
+		// pointing into the pool, like the last saved version.
 		m_strings.resize( m_curVersion->m_strings.size() );
+		m_names.reserve(m_curVersion->m_strings.size());
 		for (size_t i = 0; i < m_curVersion->m_strings.size(); i++)
 		{
 			if (m_curVersion->m_strings[i].m_name != NULL)
 			{
-				m_strings[i].m_name    = m_curVersion->m_strings[i].m_name;
-				m_strings[i].m_comment = m_curVersion->m_strings[i].m_comment;
-				m_curVersion->m_strings[i].m_name    = m_strings[i].m_name.c_str();
-				m_curVersion->m_strings[i].m_comment = m_strings[i].m_comment.c_str();
-				
-				m_names.insert(make_pair(m_strings[i].m_name, (unsigned int)i));
+				indexName((unsigned int)i);
 			}
 			else
 			{
@@ -374,14 +1053,6 @@ Document::Document(IFile& input)
 		for (map<LANGID, StringValues>::iterator p = m_curVersion->m_values.begin(); p != m_curVersion->m_values.end(); p++)
 		{
 			p->second.m_phys.resize( p->second.m_virt.size() );
-			for (size_t i = 0; i < p->second.m_virt.size(); i++)
-			{
-				if (m_curVersion->m_strings[i].m_name != NULL)
-				{
-					p->second.m_phys[i] = p->second.m_virt[i];
-					p->second.m_virt[i] = p->second.m_phys[i].c_str();
-				}
-			}
 		}
 	}
 	catch (...)
@@ -390,3 +1061,157 @@ Document::Document(IFile& input)
 		throw;
 	}
 }
+
+void Document::load(size_t version) const
+{
+	if (version >= m_pending.size() || m_pending[version].loaded)
+	{
+		return;
+	}
+
+	// Start after the last version that's built, or at a keyframe
+	size_t first = version;
+	while (first > 0 && !m_pending[first - 1].loaded && m_pending[first].keyframe == NO_KEYFRAME)
+	{
+		first--;
+	}
+
+	for (size_t v = first; v <= version; v++)
+	{
+		loadVersion(v);
+	}
+
+	if (m_numLoaded == m_pending.size())
+	{
+		vector<uint8_t>().swap(m_history);
+	}
+}
+
+void Document::loadAll() const
+{
+	for (size_t v = 0; v < m_pending.size(); v++)
+	{
+		load(v);
+	}
+}
+
+// Builds a version from the previous version or its keyframe, and its records,
+// like the versions were built when every version was read at once
+void Document::loadVersion(size_t v) const
+{
+	PendingVersion& pending  = m_pending[v];
+	Version&        version  = m_versions[v];
+	bool            fromPrev = (v > 0 && m_pending[v - 1].loaded);
+
+	if (fromPrev)
+	{
+		const Version& prev = m_versions[v - 1];
+		version.m_strings = prev.m_strings;
+		for (IdSet::const_iterator p = prev.diff_strings.begin(); p != prev.diff_strings.end(); p++)
+		{
+			if (prev.m_strings[*p].m_flags != 0)
+			{
+				version.m_strings.edit(*p).m_flags = 0;
+			}
+		}
+	}
+	else if (pending.keyframe != NO_KEYFRAME)
+	{
+		const uint8_t* data = &m_history[pending.keyframe];
+		version.m_strings.resize(pending.maxString);
+		for (size_t i = 0; i < pending.maxString; i++, data += sizeof(KEYSTRINGDESC))
+		{
+			KEYSTRINGDESC key;
+			memcpy(&key, data, sizeof key);
+			if (letohl(key.changed) != NO_VERSION)
+			{
+				StringInfo& str = version.m_strings.edit(i);
+				str.m_position = letohl(key.position);
+				str.m_flags    = key.flags;
+				str.m_name     = m_buffer.getString(letohl(key.name));
+				str.m_comment  = m_buffer.getString(letohl(key.comment));
+				str.m_modified = m_versions[letohl(key.changed)].m_saved;
+			}
+		}
+
+		for (size_t i = 0; i < version.m_values.size(); i++)
+		{
+			uint16_t leLang;
+			memcpy(&leLang, data, sizeof leLang);
+			data += sizeof leLang;
+
+			ValueArray& virt = version.m_values[letohs(leLang)].m_virt;
+			virt.resize(pending.maxString);
+			for (size_t j = 0; j < pending.maxString; j++, data += sizeof(uint32_t))
+			{
+				uint32_t offset;
+				memcpy(&offset, data, sizeof offset);
+				if (letohl(offset) != NO_STRING)
+				{
+					virt.edit(j) = m_buffer.getString(letohl(offset));
+				}
+			}
+		}
+	}
+	version.m_strings.resize(pending.maxString);
+
+	// A keyframe already has these changes; applying them again doesn't hurt
+	for (unsigned long i = 0; i < pending.nStrings; i++)
+	{
+		STRINGDESC desc;
+		memcpy(&desc, &m_history[pending.strings + i * sizeof desc], sizeof desc);
+
+		unsigned long id = letohl(desc.id);
+		version.diff_strings.insert(id);
+
+		StringInfo& str = version.m_strings.edit(id);
+		str.m_position = letohl(desc.position);
+		str.m_flags    = desc.flags;
+		str.m_name     = m_buffer.getString(letohl(desc.name));
+		str.m_comment  = m_buffer.getString(letohl(desc.comment));
+		str.m_modified = version.m_saved;
+	}
+
+	for (map<LANGID, StringValues>::iterator p = version.m_values.begin(); p != version.m_values.end(); p++)
+	{
+		StringValues& values = p->second;
+		if (fromPrev)
+		{
+			map<LANGID, StringValues>::const_iterator q = m_versions[v - 1].m_values.find(p->first);
+			if (q != m_versions[v - 1].m_values.end())
+			{
+				values.m_virt = q->second.m_virt;
+			}
+		}
+		values.m_virt.resize(pending.maxString);
+
+		map<LANGID, pair<size_t, unsigned long> >::const_iterator records = pending.values.find(p->first);
+		for (unsigned long j = 0; j < records->second.second; j++)
+		{
+			VALUEDESC desc;
+			memcpy(&desc, &m_history[records->second.first + j * sizeof desc], sizeof desc);
+
+			unsigned long id = letohl(desc.id);
+			values.m_virt.edit(id) = m_buffer.getString(letohl(desc.offset));
+			values.m_changed.insert(id);
+		}
+	}
+
+	pending.loaded = true;
+	m_numLoaded++;
+
+	// Share what the next version has in common with this one, if it's built
+	if (v + 1 == m_pending.size() || m_pending[v + 1].loaded)
+	{
+		Version& next = m_versions[v + 1];
+		next.m_strings.share(version.m_strings);
+		for (map<LANGID, StringValues>::iterator p = next.m_values.begin(); p != next.m_values.end(); p++)
+		{
+			map<LANGID, StringValues>::const_iterator q = version.m_values.find(p->first);
+			if (q != version.m_values.end())
+			{
+				p->second.m_virt.share(q->second.m_virt);
+			}
+		}
+	}
+}
\ No newline at end of file
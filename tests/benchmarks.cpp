@@ -0,0 +1,840 @@
+// Headless benchmarks for the string pool and documents. Run the release
+// build; with arguments, only the named benchmarks are run.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <malloc.h>
+#include <unistd.h>
+#endif
+#include "countingfile.h"
+#include "datetime.h"
+#include "document.h"
+#include "files.h"
+#include "idset.h"
+#include "strbuf.h"
+#include "stringlist.h"
+#include "utils.h"
+using namespace std;
+
+// The languages of the master file
+static const int    N_LANGUAGES = 14;
+static const LANGID Languages[N_LANGUAGES] = {
+	1033, 1031, 1036, 1040, 3082, 1049, 1045, 1029, 1038, 1041, 1042, 2052, 1028, 1046
+};
+
+// Keeps the optimizer from dropping the lookups that are timed
+static volatile size_t Sink;
+
+// Seconds since some fixed point
+static double Now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Resident memory of the process, in bytes. Freed heap memory is handed
+// back first where that's possible, so differences count live memory.
+static size_t MemoryUsed()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters);
+	return counters.WorkingSetSize;
+#else
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+	unsigned long size = 0, resident = 0;
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file != NULL)
+	{
+		if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+		{
+			resident = 0;
+		}
+		fclose(file);
+	}
+	return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// The benchmarks use their own generator, so they do the same on every platform
+static unsigned long Random()
+{
+	static unsigned long seed = 12345;
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7FFF;
+}
+
+// A value of a few words out of a small vocabulary, like the game's texts,
+// so some values repeat
+static wstring MakeValue(int language)
+{
+	static const wchar_t* Words[16] = {
+		L"the", L"unit", L"attack", L"shield", L"fleet", L"planet", L"ground", L"space",
+		L"damage", L"range", L"squadron", L"bonus", L"cannot", L"build", L"Imperial", L"Rebel"
+	};
+
+	wstring value = FormatString(L"%u:", (unsigned int)language);
+	int     words = 2 + (int)(Random() % 12);
+	for (int i = 0; i < words; i++)
+	{
+		value += L' ';
+		value += Words[Random() % 16];
+	}
+	if (Random() % 4 == 0)
+	{
+		value += FormatString(L" %u", (unsigned int)Random());
+	}
+	return value;
+}
+
+// A random index below size
+static size_t RandomIndex(size_t size)
+{
+	return ((Random() << 15) | Random()) % size;
+}
+
+static wstring MakeName(size_t i)
+{
+	return FormatString(L"TEXT_STRING_%06u", (unsigned int)i);
+}
+
+// Sets every string in every language of a document with nStrings strings
+static void FillDocument(Document& doc, size_t nStrings, int nLanguages)
+{
+	for (int l = 1; l < nLanguages; l++)
+	{
+		doc.addLanguage(Languages[l]);
+	}
+	for (size_t i = 0; i < nStrings; i++)
+	{
+		doc.addString();
+	}
+	for (int l = 0; l < nLanguages; l++)
+	{
+		doc.setActiveLanguage(Languages[l]);
+		for (size_t i = 0; i < nStrings; i++)
+		{
+			Document::String str;
+			str.m_position = (unsigned long)i;
+			str.m_name     = MakeName(i);
+			str.m_value    = MakeValue(Languages[l]);
+			doc.setString((unsigned int)i, str);
+		}
+	}
+	doc.setActiveLanguage(Languages[0]);
+}
+
+//
+// Interning
+//
+
+// Interns the names, comments and values of a 60,000 string document in 14
+// languages, once into a std::map keyed by wcscmp like the pool's old index,
+// and once into the pool. Then saveVersion() on such a document.
+static void BenchInterning()
+{
+	static const size_t N_STRINGS = 60000;
+
+	vector<wstring> strings;
+	strings.reserve(N_STRINGS * (2 + N_LANGUAGES));
+	for (size_t i = 0; i < N_STRINGS; i++)
+	{
+		strings.push_back(MakeName(i));
+		strings.push_back(L"");
+	}
+	for (int l = 0; l < N_LANGUAGES; l++)
+	{
+		for (size_t i = 0; i < N_STRINGS; i++)
+		{
+			strings.push_back(MakeValue(Languages[l]));
+		}
+	}
+
+	// Before: a tree node and a full string compare per level, per string
+	double start = Now();
+	size_t distinct;
+	{
+		map<const wchar_t*, uint32_t, wcsless> index;
+		vector<wchar_t*> copies;
+		uint32_t         offset = 0;
+		for (size_t i = 0; i < strings.size(); i++)
+		{
+			const wchar_t* str = strings[i].c_str();
+			if (index.find(str) == index.end())
+			{
+				size_t   length = strings[i].length();
+				wchar_t* copy   = new wchar_t[length + 1];
+				memcpy(copy, str, (length + 1) * sizeof(wchar_t));
+				index.insert(make_pair(copy, offset));
+				copies.push_back(copy);
+				offset += (uint32_t)(length + 1);
+			}
+		}
+		distinct = index.size();
+		for (size_t i = 0; i < copies.size(); i++)
+		{
+			delete[] copies[i];
+		}
+	}
+	double mapTime = Now() - start;
+
+	// After: the pool's hash index
+	start = Now();
+	{
+		StringBuffer buffer;
+		for (size_t i = 0; i < strings.size(); i++)
+		{
+			buffer.addString(strings[i]);
+		}
+	}
+	double poolTime = Now() - start;
+
+	printf("Interning %u strings, %u distinct: std::map %.3f s, pool %.3f s\n",
+		(unsigned int)strings.size(), (unsigned int)distinct, mapTime, poolTime);
+
+	// The same strings interned by a save
+	Document doc(Document::DT_NAME, Languages[0]);
+	FillDocument(doc, N_STRINGS, N_LANGUAGES);
+
+	start = Now();
+	doc.saveVersion(L"Benchmark", L"");
+	double saveTime = Now() - start;
+
+	// A second save, with one value in a hundred changed
+	doc.increaseVersion();
+	doc.setActiveVersion();
+	for (int l = 0; l < N_LANGUAGES; l++)
+	{
+		doc.setActiveLanguage(Languages[l]);
+		for (size_t i = 0; i < N_STRINGS; i += 100)
+		{
+			Document::String str;
+			str.m_flags = Document::String::SF_VALUE;
+			str.m_value = MakeValue(Languages[l]);
+			doc.setString((unsigned int)i, str);
+		}
+	}
+	start = Now();
+	doc.saveVersion(L"Benchmark", L"");
+	double resaveTime = Now() - start;
+
+	printf("saveVersion(), %u strings in %d languages: %.3f s; with 1%% changed: %.3f s\n",
+		(unsigned int)N_STRINGS, N_LANGUAGES, saveTime, resaveTime);
+}
+
+//
+// Offset resolution
+//
+
+// Writes pools of growing size as blocks, reads them back the way the
+// loader does, and resolves the offset of every string in them. The first
+// string of every block sits on a buffer boundary, so those are checked too.
+// The time per lookup should barely grow with the number of buffers.
+static void BenchOffsets()
+{
+	for (size_t nStrings = 10000; nStrings <= 640000; nStrings *= 4)
+	{
+		vector<wstring> strings(nStrings);
+		StringBuffer    pool;
+		for (size_t i = 0; i < nStrings; i++)
+		{
+			strings[i] = MakeName(i) + L" " + MakeValue(Languages[0]);
+			pool.addString(strings[i]);
+		}
+
+		vector<uint32_t> offsets(nStrings);
+		for (size_t i = 0; i < nStrings; i++)
+		{
+			offsets[i] = pool.getStringOffset(strings[i].c_str());
+		}
+
+		MemoryFile file;
+		pool.writeBlocks(file, true);
+		unsigned long index = file.tell();
+		pool.writeIndex(file);
+
+		ConstMemoryFile input(&file.data()[0], file.size());
+		input.seek(index);
+		StringBuffer loaded;
+		double start = Now();
+		loaded.readBlocks(input, true);
+		double readTime = Now() - start;
+
+		// The first pass unpacks the blocks and checks the strings
+		size_t wrong = 0;
+		for (size_t i = 0; i < nStrings; i++)
+		{
+			const wchar_t* str = loaded.getString(offsets[i]);
+			if (str == NULL || strings[i] != str)
+			{
+				wrong++;
+			}
+		}
+
+		// The second pass is timed, in random order
+		vector<uint32_t> order(offsets);
+		for (size_t i = order.size() - 1; i > 0; i--)
+		{
+			swap(order[i], order[RandomIndex(i + 1)]);
+		}
+		start = Now();
+		size_t sum = 0;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			sum += (size_t)loaded.getString(order[i])[0];
+		}
+		double lookupTime = Now() - start;
+		Sink = sum;
+
+		StringBuffer::Statistics stats;
+		loaded.getStatistics(stats);
+		printf("%7u strings in %4u buffers: read %.3f s, %.1f ns per lookup, %u wrong\n",
+			(unsigned int)nStrings, (unsigned int)stats.nChunks, readTime, lookupTime * 1e9 / nStrings, (unsigned int)wrong);
+	}
+
+	// Loading a document resolves an offset for every string and value
+	static const size_t N_STRINGS       = 100000;
+	static const int    N_DOC_LANGUAGES = 4;
+
+	Document doc(Document::DT_NAME, Languages[0]);
+	FillDocument(doc, N_STRINGS, N_DOC_LANGUAGES);
+	doc.saveVersion(L"Benchmark", L"");
+
+	MemoryFile file;
+	doc.write(file);
+
+	double start = Now();
+	{
+		ConstMemoryFile input(&file.data()[0], file.size());
+		Document        loaded(input);
+	}
+	printf("Loading %u strings in %d languages, %u bytes: %.3f s\n",
+		(unsigned int)N_STRINGS, N_DOC_LANGUAGES, (unsigned int)file.size(), Now() - start);
+}
+
+//
+// Buffered files
+//
+
+// Counts the calls that saving, appending and loading a document make to
+// the file, unbuffered and through a BufferedFile as the application does,
+// and times saving to disk both ways
+static void BenchBuffering()
+{
+	static const size_t N_STRINGS   = 20000;
+	static const int    N_VERSIONS  = 10;
+	static const int    N_LANGUAGES = 4;
+
+	Document doc(Document::DT_NAME, Languages[0]);
+	FillDocument(doc, N_STRINGS, N_LANGUAGES);
+	for (int v = 1; v < N_VERSIONS; v++)
+	{
+		for (int i = 0; i < 200; i++)
+		{
+			size_t           id = RandomIndex(N_STRINGS);
+			Document::String str;
+			str.m_position = (unsigned long)id;
+			str.m_name     = MakeName(id);
+			str.m_value    = MakeValue(Languages[0]);
+			doc.setString((unsigned int)id, str);
+		}
+		doc.saveVersion(L"Benchmark", L"");
+		doc.increaseVersion();
+		doc.setActiveVersion();
+	}
+
+	for (int buffered = 0; buffered < 2; buffered++)
+	{
+		MemoryFile   memory;
+		CountingFile counting(memory);
+		if (buffered)
+		{
+			BufferedFile output(counting);
+			doc.write(output);
+			output.flush();
+		}
+		else
+		{
+			doc.write(counting);
+		}
+		printf("write,  %-10s %7lu reads, %7lu writes, %7lu seeks for %u bytes\n", buffered ? "buffered:" : "direct:",
+			counting.m_reads, counting.m_writes, counting.m_seeks, (unsigned int)memory.size());
+
+		// Add a version and append it
+		unsigned int     id = (unsigned int)RandomIndex(N_STRINGS);
+		Document::String str;
+		str.m_position = id;
+		str.m_name     = MakeName(id);
+		str.m_value    = MakeValue(Languages[0]);
+		memory.seek(0);
+		Document copy(memory);
+		copy.setString(id, str);
+		copy.saveVersion(L"Benchmark", L"");
+		copy.detach();
+		if (copy.canAppend())
+		{
+			CountingFile appended(memory);
+			if (buffered)
+			{
+				BufferedFile output(appended);
+				copy.append(output);
+				output.flush();
+			}
+			else
+			{
+				copy.append(appended);
+			}
+			printf("append, %-10s %7lu reads, %7lu writes, %7lu seeks\n", buffered ? "buffered:" : "direct:",
+				appended.m_reads, appended.m_writes, appended.m_seeks);
+		}
+
+		CountingFile input(memory);
+		input.seek(0);
+		if (buffered)
+		{
+			BufferedFile buffer(input);
+			Document     loaded(buffer);
+		}
+		else
+		{
+			Document loaded(input);
+		}
+		printf("load,   %-10s %7lu reads, %7lu writes, %7lu seeks\n", buffered ? "buffered:" : "direct:",
+			input.m_reads, input.m_writes, input.m_seeks);
+	}
+
+	// The calls that are saved are system calls on disk
+	for (int buffered = 0; buffered < 2; buffered++)
+	{
+		double start = Now();
+		{
+			PhysicalFile file(L"benchmark.vdf", PhysicalFile::WRITE);
+			if (buffered)
+			{
+				BufferedFile output(file);
+				doc.write(output);
+				output.flush();
+			}
+			else
+			{
+				doc.write(file);
+			}
+		}
+		printf("write to disk, %-10s %.3f s\n", buffered ? "buffered:" : "direct:", Now() - start);
+	}
+	remove("benchmark.vdf");
+}
+
+//
+// Change tracking
+//
+
+static const size_t N_CHANGE_STRINGS  = 20000;
+static const int    N_CHANGE_VERSIONS = 100;
+
+// The ids that a version changes in a language: every string in the first
+// version, and 2% of them in random places after that
+static void GetChanges(int version, vector<size_t>& ids)
+{
+	ids.clear();
+	for (size_t i = 0; i < N_CHANGE_STRINGS; i++)
+	{
+		if (version == 0 || Random() % 50 == 0)
+		{
+			ids.push_back(i);
+		}
+	}
+}
+
+// Fills a set per language and version, the way the loader and edits do,
+// and returns the time it took
+template <typename Set>
+static double FillSets(vector<Set>& sets)
+{
+	double start = Now();
+	vector<size_t> ids;
+	for (int v = 0; v < N_CHANGE_VERSIONS; v++)
+	{
+		for (int l = 0; l < N_LANGUAGES; l++)
+		{
+			GetChanges(v, ids);
+			Set& changes = sets[v * N_LANGUAGES + l];
+			for (size_t i = 0; i < ids.size(); i++)
+			{
+				changes.insert(ids[i]);
+			}
+		}
+	}
+	return Now() - start;
+}
+
+// Walks every set in order, like Document::write does
+template <typename Set>
+static double WalkSets(const vector<Set>& sets)
+{
+	double start = Now();
+	size_t sum   = 0;
+	for (size_t s = 0; s < sets.size(); s++)
+	{
+		for (typename Set::const_iterator p = sets[s].begin(); p != sets[s].end(); p++)
+		{
+			sum += *p;
+		}
+	}
+	Sink = sum;
+	return Now() - start;
+}
+
+template <typename Set>
+static void BenchSets(const char* name)
+{
+	size_t before = MemoryUsed();
+	{
+		vector<Set> sets(N_CHANGE_VERSIONS * N_LANGUAGES);
+		double fillTime = FillSets(sets);
+		size_t memory   = MemoryUsed() - before;
+		double walkTime = WalkSets(sets);
+		printf("%-16s %6.1f MB, fill %.3f s, walk %.3f s\n", name, memory / 1048576.0, fillTime, walkTime);
+	}
+}
+
+// The change sets of a 100 version document in 14 languages, as the
+// std::set<size_t> they used to be and as IdSet. Then such a document is
+// saved version by version, written and loaded again.
+//
+// Measured with the CMake Release build (g++ 12.2, Linux x86-64), memory
+// as resident set: std::set<size_t> 38.5 MB, IdSet 3.2 MB; the document
+// takes 522 MB with 32-bit wchar_t and loads again into 257 MB.
+static void BenchChanges()
+{
+	BenchSets<set<size_t> >("std::set<size_t>");
+	BenchSets<IdSet>("IdSet");
+
+	double saveTime = 0;
+	size_t before   = MemoryUsed();
+	Document* doc = new Document(Document::DT_NAME, Languages[0]);
+	for (int l = 1; l < N_LANGUAGES; l++)
+	{
+		doc->addLanguage(Languages[l]);
+	}
+	for (size_t i = 0; i < N_CHANGE_STRINGS; i++)
+	{
+		doc->addString();
+	}
+
+	vector<size_t> ids;
+	for (int v = 0; v < N_CHANGE_VERSIONS; v++)
+	{
+		for (int l = 0; l < N_LANGUAGES; l++)
+		{
+			doc->setActiveLanguage(Languages[l]);
+			GetChanges(v, ids);
+			for (size_t i = 0; i < ids.size(); i++)
+			{
+				Document::String str;
+				str.m_position = (unsigned long)ids[i];
+				str.m_name     = MakeName(ids[i]);
+				str.m_value    = MakeValue(Languages[l]);
+				doc->setString((unsigned int)ids[i], str);
+			}
+		}
+		double start = Now();
+		doc->saveVersion(L"Benchmark", L"");
+		saveTime += Now() - start;
+		doc->increaseVersion();
+		doc->setActiveVersion();
+	}
+	size_t memory = MemoryUsed() - before;
+
+	MemoryFile file;
+	double start = Now();
+	doc->write(file);
+	double writeTime = Now() - start;
+	delete doc;
+
+	printf("%u strings, %d versions, %d languages: %.1f MB, saveVersion() %.3f s in all, write %.3f s, %u bytes\n",
+		(unsigned int)N_CHANGE_STRINGS, N_CHANGE_VERSIONS, N_LANGUAGES, memory / 1048576.0, saveTime, writeTime, (unsigned int)file.size());
+
+	before = MemoryUsed();
+	start  = Now();
+	{
+		ConstMemoryFile input(&file.data()[0], file.size());
+		Document        loaded(input);
+		double loadTime = Now() - start;
+		printf("Loaded: %.1f MB, %.3f s\n", (MemoryUsed() - before) / 1048576.0, loadTime);
+	}
+}
+
+//
+// Name index
+//
+
+// Imports a million rows, once with a name each into a named document,
+// and once with 1000 names into an indexed one, where the names repeat.
+// Then every string of the indexed document is deleted in order.
+static void BenchNames()
+{
+	static const size_t N_ROWS   = 1000000;
+	static const size_t N_SHARED = 1000;
+
+	StringList unique, shared;
+	unique.reserve(N_ROWS);
+	shared.reserve(N_ROWS);
+	for (size_t i = 0; i < N_ROWS; i++)
+	{
+		unique.add(MakeName(i), L"Value", L"");
+		shared.add(MakeName(i % N_SHARED), L"Value", L"");
+	}
+
+	Document named(Document::DT_NAME, Languages[0]);
+	double   start = Now();
+	named.addStrings(unique, Document::AM_UNION);
+	double   namedTime = Now() - start;
+
+	start = Now();
+	for (size_t i = 0; i < N_ROWS; i++)
+	{
+		Sink = Sink + named.findString(unique[i].m_name.c_str());
+	}
+	double findTime = Now() - start;
+	printf("%u distinct names: import %.3f s, findString() %.1f ns\n",
+		(unsigned int)N_ROWS, namedTime, findTime * 1e9 / N_ROWS);
+
+	Document indexed(Document::DT_INDEX, Languages[0]);
+	start = Now();
+	indexed.addStrings(shared, Document::AM_UNION);
+	double indexedTime = Now() - start;
+
+	start = Now();
+	for (size_t i = 0; i < N_ROWS; i++)
+	{
+		indexed.deleteString((unsigned int)i);
+	}
+	double deleteTime = Now() - start;
+	printf("%u rows with %u names: import %.3f s, delete %.3f s\n",
+		(unsigned int)N_ROWS, (unsigned int)N_SHARED, indexedTime, deleteTime);
+}
+
+//
+// Overwrite imports
+//
+
+// Imports 100,000 rows over an index document of 100,000 strings, with a
+// new row every 1000 rows, every 1000th string left out and a block of 50
+// moved to the end
+static void BenchOverwrite()
+{
+	static const size_t N_STRINGS = 100000;
+
+	Document doc(Document::DT_INDEX, Languages[0]);
+	for (size_t i = 0; i < N_STRINGS; i++)
+	{
+		unsigned int     id = doc.addString();
+		Document::String str;
+		str.m_position = id;
+		str.m_name     = MakeName(i);
+		str.m_value    = MakeValue(Languages[0]);
+		doc.setString(id, str);
+	}
+
+	StringList rows;
+	rows.reserve(N_STRINGS + N_STRINGS / 1000);
+	for (size_t i = 0; i < N_STRINGS; i++)
+	{
+		if (i % 1000 == 500)
+		{
+			rows.add(MakeName(N_STRINGS + i), MakeValue(Languages[0]), L"");
+		}
+		if (i % 1000 != 999 && (i < N_STRINGS / 2 || i >= N_STRINGS / 2 + 50))
+		{
+			rows.add(MakeName(i), MakeValue(Languages[0]), L"");
+		}
+	}
+	for (size_t i = N_STRINGS / 2; i < N_STRINGS / 2 + 50; i++)
+	{
+		rows.add(MakeName(i), MakeValue(Languages[0]), L"");
+	}
+
+	Document::ImportReport report;
+	double start = Now();
+	doc.addStrings(rows, Document::AM_OVERWRITE, &report);
+	double time = Now() - start;
+	printf("%u rows over %u strings: %.3f s, %lu overwritten, %lu moved in %lu blocks, %lu inserted, %lu missing; %u strings\n",
+		(unsigned int)rows.size(), (unsigned int)N_STRINGS, time, report.m_overwritten, report.m_moved, report.m_movedBlocks,
+		report.m_inserted, report.m_missing, (unsigned int)doc.getStrings().size());
+}
+
+//
+// Pasting
+//
+
+// Replays the document side of pasting 50,000 rows into the middle of an
+// index document of 50,000 strings: every row is added and set, its time is
+// formatted for the list, and the strings after it move down. Once the way
+// it was done before batches, with the time formatted for every row, and
+// once in a batch as Application::DoPaste() does now.
+static void Paste(bool batch)
+{
+	static const size_t N_STRINGS = 50000;
+	static const size_t N_ROWS    = 50000;
+
+	Document doc(Document::DT_INDEX, Languages[0]);
+	for (size_t i = 0; i < N_STRINGS; i++)
+	{
+		unsigned int     id = doc.addString();
+		Document::String str;
+		str.m_position = id;
+		str.m_name     = MakeName(i);
+		str.m_value    = MakeValue(Languages[0]);
+		doc.setString(id, str);
+	}
+
+	vector<Document::String> rows(N_ROWS);
+	for (size_t j = 0; j < N_ROWS; j++)
+	{
+		rows[j].m_position = (unsigned long)(N_STRINGS / 2 + j);
+		rows[j].m_name     = MakeName(N_STRINGS + j);
+		rows[j].m_value    = MakeValue(Languages[0]);
+	}
+
+	double   start = Now();
+	uint64_t time  = 0;
+	wstring  modified;
+	size_t   formatted = 0;
+	if (batch)
+	{
+		doc.beginBatch();
+	}
+	for (size_t j = 0; j < N_ROWS; j++)
+	{
+		unsigned int id = doc.addString();
+		doc.setString(id, rows[j]);
+		const Document::StringInfo& info = doc.getString(id);
+		if (!batch || modified.empty() || info.m_modified != time)
+		{
+			time     = info.m_modified;
+			modified = DateTime(time).formatShort();
+			formatted++;
+		}
+	}
+	for (size_t i = N_STRINGS / 2; i < N_STRINGS; i++)
+	{
+		doc.setPosition((unsigned int)i, (unsigned int)(i + N_ROWS));
+	}
+	if (batch)
+	{
+		doc.commitBatch();
+	}
+	double elapsed = Now() - start;
+
+	printf("%-10s %.3f s, %u times formatted\n", batch ? "batched" : "unbatched", elapsed, (unsigned int)formatted);
+}
+
+static void BenchPaste()
+{
+	Paste(false);
+	Paste(true);
+}
+
+//
+// Set operations
+//
+
+// Imports 500,000 rows into a document of 500,000 strings with half of the
+// names in common, with every name-based method
+static void BenchSetOperations()
+{
+	static const size_t N_ROWS = 500000;
+
+	StringList strings, rows;
+	strings.reserve(N_ROWS);
+	rows.reserve(N_ROWS);
+	for (size_t i = 0; i < N_ROWS; i++)
+	{
+		strings.add(MakeName(i), L"Value", L"");
+		rows.add(MakeName(i + N_ROWS / 2), L"Row", L"");
+	}
+
+	static const char* Names[4] = {"union", "union overwrite", "intersect", "difference"};
+	for (int method = Document::AM_UNION; method <= Document::AM_DIFFERENCE; method++)
+	{
+		Document doc(Document::DT_NAME, Languages[0]);
+		doc.addStrings(strings, Document::AM_UNION);
+
+		Document::ImportReport report;
+		double start = Now();
+		doc.addStrings(rows, (Document::Method)method, &report);
+		double time = Now() - start;
+		printf("%-16s %.3f s: %lu inserted, %lu overwritten, %lu removed\n", Names[method], time,
+			report.m_inserted, report.m_overwritten, report.m_removed);
+	}
+}
+
+struct BENCHMARK
+{
+	const char* name;
+	void      (*run)();
+};
+
+static const int N_BENCHMARKS = 8;
+static const BENCHMARK Benchmarks[N_BENCHMARKS] = {
+	{"buffering", BenchBuffering},
+	{"changes",   BenchChanges},
+	{"interning", BenchInterning},
+	{"names",     BenchNames},
+	{"offsets",   BenchOffsets},
+	{"overwrite", BenchOverwrite},
+	{"paste",     BenchPaste},
+	{"setops",    BenchSetOperations},
+};
+
+// Labels the results with the build they were measured on
+static void PrintPlatform()
+{
+#if defined(_MSC_VER)
+	printf("MSVC %d", _MSC_VER);
+#elif defined(__clang__)
+	printf("clang %s", __clang_version__);
+#elif defined(__GNUC__)
+	printf("g++ %s", __VERSION__);
+#endif
+#if defined(_WIN32)
+	printf(", Windows");
+#elif defined(__linux__)
+	printf(", Linux");
+#endif
+	printf(", %d-bit, %d-bit wchar_t", (int)sizeof(void*) * 8, (int)sizeof(wchar_t) * 8);
+#ifdef NDEBUG
+	printf(", release build\n");
+#else
+	printf(", debug build\n");
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+	PrintPlatform();
+	for (int i = 0; i < N_BENCHMARKS; i++)
+	{
+		bool run = (argc == 1);
+		for (int j = 1; j < argc; j++)
+		{
+			run = run || strcmp(argv[j], Benchmarks[i].name) == 0;
+		}
+		if (run)
+		{
+			printf("%s:\n", Benchmarks[i].name);
+			Benchmarks[i].run();
+		}
+	}
+	return 0;
+}
\ No newline at end of file
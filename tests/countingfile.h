@@ -0,0 +1,33 @@
+#ifndef COUNTINGFILE_H
+#define COUNTINGFILE_H
+
+#include "files.h"
+
+// Passes everything on to another file and counts the reads, writes, seeks
+// and truncates. On a PhysicalFile, every read, write and truncate is a
+// system call.
+class CountingFile : public IFile
+{
+public:
+	unsigned long m_reads;
+	unsigned long m_writes;
+	unsigned long m_seeks;
+	unsigned long m_truncates;
+
+	unsigned long calls() const { return m_reads + m_writes + m_seeks + m_truncates; }
+
+	bool          eof()                      { return m_file.eof(); }
+	unsigned long size()                     { return m_file.size(); }
+	unsigned long tell()                     { return m_file.tell(); }
+	void          seek(unsigned long offset) { m_seeks++; m_file.seek(offset); }
+	unsigned long read(void* buffer, unsigned long size)        { m_reads++;  return m_file.read(buffer, size); }
+	unsigned long write(const void* buffer, unsigned long size) { m_writes++; return m_file.write(buffer, size); }
+	void          truncate()                 { m_truncates++; m_file.truncate(); }
+
+	CountingFile(IFile& file) : m_reads(0), m_writes(0), m_seeks(0), m_truncates(0), m_file(file) {}
+
+private:
+	IFile& m_file;
+};
+
+#endif
@@ -0,0 +1,1164 @@
+// Headless round-trip tests for the in-memory files, string lists and
+// documents. Returns nonzero if a check failed.
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "align.h"
+#include "countingfile.h"
+#include "document.h"
+#include "exceptions.h"
+#include "files.h"
+#include "nameindex.h"
+#include "strbuf.h"
+#include "stringlist.h"
+#include "utils.h"
+using namespace std;
+
+static int Checks   = 0;
+static int Failures = 0;
+
+#define CHECK(cond) Check((cond), #cond, __LINE__)
+
+static void Check(bool ok, const char* expr, int line)
+{
+	Checks++;
+	if (!ok)
+	{
+		Failures++;
+		printf("tests.cpp(%d): check failed: %s\n", line, expr);
+	}
+}
+
+// The tests use their own generator, so they do the same on every platform
+static unsigned long Random()
+{
+	static unsigned long seed = 12345;
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7FFF;
+}
+
+// Compares size bytes at data with the bytes of ref at offset
+static bool Equal(const void* data, const vector<char>& ref, size_t offset, size_t size)
+{
+	return size == 0 || memcmp(data, &ref[offset], size) == 0;
+}
+
+//
+// MemoryFile and ConstMemoryFile
+//
+
+// Random reads, writes, seeks, truncates and views must do the same to a
+// MemoryFile as to a plain vector
+static void TestMemoryFile()
+{
+	for (int round = 0; round < 100; round++)
+	{
+		MemoryFile    file;
+		vector<char>  ref;
+		unsigned long pos = 0;
+		for (int op = 0; op < 300; op++)
+		{
+			char          buffer[64];
+			unsigned long size = Random() % sizeof buffer;
+			switch (Random() % 5)
+			{
+			case 0:
+			case 1:
+				for (unsigned long i = 0; i < size; i++)
+				{
+					buffer[i] = (char)Random();
+				}
+				CHECK(file.write(buffer, size) == size);
+				if (pos + size > ref.size())
+				{
+					ref.resize(pos + size);
+				}
+				if (size > 0)
+				{
+					memcpy(&ref[pos], buffer, size);
+				}
+				pos += size;
+				break;
+
+			case 2:
+			{
+				unsigned long expected = min(size, (unsigned long)ref.size() - pos);
+				unsigned long read     = file.read(buffer, size);
+				CHECK(read == expected && Equal(buffer, ref, pos, read));
+				pos += expected;
+				break;
+			}
+
+			case 3:
+			{
+				unsigned long offset = Random() % (ref.size() + 5);
+				file.seek(offset);
+				pos = min(offset, (unsigned long)ref.size());
+				break;
+			}
+
+			case 4:
+				if (Random() % 3 == 0)
+				{
+					file.truncate();
+					ref.resize(pos);
+				}
+				else
+				{
+					const void* view = file.view(size);
+					if (pos + size > ref.size())
+					{
+						CHECK(view == NULL);
+					}
+					else if (!ref.empty())
+					{
+						CHECK(view != NULL && Equal(view, ref, pos, size));
+						pos += size;
+					}
+				}
+				break;
+			}
+			CHECK(file.tell() == pos && file.size() == ref.size() && file.eof() == (pos == ref.size()));
+		}
+		CHECK(file.data() == ref);
+
+		// swap() hands the data over and starts the file over
+		vector<char> data;
+		file.swap(data);
+		CHECK(data == ref && file.size() == 0 && file.tell() == 0);
+	}
+}
+
+// A ConstMemoryFile reads like a MemoryFile and can't be written
+static void TestConstMemoryFile()
+{
+	vector<char> ref(1000);
+	for (size_t i = 0; i < ref.size(); i++)
+	{
+		ref[i] = (char)Random();
+	}
+
+	ConstMemoryFile file(&ref[0], (unsigned long)ref.size());
+	unsigned long   pos = 0;
+	for (int op = 0; op < 2000; op++)
+	{
+		char          buffer[64];
+		unsigned long size   = Random() % sizeof buffer;
+		unsigned long offset = Random() % (ref.size() + 50);
+		file.seek(offset);
+		pos = min(offset, (unsigned long)ref.size());
+		if (Random() % 2)
+		{
+			unsigned long expected = min(size, (unsigned long)ref.size() - pos);
+			CHECK(file.read(buffer, size) == expected && Equal(buffer, ref, pos, expected));
+			pos += expected;
+		}
+		else
+		{
+			const void* view = file.view(size);
+			if (pos + size > ref.size())
+			{
+				CHECK(view == NULL);
+			}
+			else
+			{
+				CHECK(view == &ref[0] + pos);
+				pos += size;
+			}
+		}
+		CHECK(file.tell() == pos && file.eof() == (pos == ref.size()));
+	}
+
+	bool threw = false;
+	try
+	{
+		file.write("x", 1);
+	}
+	catch (WriteException&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	threw = false;
+	try
+	{
+		file.truncate();
+	}
+	catch (WriteException&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+// Random reads, seeks and views through a MappedFile see the bytes of file,
+// which holds ref from start on
+static void CheckMappedFile(IFile& file, const vector<char>& ref, unsigned long start, bool mapped)
+{
+	file.seek(start);
+	MappedFile    input(file);
+	unsigned long pos = start;
+	CHECK(input.tell() == start && input.size() == ref.size());
+	for (int op = 0; op < 2000; op++)
+	{
+		char          buffer[64];
+		unsigned long size = Random() % sizeof buffer;
+		switch (Random() % 3)
+		{
+		case 0:
+		{
+			unsigned long expected = min(size, (unsigned long)ref.size() - pos);
+			CHECK(input.read(buffer, size) == expected && Equal(buffer, ref, pos, expected));
+			pos += expected;
+			break;
+		}
+
+		case 1:
+		{
+			const void* view = input.view(size);
+			if (!mapped || pos + size > ref.size())
+			{
+				CHECK(view == NULL);
+			}
+			else
+			{
+				CHECK(view != NULL && Equal(view, ref, pos, size));
+				pos += size;
+			}
+			break;
+		}
+
+		case 2:
+		{
+			unsigned long offset = Random() % (ref.size() + 50);
+			input.seek(offset);
+			pos = min(offset, (unsigned long)ref.size());
+			break;
+		}
+		}
+		CHECK(input.tell() == pos && input.eof() == (pos == ref.size()));
+	}
+
+	bool threw = false;
+	try
+	{
+		input.write("x", 1);
+	}
+	catch (WriteException&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+// A file on disk is viewed in place, a file in memory is read
+static void TestMappedFile()
+{
+	static const wchar_t* Filename = L"tests.bin";
+
+	vector<char> ref(100000);
+	for (size_t i = 0; i < ref.size(); i++)
+	{
+		ref[i] = (char)Random();
+	}
+	{
+		PhysicalFile file(Filename, PhysicalFile::WRITE);
+		file.write(&ref[0], (unsigned long)ref.size());
+	}
+	{
+		PhysicalFile file(Filename);
+		CheckMappedFile(file, ref, 0, true);
+		CheckMappedFile(file, ref, 1234, true);
+	}
+
+	MemoryFile memory;
+	memory.write(&ref[0], (unsigned long)ref.size());
+	CheckMappedFile(memory, ref, 0, false);
+
+	// An empty file can't be mapped, but reads the same
+	{
+		PhysicalFile file(Filename, PhysicalFile::WRITE);
+	}
+	{
+		PhysicalFile file(Filename);
+		MappedFile   input(file);
+		char         buffer[16];
+		CHECK(input.size() == 0 && input.eof() && input.read(buffer, sizeof buffer) == 0);
+		CHECK(input.view(0) == NULL && input.view(1) == NULL);
+	}
+	remove("tests.bin");
+}
+
+// Random reads, writes, seeks and truncates through a BufferedFile with
+// small buffers must leave file with the same bytes as a MemoryFile that
+// started out the same, read the same and go to file in fewer calls
+static void CheckBufferedFile(IFile& file)
+{
+	MemoryFile   ref;
+	vector<char> bytes(file.size());
+	file.seek(0);
+	CHECK(bytes.empty() || file.read(&bytes[0], (unsigned long)bytes.size()) == bytes.size());
+	if (!bytes.empty())
+	{
+		ref.write(&bytes[0], (unsigned long)bytes.size());
+	}
+	file.seek(0);
+	ref.seek(0);
+
+	CountingFile  counting(file);
+	unsigned long direct = 0;
+	{
+		BufferedFile buffered(counting, 1 + Random() % 100, 1 + Random() % 100);
+		for (int op = 0; op < 5000; op++)
+		{
+			char          buffer[300], expected[300];
+			unsigned long size = Random() % sizeof buffer;
+			switch (Random() % 6)
+			{
+			case 0:
+			case 1:
+				for (unsigned long i = 0; i < size; i++)
+				{
+					buffer[i] = (char)Random();
+				}
+				CHECK(buffered.write(buffer, size) == size);
+				ref.write(buffer, size);
+				break;
+
+			case 2:
+			case 3:
+			{
+				unsigned long n = ref.read(expected, size);
+				CHECK(buffered.read(buffer, size) == n && memcmp(buffer, expected, n) == 0);
+				break;
+			}
+
+			case 4:
+			{
+				unsigned long offset = Random() % (ref.size() + 50);
+				buffered.seek(offset);
+				ref.seek(offset);
+				break;
+			}
+
+			case 5:
+				if (Random() % 10 == 0)
+				{
+					buffered.truncate();
+					ref.truncate();
+				}
+				break;
+			}
+			direct++;
+			CHECK(buffered.tell() == ref.tell() && buffered.size() == ref.size() && buffered.eof() == ref.eof());
+		}
+		buffered.flush();
+	}
+
+	CHECK(file.size() == ref.size());
+	bytes.resize(file.size());
+	file.seek(0);
+	CHECK(bytes.empty() || file.read(&bytes[0], (unsigned long)bytes.size()) == bytes.size());
+	CHECK(bytes == ref.data());
+	CHECK(counting.m_reads + counting.m_writes + counting.m_truncates < direct);
+}
+
+static void TestBufferedFile()
+{
+	char previous[1000];
+	for (size_t i = 0; i < sizeof previous; i++)
+	{
+		previous[i] = (char)Random();
+	}
+
+	for (int round = 0; round < 20; round++)
+	{
+		MemoryFile memory;
+		memory.write(previous, (round % 2) ? sizeof previous : 0);
+		CheckBufferedFile(memory);
+	}
+
+	// The same on disk, over what was there before
+	for (int round = 0; round < 5; round++)
+	{
+		{
+			PhysicalFile file(L"tests.bin", PhysicalFile::WRITE);
+			file.write(previous, sizeof previous);
+		}
+		PhysicalFile file(L"tests.bin", PhysicalFile::UPDATE);
+		CheckBufferedFile(file);
+	}
+	remove("tests.bin");
+}
+
+//
+// StringBuffer
+//
+
+// Returns whether reading the string at offset throws BadFileException
+static bool IsBadString(const StringBuffer& pool, uint32_t offset, const wstring& expected)
+{
+	try
+	{
+		const wchar_t* str = pool.getString(offset);
+		CHECK(str != NULL && expected == str);
+		return false;
+	}
+	catch (BadFileException&)
+	{
+		return true;
+	}
+}
+
+static void TestStringBuffer()
+{
+	StringBuffer     pool;
+	vector<wstring>  strings(20000);
+	vector<uint32_t> offsets(strings.size());
+	for (size_t i = 0; i < strings.size(); i++)
+	{
+		strings[i] = FormatString(L"String %u %u", (unsigned int)i, (unsigned int)Random());
+		pool.addString(strings[i]);
+	}
+	for (size_t i = 0; i < strings.size(); i++)
+	{
+		offsets[i] = pool.getStringOffset(strings[i].c_str());
+	}
+
+	MemoryFile file;
+	pool.writeBlocks(file, true);
+	unsigned long index = file.tell();
+	pool.writeIndex(file);
+	vector<char> data(file.data());
+
+	// The index: the pool size and block count, then length, packed size,
+	// offset and CRC per block
+	uint32_t info[2];
+	memcpy(info, &data[index], sizeof info);
+	unsigned long    nBlocks = letohl(info[1]);
+	vector<uint32_t> entries(nBlocks * 4);
+	CHECK(nBlocks > 2 && data.size() == index + sizeof info + entries.size() * sizeof(uint32_t));
+	memcpy(&entries[0], &data[index + sizeof info], entries.size() * sizeof(uint32_t));
+
+	// Damage the middle block. Opening doesn't notice, only using its strings.
+	size_t   bad   = nBlocks / 2;
+	uint32_t start = 0;
+	for (size_t i = 0; i < bad; i++)
+	{
+		start += letohl(entries[i * 4]);
+	}
+	uint32_t end = start + letohl(entries[bad * 4]);
+	data[letohl(entries[bad * 4 + 2]) + letohl(entries[bad * 4 + 1]) / 2] ^= 0x5A;
+	{
+		ConstMemoryFile input(&data[0], (unsigned long)data.size());
+		input.seek(index);
+		StringBuffer loaded;
+		loaded.readBlocks(input, true);
+		CHECK(input.tell() == data.size());
+
+		bool ok = true;
+		for (size_t i = 0; i < strings.size(); i++)
+		{
+			bool inBad = (offsets[i] >= start && offsets[i] < end);
+			ok = ok && IsBadString(loaded, offsets[i], strings[i]) == inBad;
+		}
+		CHECK(ok);
+	}
+
+	// An index without CRCs, as in older files, still reads. Writing it again
+	// rewrites the blocks, with a checked index.
+	data = file.data();
+	MemoryFile unchecked;
+	unchecked.write(&data[0], index);
+	unchecked.write(info, sizeof info);
+	for (size_t i = 0; i < nBlocks; i++)
+	{
+		unchecked.write(&entries[i * 4], 3 * sizeof(uint32_t));
+	}
+	{
+		ConstMemoryFile input(&unchecked.data()[0], unchecked.size());
+		input.seek(index);
+		StringBuffer loaded;
+		loaded.readBlocks(input, false);
+		CHECK(input.tell() == unchecked.size());
+
+		MemoryFile again;
+		again.write(&data[0], index);
+		loaded.writeBlocks(again, false);
+		unsigned long newIndex = again.tell();
+		CHECK(newIndex == index * 2);
+		loaded.writeIndex(again);
+
+		ConstMemoryFile reread(&again.data()[0], again.size());
+		reread.seek(newIndex);
+		StringBuffer copy;
+		copy.readBlocks(reread, true);
+
+		bool ok = true;
+		for (size_t i = 0; i < strings.size(); i++)
+		{
+			ok = ok && !IsBadString(copy, offsets[i], strings[i]) && !IsBadString(loaded, offsets[i], strings[i]);
+		}
+		CHECK(ok);
+	}
+}
+
+//
+// StringList
+//
+
+static void FillList(StringList& list, size_t count)
+{
+	list.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		// Names are stored as ANSI, values as UCS-2
+		wstring value = (i % 7 == 0) ? L"" : FormatString(L"Value %u \x00E9\x4E2D %u", (unsigned int)i, (unsigned int)Random());
+		list.add(FormatString(L"NAME_%u", (unsigned int)(i * 7919 % 100003)), value, L"");
+	}
+}
+
+// Compares two lists string by string
+static bool SameStrings(const StringList& a, const StringList& b)
+{
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		// The const operator[] of a mapped list reuses one buffer
+		StringList::StringInfo left = a[i];
+		const StringList::StringInfo& right = b[i];
+		if (left.m_name != right.m_name || left.m_value != right.m_value)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void TestStringList()
+{
+	StringList list;
+	FillList(list, 2000);
+
+	// Unsorted, the order is kept
+	MemoryFile file;
+	list.write(file);
+	{
+		ConstMemoryFile input(&file.data()[0], file.size());
+		StringList      copy(input);
+		CHECK(SameStrings(list, copy));
+
+		// A list that's read in place writes the same bytes
+		MemoryFile again;
+		copy.write(again);
+		CHECK(again.data() == file.data());
+	}
+	{
+		file.seek(0);
+		StringList copy(file);
+		CHECK(SameStrings(list, copy));
+	}
+
+	// Sorted, every string can still be found
+	MemoryFile sorted;
+	list.write(sorted, true);
+	{
+		ConstMemoryFile input(&sorted.data()[0], sorted.size());
+		StringList      copy(input);
+		CHECK(copy.size() == list.size());
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			StringList::const_iterator p = copy.find(list[i].m_name);
+			CHECK(p != copy.end() && p->m_value == list[i].m_value);
+		}
+	}
+
+	// An empty list
+	StringList empty;
+	MemoryFile emptyFile;
+	empty.write(emptyFile);
+	{
+		ConstMemoryFile input(&emptyFile.data()[0], emptyFile.size());
+		StringList      copy(input);
+		CHECK(copy.size() == 0);
+	}
+}
+
+//
+// NameIndex
+//
+
+struct Name
+{
+	const wchar_t* m_name;
+};
+
+typedef NameIndex<vector<Name> > TestIndex;
+
+// Random inserts and erases over a few names must keep the count, the
+// lowest id and the chain of every name the same as a multimap's
+static void TestNameIndex()
+{
+	static const wchar_t* Names[6] = {L"", L"A", L"B", L"TEXT_A", L"TEXT_B", L"TEXT_C"};
+
+	vector<Name>                    names(500);
+	vector<bool>                    indexed(names.size());
+	multimap<wstring, unsigned int> ref;
+	TestIndex                       index;
+	for (int op = 0; op < 20000; op++)
+	{
+		unsigned int id = (unsigned int)(Random() % names.size());
+		if (!indexed[id])
+		{
+			names[id].m_name = Names[Random() % 6];
+			size_t count = index.insert(id, names);
+			ref.insert(make_pair(wstring(names[id].m_name), id));
+			CHECK(count == ref.count(names[id].m_name));
+		}
+		else
+		{
+			size_t count = index.erase(id, names);
+			multimap<wstring, unsigned int>::iterator p = ref.lower_bound(names[id].m_name);
+			while (p->second != id)
+			{
+				p++;
+			}
+			ref.erase(p);
+			CHECK(count == ref.count(names[id].m_name));
+		}
+		indexed[id] = !indexed[id];
+
+		const wchar_t*    name   = Names[Random() % 6];
+		unsigned int      lowest = TestIndex::NO_ID;
+		set<unsigned int> ids;
+		for (multimap<wstring, unsigned int>::const_iterator p = ref.lower_bound(name); p != ref.end() && p->first == name; p++)
+		{
+			lowest = min(lowest, p->second);
+			ids.insert(p->second);
+		}
+		CHECK(index.count(name, names) == ids.size() && index.find(name, names) == lowest);
+
+		set<unsigned int> chain;
+		for (unsigned int i = index.first(name, names); i != TestIndex::NO_ID && chain.size() <= ids.size(); i = index.next(i))
+		{
+			chain.insert(i);
+		}
+		CHECK(chain == ids);
+	}
+}
+
+//
+// Alignment
+//
+
+// Every match pairs equal symbols, and the matches are in increasing order
+// of b. Returns the number of matches.
+static size_t CheckAlignment(const vector<uint32_t>& a, const vector<uint32_t>& b, const vector<uint32_t>& match)
+{
+	size_t   count = 0;
+	uint32_t last  = NO_MATCH;
+	CHECK(match.size() == a.size());
+	for (size_t i = 0; i < match.size(); i++)
+	{
+		if (match[i] != NO_MATCH)
+		{
+			CHECK(match[i] < b.size() && a[i] == b[match[i]]);
+			CHECK(last == NO_MATCH || match[i] > last);
+			last = match[i];
+			count++;
+		}
+	}
+	return count;
+}
+
+static void TestAlign()
+{
+	vector<uint32_t> a, b, match;
+
+	// Empty sequences
+	align(a, b, 0, match);
+	CHECK(match.empty());
+	a.push_back(0);
+	align(a, b, 1, match);
+	CHECK(match.size() == 1 && match[0] == NO_MATCH);
+
+	for (int round = 0; round < 50; round++)
+	{
+		// Distinct symbols, with some of them removed and new ones inserted:
+		// everything that's left is matched
+		size_t n = 100 + Random() % 1000;
+		a.clear();
+		b.clear();
+		size_t kept = 0;
+		for (uint32_t i = 0; i < n; i++)
+		{
+			a.push_back(i);
+			if (Random() % 10 == 0)
+			{
+				b.push_back((uint32_t)(n + b.size()));
+			}
+			if (Random() % 10 != 0)
+			{
+				b.push_back(i);
+				kept++;
+			}
+		}
+		align(a, b, n + b.size(), match);
+		CHECK(CheckAlignment(a, b, match) == kept);
+
+		// A block moved elsewhere: either the block or what it moved past is
+		// left unmatched, and the rest is matched
+		size_t size  = 1 + Random() % 50;
+		size_t from  = Random() % (n - size);
+		size_t to    = Random() % (n - size);
+		b.assign(a.begin(), a.end());
+		vector<uint32_t> block(b.begin() + from, b.begin() + from + size);
+		b.erase(b.begin() + from, b.begin() + from + size);
+		b.insert(b.begin() + to, block.begin(), block.end());
+		align(a, b, n, match);
+		size_t moved = (from > to) ? from - to : to - from;
+		CHECK(CheckAlignment(a, b, match) == n - min(size, moved));
+
+		// Repeated symbols still give a valid alignment, and equal
+		// sequences match completely
+		for (size_t i = 0; i < n; i++)
+		{
+			a[i] = (uint32_t)(Random() % 20);
+		}
+		b.assign(a.begin(), a.end());
+		align(a, b, 20, match);
+		CHECK(CheckAlignment(a, b, match) == n);
+		for (size_t i = 0; i < n; i++)
+		{
+			if (Random() % 4 == 0)
+			{
+				b[i] = (uint32_t)(Random() % 20);
+			}
+		}
+		align(a, b, 20, match);
+		CheckAlignment(a, b, match);
+	}
+}
+
+// An overwrite import of an index document's rows, with rows inserted,
+// removed and moved, overwrites each string that's still in the rows
+static void TestOverwrite()
+{
+	Document doc(Document::DT_INDEX, 1033);
+	for (unsigned int i = 0; i < 1000; i++)
+	{
+		unsigned int     id = doc.addString();
+		Document::String str;
+		str.m_name     = FormatString(L"STRING_%u", i);
+		str.m_value    = FormatString(L"Old %u", i);
+		str.m_position = id;
+		doc.setString(id, str);
+	}
+
+	// Remove every 50th string, insert a new row every 40 and move a block
+	// of 20 from the middle to the end
+	StringList     list;
+	vector<size_t> order;
+	for (size_t i = 0; i < 1000; i++)
+	{
+		if (i % 50 != 7 && (i < 510 || i >= 530))
+		{
+			order.push_back(i);
+		}
+		if (i % 40 == 0)
+		{
+			order.push_back(1000 + i);
+		}
+	}
+	for (size_t i = 510; i < 530; i++)
+	{
+		order.push_back(i);
+	}
+	for (size_t j = 0; j < order.size(); j++)
+	{
+		list.add(FormatString(L"STRING_%u", (unsigned int)order[j]), FormatString(L"New %u", (unsigned int)order[j]), L"");
+	}
+
+	Document::ImportReport report;
+	doc.addStrings(list, Document::AM_OVERWRITE, &report);
+	CHECK(report.m_inserted == 25 && report.m_insertedBlocks == 25);
+	CHECK(report.m_missing == 20 && report.m_missingBlocks == 20);
+	CHECK(report.m_moved == 20 && report.m_movedBlocks == 1);
+	CHECK(report.m_overwritten + report.m_moved + report.m_inserted == order.size());
+
+	// Every string that's in the rows has its new value, the others their old one
+	CHECK(doc.getStrings().size() == 1025);
+	for (unsigned int id = 0; id < doc.getStrings().size(); id++)
+	{
+		unsigned int number = 0;
+		swscanf(doc.getString(id).m_name, L"STRING_%u", &number);
+		bool inRows = number >= 1000 || number % 50 != 7;
+		CHECK(wcscmp(doc.getValue(id), FormatString(inRows ? L"New %u" : L"Old %u", number).c_str()) == 0);
+	}
+}
+
+//
+// Document
+//
+
+// Describes every string of every language in every version
+static wstring Describe(Document& doc)
+{
+	wstring description;
+	LANGID  active = doc.getActiveLanguage();
+
+	vector<Document::VersionInfo> versions;
+	doc.getVersions(versions);
+	for (int v = 0; v < (int)versions.size(); v++)
+	{
+		doc.setActiveVersion(v);
+		description += FormatString(L"Version %d by %ls: %ls\n", v, versions[v].m_author.c_str(), versions[v].m_notes.c_str());
+
+		set<LANGID> languages;
+		doc.getLanguages(languages, v);
+		for (set<LANGID>::const_iterator l = languages.begin(); l != languages.end(); l++)
+		{
+			doc.setActiveLanguage(*l);
+			description += FormatString(L"Language %u\n", (unsigned int)*l);
+			for (unsigned int id = 0; id < doc.getStrings().size(); id++)
+			{
+				const Document::StringInfo& info = doc.getString(id, v);
+				if (info.m_name != NULL)
+				{
+					const wchar_t* value = doc.getValue(id, v);
+					description += FormatString(L"%u %lu %ls=%ls (%ls)\n", id, info.m_position, info.m_name,
+						(value != NULL) ? value : L"", (info.m_comment != NULL) ? info.m_comment : L"");
+				}
+			}
+		}
+	}
+	doc.setActiveVersion();
+	doc.setActiveLanguage(active);
+	return description;
+}
+
+// Adds and changes strings in every language of the document
+static void Edit(Document& doc, int version)
+{
+	set<LANGID> languages;
+	doc.getLanguages(languages);
+	for (int i = 0; i < 100; i++)
+	{
+		unsigned int id = (version == 0 || Random() % 4 == 0) ? doc.addString() : (unsigned int)(Random() % doc.getStrings().size());
+		if (doc.getStrings()[id].m_name == NULL)
+		{
+			continue;
+		}
+
+		for (set<LANGID>::const_iterator l = languages.begin(); l != languages.end(); l++)
+		{
+			doc.setActiveLanguage(*l);
+			Document::String str;
+			str.m_name     = FormatString(L"STRING_%u", id);
+			str.m_value    = FormatString(L"Value %u in %u, version %d \x00E9", (unsigned int)Random(), (unsigned int)*l, version);
+			str.m_comment  = FormatString(L"Comment %u", id);
+			str.m_position = id;
+			doc.setString(id, str);
+		}
+	}
+	unsigned int id = (unsigned int)(Random() % doc.getStrings().size());
+	if (version % 5 == 4 && doc.getStrings()[id].m_name != NULL)
+	{
+		doc.deleteString(id);
+	}
+}
+
+// Saves a version into file the way the application does and checks that
+// the file reads back as the document
+static void Save(Document& doc, MemoryFile& file, int version, bool append)
+{
+	doc.saveVersion(FormatString(L"Author %d", version % 3), FormatString(L"Notes %d", version));
+	doc.detach();
+	if (append && doc.canAppend())
+	{
+		doc.append(file);
+	}
+	else
+	{
+		file.seek(0);
+		doc.write(file);
+		file.truncate();
+	}
+	doc.increaseVersion();
+	doc.setActiveVersion();
+
+	wstring expected = Describe(doc);
+	{
+		ConstMemoryFile input(&file.data()[0], file.size());
+		Document        copy(input);
+		CHECK(Describe(copy) == expected);
+
+	}
+	{
+		file.seek(0);
+		Document copy(file);
+		CHECK(Describe(copy) == expected);
+	}
+}
+
+static void TestDocument(Document::Type type, bool append)
+{
+	Document doc(type, 1033);
+	doc.addLanguage(1031);
+
+	MemoryFile file;
+	for (int v = 0; v < 25; v++)
+	{
+		if (v == 10)
+		{
+			doc.addLanguage(1036);
+		}
+		Edit(doc, v);
+		Save(doc, file, v, append);
+	}
+
+	// A document read from memory can be saved again
+	ConstMemoryFile input(&file.data()[0], file.size());
+	Document        copy(input);
+	Edit(copy, 25);
+	Save(copy, file, 25, append);
+}
+
+// Saves to a file on disk and opens it the way the application does, so the
+// string pools are used straight from the mapped file
+static void TestPhysicalDocument(Document::Type type)
+{
+	static const wchar_t* Filename = L"tests.vdf";
+
+	Document doc(type, 1033);
+	doc.addLanguage(1031);
+	for (int v = 0; v < 10; v++)
+	{
+		Edit(doc, v);
+		doc.saveVersion(FormatString(L"Author %d", v % 3), FormatString(L"Notes %d", v));
+		doc.detach();
+		if (v > 0 && doc.canAppend())
+		{
+			PhysicalFile file(Filename, PhysicalFile::UPDATE);
+			doc.append(file);
+		}
+		else
+		{
+			PhysicalFile file(Filename, PhysicalFile::WRITE);
+			doc.write(file);
+		}
+		doc.increaseVersion();
+		doc.setActiveVersion();
+
+		wstring expected = Describe(doc);
+		{
+			PhysicalFile file(Filename);
+			FileMapping* mapping = file.map();
+			CHECK(mapping != NULL && mapping->size() == file.size());
+			delete mapping;
+
+			MappedFile   mapped(file);
+			Document     copy(mapped);
+			CHECK(Describe(copy) == expected);
+		}
+		{
+			PhysicalFile file(Filename);
+			Document     copy(file);
+			CHECK(Describe(copy) == expected);
+		}
+	}
+	remove("tests.vdf");
+}
+
+// Exported DAT files import again with the same strings
+static void TestExport()
+{
+	Document doc(Document::DT_NAME, 1033);
+	Edit(doc, 0);
+
+	MemoryFile dat;
+	doc.exportFile(1033, dat);
+
+	ConstMemoryFile input(&dat.data()[0], dat.size());
+	StringList      list(input);
+	CHECK(list.size() == doc.getStrings().size());
+
+	Document copy(Document::DT_NAME, 1033);
+	copy.addStrings(list, Document::AM_UNION);
+	for (unsigned int id = 0; id < doc.getStrings().size(); id++)
+	{
+		const Document::StringInfo& info = doc.getString(id);
+		int found = copy.findString(info.m_name);
+		CHECK(found >= 0 && wcscmp(copy.getValue(found), doc.getValue(id)) == 0);
+	}
+}
+
+// Every import method gives the strings a simple model of it expects, with
+// duplicate names in the document and in the rows
+static void CheckSetOperation(const StringList& list, Document::Method method)
+{
+	Document doc(Document::DT_NAME, 1033);
+	for (unsigned int i = 0; i < 300; i++)
+	{
+		unsigned int     id = doc.addString();
+		Document::String str;
+		str.m_name     = FormatString(L"NAME_%u", (unsigned int)(Random() % 200));
+		str.m_value    = FormatString(L"Old %u", i);
+		str.m_position = id;
+		doc.setString(id, str);
+	}
+	if (Random() % 2)
+	{
+		doc.deleteString((unsigned int)(Random() % 300));
+	}
+
+	// The names and values of the rows; the first row with a name adds it,
+	// later rows overwrite it
+	map<wstring, wstring> first, last;
+	for (size_t j = 0; j < list.size(); j++)
+	{
+		StringList::StringInfo row = list[j];
+		first.insert(make_pair(row.m_name, row.m_value));
+		last[row.m_name] = row.m_value;
+	}
+
+	// What's left of the document, and the lowest string of every name
+	map<wstring, unsigned int> lowest;
+	vector<wstring>            expected(doc.getStrings().size());
+	vector<bool>               wasLive(doc.getStrings().size());
+	size_t                     live = 0;
+	for (unsigned int id = 0; id < doc.getStrings().size(); id++)
+	{
+		const wchar_t* name = doc.getStrings()[id].m_name;
+		if (name == NULL)
+		{
+			continue;
+		}
+		lowest.insert(make_pair(wstring(name), id));
+		wasLive[id] = true;
+		live++;
+
+		bool inRows = first.find(name) != first.end();
+		if ((method == Document::AM_INTERSECT && !inRows) || (method == Document::AM_DIFFERENCE && inRows))
+		{
+			continue;
+		}
+		expected[id] = wstring(name) + L"=" + doc.getValue(id);
+	}
+
+	Document::ImportReport report;
+	doc.addStrings(list, method, &report);
+
+	map<wstring, wstring> added;
+	size_t                kept = 0;
+	for (unsigned int id = 0; id < doc.getStrings().size(); id++)
+	{
+		const wchar_t* name = doc.getStrings()[id].m_name;
+		// Deleted strings are reused before new ones are added
+		if (id < expected.size() && wasLive[id])
+		{
+			wstring actual = (name != NULL) ? wstring(name) + L"=" + doc.getValue(id) : L"";
+			if (method == Document::AM_UNION_OVERWRITE && name != NULL && lowest[name] == id && last.count(name) > 0)
+			{
+				CHECK(actual == wstring(name) + L"=" + last[name]);
+			}
+			else
+			{
+				CHECK(actual == expected[id]);
+			}
+			kept += !expected[id].empty();
+		}
+		else if (name != NULL)
+		{
+			added[name] = doc.getValue(id);
+		}
+	}
+
+	if (method == Document::AM_UNION || method == Document::AM_UNION_OVERWRITE)
+	{
+		size_t newNames = 0;
+		for (map<wstring, wstring>::const_iterator p = first.begin(); p != first.end(); p++)
+		{
+			if (lowest.find(p->first) == lowest.end())
+			{
+				newNames++;
+				wstring value = (method == Document::AM_UNION) ? p->second : last[p->first];
+				CHECK(added.find(p->first) != added.end() && added[p->first] == value);
+			}
+		}
+		CHECK(added.size() == newNames && report.m_inserted == newNames);
+	}
+	else
+	{
+		CHECK(added.empty() && report.m_removed == live - kept);
+	}
+}
+
+static void TestSetOperations()
+{
+	static const wchar_t* Filename = L"tests.dat";
+
+	StringList list;
+	for (int j = 0; j < 300; j++)
+	{
+		list.add(FormatString(L"NAME_%u", (unsigned int)(100 + Random() % 200)), FormatString(L"Row %d", j), L"");
+	}
+	{
+		PhysicalFile file(Filename, PhysicalFile::WRITE);
+		list.write(file);
+	}
+
+	{
+		PhysicalFile file(Filename);
+		StringList   mapped(file);
+		for (int m = Document::AM_UNION; m <= Document::AM_DIFFERENCE; m++)
+		{
+			CheckSetOperation(list,   (Document::Method)m);
+			CheckSetOperation(mapped, (Document::Method)m);
+		}
+	}
+	remove("tests.dat");
+}
+
+int main()
+{
+	try
+	{
+		TestMemoryFile();
+		TestConstMemoryFile();
+		TestMappedFile();
+		TestBufferedFile();
+		TestStringBuffer();
+		TestStringList();
+		TestNameIndex();
+		TestAlign();
+		TestDocument(Document::DT_NAME,  false);
+		TestDocument(Document::DT_NAME,  true);
+		TestDocument(Document::DT_INDEX, false);
+		TestDocument(Document::DT_INDEX, true);
+		TestPhysicalDocument(Document::DT_NAME);
+		TestPhysicalDocument(Document::DT_INDEX);
+		TestExport();
+		TestOverwrite();
+		TestSetOperations();
+	}
+	catch (wexception& e)
+	{
+		printf("Unexpected exception: %ls\n", e.what());
+		return 1;
+	}
+	catch (exception& e)
+	{
+		printf("Unexpected exception: %s\n", e.what());
+		return 1;
+	}
+
+	printf("%d checks, %d failed\n", Checks, Failures);
+	return (Failures > 0) ? 1 : 0;
+}
\ No newline at end of file